@@ -0,0 +1,1308 @@
+/* bench/au_bench.c: Benchmarks for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Usage: au_bench [file]
+ *
+ * Times the hot paths of audio-utsl and prints the results to stdout
+ * as one JSON object.  Without #file, the input is 10 s of
+ * pseudo-random 16-bit stereo at 44.1 kHz, the same on every run,
+ * written to a temporary file.  No audio device is needed: everything
+ * runs against offline outputs that throw their output away.
+ *
+ * Microbenchmarks:
+ *  - ring_buffer: one block through PortAudio's PaUtilRingBuffer and
+ *    through AuRing, in one thread, and between two threads
+ *  - convert: not timed.  Checks that each conversion implementation
+ *    gives the same bytes as the scalar one, for each format.
+ *  - decode: SFReadStream_() (the reader thread's inner loop) to each
+ *    output format, with each conversion implementation, and through
+ *    the resampler at each quality
+ *  - callback: one PAPlayCallback_() call, with the ring kept full
+ *  - oscillator: stereo sine by libm sin() per frame, as Au_HL_Sine()
+ *    used to do, and AuOsc_Render() with each kernel, for one sine and
+ *    for a bank of AU_BENCH_OSCS mixed waveforms and sweeps
+ *
+ * Macro-benchmarks:
+ *  - concurrent: N outputs rendering the input at once.  Callback times
+ *    here include waiting for the reader, since offline outputs never
+ *    underrun.
+ *  - jitter: callback times, as for "callback", while another thread
+ *    keeps faulting in, dirtying and dropping AU_BENCH_PRESSURE_BYTES
+ *    of memory, and with an unlocked ring paged out before each call.
+ *    With the ring on ordinary pages, mlock()ed, and on huge pages.
+ *    Also reports the page faults taken by the calling thread.
+ *  - pipe: the input played through a pipe (Au_PlayFd()) from a fast
+ *    and a slow writer, and through a slow Au_PlayCallback(), rendered
+ *    to a file and checked against playing the file itself.  Then how
+ *    long Au_Stop() takes while each kind of source is stalled.
+ *
+ * Throughputs are the median of AU_BENCH_REPEATS runs. */
+
+/* Include the library itself, so the static functions can be timed on
+ * their own. */
+#include "audio_utsl.c"
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/** How many times to repeat each throughput measurement */
+#define AU_BENCH_REPEATS (5)
+
+/** Length of the generated input */
+#define AU_BENCH_INPUT_SECS (10)
+
+/** Callbacks timed for the callback percentiles */
+#define AU_BENCH_CALLBACKS (20000)
+
+/** Frames per callback, as a typical device would ask for */
+#define AU_BENCH_CALLBACK_FRAMES (256)
+
+/** Blocks passed through the ring in the ring-buffer benchmarks */
+#define AU_BENCH_RING_OPS (1000000)
+
+/** Frames rendered per run in the oscillator benchmark */
+#define AU_BENCH_OSC_FRAMES (441000)
+
+/** The size of the mixed bank in the oscillator benchmark */
+#define AU_BENCH_OSCS (16)
+
+/** The conversion check tries every length up to AU_BENCH_CONV_SHORT
+ * samples, and a few more up to AU_BENCH_CONV_LONG */
+#define AU_BENCH_CONV_SHORT (40)
+#define AU_BENCH_CONV_LONG (4099)
+
+/** Bytes after each conversion output that must be left alone: more
+ * than any kernel's widest store */
+#define AU_BENCH_CONV_GUARD (32)
+
+/** How much memory the jitter benchmark churns through */
+#define AU_BENCH_PRESSURE_BYTES ((size_t)256 * 1024 * 1024)
+
+/** A slow pipe source sends this many bytes at a time, this far apart:
+ * about 4 MB/s, a few times faster than 16-bit stereo plays */
+#define AU_BENCH_PIPE_CHUNK (4096)
+#define AU_BENCH_PIPE_GAP_US (1000)
+
+/** A stalling pipe source sends this much, then nothing */
+#define AU_BENCH_PIPE_STALL_BYTES (64 * 1024)
+
+/* Helpers ================================================================ */
+
+static double nowSecs_(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+} /* nowSecs_ */
+
+static int cmpDouble_(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+} /* cmpDouble_ */
+
+/** Median of #n values.  Sorts #vals. */
+static double median_(double *vals, int n)
+{
+    qsort(vals, n, sizeof(double), cmpDouble_);
+    return (n & 1) ? vals[n/2] : (vals[n/2 - 1] + vals[n/2]) / 2;
+} /* median_ */
+
+/** The #pct'th percentile of #n sorted values */
+static double percentile_(const double *sorted, long n, double pct)
+{
+    long idx = (long)(pct / 100.0 * (n - 1) + 0.5);
+    return sorted[idx];
+} /* percentile_ */
+
+/** Bytes of heap in use, or -1 if unknown */
+static long heapBytes_(void)
+{
+#if defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return (long)mallinfo2().uordblks;
+#else
+    return -1;
+#endif
+} /* heapBytes_ */
+
+static int NResults_ = 0;
+
+/** Start a result object in the "results" array */
+static void resultBegin_(const char *group, const char *name)
+{
+    printf("%s\n    { \"group\": \"%s\", \"name\": \"%s\"",
+            NResults_++ ? "," : "", group, name);
+} /* resultBegin_ */
+
+static void resultEnd_(void)
+{
+    printf(" }");
+} /* resultEnd_ */
+
+/** Print callback-time percentiles from #n times in seconds */
+static void printPercentiles_(double *times, long n)
+{
+    qsort(times, n, sizeof(double), cmpDouble_);
+    printf(", \"callbacks\": %ld, \"p50_ns\": %.0f, \"p90_ns\": %.0f, "
+            "\"p99_ns\": %.0f, \"p999_ns\": %.0f, \"max_ns\": %.0f", n,
+            percentile_(times, n, 50) * 1e9,
+            percentile_(times, n, 90) * 1e9,
+            percentile_(times, n, 99) * 1e9,
+            percentile_(times, n, 99.9) * 1e9,
+            times[n-1] * 1e9);
+} /* printPercentiles_ */
+
+static const char *FormatNames_[] = { "f32", "i32", "i24", "i16", "i8",
+                                        "ui8" };
+
+/** Make an offline output that throws its output away */
+static PAU newNullOutputEx_(Au_SampleFormat format, int rate,
+        int channels, Au_ResampleQuality quality, BOOL lock_memory,
+        BOOL huge_pages)
+{
+    Au_Options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.render_file = "";
+    opts.resample_quality = quality;
+    opts.lock_memory = lock_memory;
+    opts.huge_pages = huge_pages;
+    return (PAU)Au_NewEx(format, rate, channels, &opts, NULL);
+} /* newNullOutputEx_ */
+
+static PAU newNullOutput_(Au_SampleFormat format, int rate, int channels,
+        Au_ResampleQuality quality)
+{
+    return newNullOutputEx_(format, rate, channels, quality, FALSE, FALSE);
+} /* newNullOutput_ */
+
+/* Input ================================================================== */
+
+/** Write the standard input: white noise from a fixed LCG.
+ * @return TRUE on success; FALSE on failure. */
+static BOOL makeInput_(const char *filename, int rate)
+{
+    SF_INFO sf_info;
+    SNDFILE *sf_fd;
+    short buf[2 * 4096];
+    unsigned int seed = 12345;
+    long frames = (long)rate * AU_BENCH_INPUT_SECS, done, n, i;
+
+    memset(&sf_info, 0, sizeof(sf_info));
+    sf_info.samplerate = rate;
+    sf_info.channels = 2;
+    sf_info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    if(!(sf_fd = sf_open(filename, SFM_WRITE, &sf_info))) return FALSE;
+
+    for(done = 0; done < frames; done += n) {
+        n = frames - done;
+        if(n > 4096) n = 4096;
+        for(i = 0; i < 2 * n; ++i) {
+            seed = seed * 1103515245u + 12345u;
+            buf[i] = (short)(seed >> 16) / 4;   /* about -12 dBFS */
+        }
+        if(sf_writef_short(sf_fd, buf, n) != n) break;
+    }
+    sf_close(sf_fd);
+    return (done == frames);
+} /* makeInput_ */
+
+/* Ring buffer ============================================================ */
+
+/** The ring and block size for the ring-buffer benchmarks: the default
+ * profile, 16-bit stereo.  The same elements either way; only the ring
+ * differs. */
+typedef struct RingBench {
+    /** Which ring: AuRing if TRUE, else PaUtilRingBuffer */
+    BOOL au;
+    PaUtilRingBuffer pa_ring;
+    AuRing au_ring;
+    AuRingMemory mem;
+    long elem_bytes;
+    volatile BOOL go;
+} RingBench;
+
+static BOOL ringBenchInit_(RingBench *rb, BOOL au)
+{
+    rb->au = au;
+    rb->elem_bytes = offsetof(FRBuf, data) + PA_BUFFER_FRAMECOUNT * 4;
+    rb->elem_bytes = (rb->elem_bytes + AU_FRBUF_ALIGN - 1) &
+                        ~(long)(AU_FRBUF_ALIGN - 1);
+    if(!AuRing_AllocMemory(&rb->mem, rb->elem_bytes * PA_RING_BUFFERCOUNT,
+                            0)) {
+        return FALSE;
+    }
+    if(au) {
+        return (AuRing_Init(&rb->au_ring, rb->elem_bytes,
+                    PA_RING_BUFFERCOUNT, rb->mem.data) != -1);
+    }
+    return (PaUtil_InitializeRingBuffer(&rb->pa_ring, rb->elem_bytes,
+                PA_RING_BUFFERCOUNT, rb->mem.data) != -1);
+} /* ringBenchInit_ */
+
+static void ringFlush_(RingBench *rb)
+{
+    if(rb->au) {
+        AuRing_Flush(&rb->au_ring);
+    } else {
+        PaUtil_FlushRingBuffer(&rb->pa_ring);
+    }
+} /* ringFlush_ */
+
+/** Write one block the way SFReaderFill_() does */
+static BOOL ringPut_(RingBench *rb, long seq)
+{
+    void *data1, *data2;
+    ring_buffer_size_t elems1, elems2, n;
+    PFRBuf pfr;
+
+    n = rb->au ? AuRing_GetWriteRegions(&rb->au_ring, 1, &data1, &elems1,
+                                        &data2, &elems2) :
+                 PaUtil_GetRingBufferWriteRegions(&rb->pa_ring, 1, &data1,
+                                        &elems1, &data2, &elems2);
+    if(n < 1) return FALSE;
+    pfr = (PFRBuf)data1;
+    pfr->state = PPPS_Playing;
+    pfr->pos_frames = seq;
+    pfr->frames = PA_BUFFER_FRAMECOUNT;
+    if(rb->au) {
+        AuRing_AdvanceWriteIndex(&rb->au_ring, 1);
+    } else {
+        PaUtil_AdvanceRingBufferWriteIndex(&rb->pa_ring, 1);
+    }
+    return TRUE;
+} /* ringPut_ */
+
+/** Read one block the way StreamRead_() does */
+static BOOL ringGet_(RingBench *rb, long *seq)
+{
+    void *data1, *data2;
+    ring_buffer_size_t elems1, elems2, n;
+
+    n = rb->au ? AuRing_GetReadRegions(&rb->au_ring, 1, &data1, &elems1,
+                                        &data2, &elems2) :
+                 PaUtil_GetRingBufferReadRegions(&rb->pa_ring, 1, &data1,
+                                        &elems1, &data2, &elems2);
+    if(n < 1) return FALSE;
+    *seq = ((PFRBuf)data1)->pos_frames;
+    if(rb->au) {
+        AuRing_AdvanceReadIndex(&rb->au_ring, 1);
+    } else {
+        PaUtil_AdvanceRingBufferReadIndex(&rb->pa_ring, 1);
+    }
+    return TRUE;
+} /* ringGet_ */
+
+static void *ringProducer_(void *handle)
+{
+    RingBench *rb = (RingBench *)handle;
+    long seq = 0;
+    while(!rb->go) sched_yield();
+    while(seq < AU_BENCH_RING_OPS) {
+        if(ringPut_(rb, seq)) {
+            ++seq;
+        } else {
+            sched_yield();      /* full */
+        }
+    }
+    return 0;
+} /* ringProducer_ */
+
+static void benchRing_(BOOL au)
+{
+    const char *name = au ? "au" : "pa";
+    RingBench rb;
+    pthread_t producer;
+    double t, rates[AU_BENCH_REPEATS];
+    long i, seq, expect;
+    int r;
+    BOOL ok = TRUE;
+
+    if(!ringBenchInit_(&rb, au)) {
+        AuRing_FreeMemory(&rb.mem);
+        return;
+    }
+
+    /* Put-then-get in one thread: the cost of the operations alone */
+    for(r = 0; r < AU_BENCH_REPEATS; ++r) {
+        t = nowSecs_();
+        for(i = 0; i < AU_BENCH_RING_OPS; ++i) {
+            ringPut_(&rb, i);
+            ringGet_(&rb, &seq);
+        }
+        rates[r] = AU_BENCH_RING_OPS / (nowSecs_() - t);
+    }
+    resultBegin_("ring_buffer", "single_thread");
+    printf(", \"ring\": \"%s\", \"elem_bytes\": %ld, "
+            "\"blocks_per_sec\": %.0f", name, rb.elem_bytes,
+            median_(rates, AU_BENCH_REPEATS));
+    resultEnd_();
+
+    /* Producer and consumer threads: adds the cache-line traffic */
+    for(r = 0; r < AU_BENCH_REPEATS; ++r) {
+        ringFlush_(&rb);
+        rb.go = FALSE;
+        if(pthread_create(&producer, NULL, ringProducer_, &rb) != 0) break;
+        t = nowSecs_();
+        rb.go = TRUE;
+        for(expect = 0; expect < AU_BENCH_RING_OPS; ) {
+            if(!ringGet_(&rb, &seq)) {
+                sched_yield();  /* empty */
+                continue;
+            }
+            if(seq != expect) ok = FALSE;
+            ++expect;
+        }
+        rates[r] = AU_BENCH_RING_OPS / (nowSecs_() - t);
+        pthread_join(producer, NULL);
+    }
+    if(r == AU_BENCH_REPEATS) {
+        resultBegin_("ring_buffer", "two_threads");
+        printf(", \"ring\": \"%s\", \"elem_bytes\": %ld, "
+                "\"blocks_per_sec\": %.0f, \"in_order\": %s", name,
+                rb.elem_bytes, median_(rates, AU_BENCH_REPEATS),
+                ok ? "true" : "false");
+        resultEnd_();
+    }
+
+    AuRing_FreeMemory(&rb.mem);
+} /* benchRing_ */
+
+/* Conversion kernels ===================================================== */
+
+/** Pseudo-random samples to convert.  Floats run a little past
+ * [-1, 1] to reach the clipping, and every other one is half an LSB of
+ * AUSF_I16 or AUSF_I8 off a step, to reach the rounding.
+ * @param ints Filled with #bytes random bytes
+ * @param floats Filled with #n floats */
+static void convInput_(unsigned char *ints, size_t bytes, float *floats,
+        size_t n)
+{
+    unsigned int seed = 54321;
+    size_t i;
+
+    for(i = 0; i < bytes; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        ints[i] = (unsigned char)(seed >> 16);
+    }
+    for(i = 0; i < n; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        switch(i % 4) {
+            case 0: floats[i] = ((int)(seed >> 8) - (1 << 23)) * 1.25f /
+                                (1 << 23);
+                    break;
+            case 1: floats[i] = ((short)(seed >> 16) + 0.5f) / 32768.0f;
+                    break;
+            case 2: floats[i] = ((signed char)(seed >> 24) + 0.5f) / 128.0f;
+                    break;
+            default: floats[i] = (seed & 0x10000) ? 1.0f : -1.0f;
+                    break;
+        }
+    }
+} /* convInput_ */
+
+/** Convert #n samples of #format to and from float with the kernels
+ * called #impl.  The input buffers end where the samples do, so ASan
+ * sees any overread; the outputs are followed by AU_BENCH_CONV_GUARD
+ * bytes that must not change.  If #check, compare the results with
+ * #to_ref and #from_ref; else save them there.
+ * @return TRUE if they matched; FALSE if they didn't or on failure. */
+static BOOL convCheck_(const char *impl, Au_SampleFormat format,
+        const unsigned char *ints, const float *floats, size_t n,
+        float *to_ref, unsigned char *from_ref, BOOL check)
+{
+    unsigned char guard[AU_BENCH_CONV_GUARD];
+    size_t bytes = n * sampleSizeBytes_(format);
+    size_t fbytes = n * sizeof(float);
+    /* At least 1 byte, so malloc() won't return NULL */
+    unsigned char *src = malloc(bytes + !n);
+    float *fsrc = malloc(fbytes + !n);
+    unsigned char *from = malloc(bytes + AU_BENCH_CONV_GUARD);
+    unsigned char *to = malloc(fbytes + AU_BENCH_CONV_GUARD);
+    BOOL ok = (src && from && fsrc && to && AuConv_SetImplementation(impl));
+
+    if(ok) {
+        memcpy(src, ints, bytes);
+        memcpy(fsrc, floats, fbytes);
+        /* Not 0, which the I24 kernels pad with */
+        memset(guard, 0xA5, AU_BENCH_CONV_GUARD);
+        memcpy(from + bytes, guard, AU_BENCH_CONV_GUARD);
+        memcpy(to + fbytes, guard, AU_BENCH_CONV_GUARD);
+        AuConv_ToFloat(format, src, (float *)to, n);
+        AuConv_FromFloat(format, fsrc, from, n, NULL);
+        ok = !memcmp(from + bytes, guard, AU_BENCH_CONV_GUARD) &&
+                !memcmp(to + fbytes, guard, AU_BENCH_CONV_GUARD);
+        if(check) {
+            ok = ok && !memcmp(to, to_ref, fbytes) &&
+                    !memcmp(from, from_ref, bytes);
+        } else {
+            memcpy(to_ref, to, fbytes);
+            memcpy(from_ref, from, bytes);
+        }
+    }
+    free(src);
+    free(from);
+    free(fsrc);
+    free(to);
+    return ok;
+} /* convCheck_ */
+
+/** Check that each conversion implementation the CPU has gives the same
+ * bytes as the scalar one, for every format, at every length up to
+ * AU_BENCH_CONV_SHORT (each kernel's tail) and a few longer odd ones.
+ * Without dither: the kernels draw the noise in different orders. */
+static void benchConvert_(void)
+{
+    static const char *impls[] = { "sse2", "avx2" };
+    static const size_t longer[] = { 1023, 1033, AU_BENCH_CONV_LONG };
+    const char *best_impl = AuConv_Implementation();
+    unsigned char *ints, *from_ref;
+    float *floats, *to_ref;
+    Au_SampleFormat format;
+    size_t n;
+    int i, j, lengths, mismatches;
+
+    ints = malloc(AU_BENCH_CONV_LONG * 4);
+    from_ref = malloc(AU_BENCH_CONV_LONG * 4);
+    floats = malloc(AU_BENCH_CONV_LONG * sizeof(float));
+    to_ref = malloc(AU_BENCH_CONV_LONG * sizeof(float));
+    if(ints && from_ref && floats && to_ref) {
+        convInput_(ints, AU_BENCH_CONV_LONG * 4, floats, AU_BENCH_CONV_LONG);
+    }
+
+    for(i = 0; ints && from_ref && floats && to_ref &&
+                i < (int)(sizeof(impls)/sizeof(impls[0])); ++i) {
+        if(!AuConv_SetImplementation(impls[i])) continue;
+        for(format = AUSF_F32; format < AUSF_CUSTOM; ++format) {
+            lengths = mismatches = 0;
+            for(j = 0; j <= AU_BENCH_CONV_SHORT +
+                        (int)(sizeof(longer)/sizeof(longer[0])); ++j) {
+                n = (j <= AU_BENCH_CONV_SHORT) ? (size_t)j :
+                        longer[j - AU_BENCH_CONV_SHORT - 1];
+                ++lengths;
+                if( !convCheck_("scalar", format, ints, floats, n,
+                                to_ref, from_ref, FALSE) ||
+                    !convCheck_(impls[i], format, ints, floats, n,
+                                to_ref, from_ref, TRUE) ) {
+                    ++mismatches;
+                }
+            }
+            resultBegin_("convert", FormatNames_[format]);
+            printf(", \"implementation\": \"%s\", \"lengths\": %d, "
+                    "\"matches_scalar\": %s", impls[i], lengths,
+                    mismatches ? "false" : "true");
+            resultEnd_();
+        }
+    }
+    AuConv_SetImplementation(best_impl);
+
+    free(ints);
+    free(from_ref);
+    free(floats);
+    free(to_ref);
+} /* benchConvert_ */
+
+/* Decoding =============================================================== */
+
+/** Set up #pau's stream to decode #filename without a reader thread:
+ * the parts of StreamOpen_() that SFReadStream_() needs.
+ * @return TRUE on success; FALSE on failure. */
+static BOOL decodeOpen_(PAU pau, const char *filename)
+{
+    PAU_Stream pst = &pau->stream;
+    SF_INFO sf_info;
+    size_t frames = (size_t)pau->block_frames * pau->ring_blocks;
+
+    memset(&sf_info, 0, sizeof(sf_info));
+    if(!(pst->sf_fd = sf_open(filename, SFM_READ, &sf_info))) return FALSE;
+    if(sf_info.channels != pau->channels) return FALSE;
+    if(!SFSetRate_(pst, sf_info.samplerate)) return FALSE;
+    /* Kept from the last repeat, as StreamOpen_() would */
+    if( !pst->sf_stage &&
+        !(pst->sf_stage = malloc(frames * pau->frame_bytes)) ) {
+        return FALSE;
+    }
+    if( (pau->format != AUSF_F32) && !pst->sf_float_stage &&
+        !(pst->sf_float_stage = (float *)malloc(
+                frames * pau->channels * sizeof(float))) ) {
+        return FALSE;
+    }
+    AuConv_DitherInit(&pst->sf_dither, 1);
+    return TRUE;
+} /* decodeOpen_ */
+
+/** Decode all of #filename to #pau's format, AU_BENCH_REPEATS times.
+ * @return The median frames per second, or -1 on failure. */
+static double decodeRate_(PAU pau, const char *filename)
+{
+    PAU_Stream pst = &pau->stream;
+    double t, rates[AU_BENCH_REPEATS];
+    sf_count_t got, total;
+    int r;
+
+    for(r = 0; r < AU_BENCH_REPEATS; ++r) {
+        if(!decodeOpen_(pau, filename)) {
+            StreamClose_(pst);
+            return -1;
+        }
+        total = 0;
+        t = nowSecs_();
+        while((got = SFReadStream_(pst,
+                        pau->block_frames * pau->ring_blocks)) > 0) {
+            total += got;
+        }
+        rates[r] = total / (nowSecs_() - t);
+        StreamClose_(pst);
+    }
+    return median_(rates, AU_BENCH_REPEATS);
+} /* decodeRate_ */
+
+static void benchDecode_(const char *filename, int rate, int channels)
+{
+    static const char *impls[] = { "scalar", "sse2", "avx2" };
+    static const char *qualities[] = { "fast", "medium", "best" };
+    const char *best_impl = AuConv_Implementation();
+    Au_SampleFormat format;
+    PAU pau;
+    double fps;
+    int i;
+
+    /* Each format, with each conversion implementation the CPU has */
+    for(i = 0; i < (int)(sizeof(impls)/sizeof(impls[0])); ++i) {
+        if(!AuConv_SetImplementation(impls[i])) continue;
+        for(format = AUSF_F32; format < AUSF_CUSTOM; ++format) {
+            if(!(pau = newNullOutput_(format, rate, channels,
+                                        AURQ_PROFILE))) continue;
+            fps = decodeRate_(pau, filename);
+            Au_Delete((HAU)pau);
+            if(fps < 0) continue;
+            resultBegin_("decode", FormatNames_[format]);
+            printf(", \"implementation\": \"%s\", \"frames_per_sec\": %.0f",
+                    impls[i], fps);
+            resultEnd_();
+        }
+    }
+    AuConv_SetImplementation(best_impl);
+
+    /* Resampling, to a rate with an awkward ratio */
+    for(i = 0; i < (int)(sizeof(qualities)/sizeof(qualities[0])); ++i) {
+        if(!(pau = newNullOutput_(AUSF_F32, (rate == 48000) ? 44100 : 48000,
+                    channels, (Au_ResampleQuality)(AURQ_FAST + i)))) {
+            continue;
+        }
+        fps = decodeRate_(pau, filename);
+        Au_Delete((HAU)pau);
+        if(fps < 0) continue;
+        resultBegin_("decode", "resample_f32");
+        printf(", \"quality\": \"%s\", \"frames_per_sec\": %.0f",
+                qualities[i], fps);
+        resultEnd_();
+    }
+} /* benchDecode_ */
+
+/* Oscillators ============================================================ */
+
+/** Somewhere to put results so the compiler can't skip the work */
+static volatile float OscSink_;
+
+/** The inner loop of the old Au_HL_Sine() callback */
+static void libmSine_(float *out, unsigned long frames, double freq_rad,
+        double *t, double time_step)
+{
+    unsigned long i;
+    double d;
+
+    for(i = 0; i < frames; ++i) {
+        d = sin(freq_rad * *t);
+        *out++ = d;
+        *out++ = d;
+        *t += time_step;
+    }
+} /* libmSine_ */
+
+/** Frames per second rendering #ntones of #tones in callback-sized
+ * pieces, or the libm loop if #ntones is 0 */
+static double oscRate_(const Au_Tone *tones, int ntones, float *out)
+{
+    AuOscBank *bank = NULL;
+    double t, phase_t = 0.0;
+    long done;
+
+    if(ntones && !(bank = AuOsc_New(tones, ntones, 2, 44100))) return -1;
+
+    t = nowSecs_();
+    for(done = 0; done < AU_BENCH_OSC_FRAMES;
+            done += AU_BENCH_CALLBACK_FRAMES) {
+        if(bank) {
+            AuOsc_Render(bank, out, AU_BENCH_CALLBACK_FRAMES);
+        } else {
+            libmSine_(out, AU_BENCH_CALLBACK_FRAMES, 2.0 * M_PI * 440.0,
+                        &phase_t, 1.0 / 44100);
+        }
+        OscSink_ = out[0];
+    }
+    t = nowSecs_() - t;
+
+    AuOsc_Delete(bank);
+    return AU_BENCH_OSC_FRAMES / t;
+} /* oscRate_ */
+
+static void benchOsc_(void)
+{
+    static const char *impls[] = { "libm", "scalar", "sse2" };
+    static const int counts[] = { 1, AU_BENCH_OSCS };
+    const char *best_impl = AuOsc_Implementation();
+    Au_Tone tones[AU_BENCH_OSCS];
+    float *out;
+    double rates[AU_BENCH_REPEATS];
+    int i, j, r;
+
+    memset(tones, 0, sizeof(tones));
+    for(i = 0; i < AU_BENCH_OSCS; ++i) {
+        tones[i].wave = (Au_Waveform)(i % ((int)AUWF_NOISE + 1));
+        tones[i].freq_hz = 110.0 * (i + 1);
+        if(i % 4 == 3) {
+            tones[i].end_freq_hz = 8000.0;
+            tones[i].sweep_secs = 5.0;
+            tones[i].sweep_log = TRUE;
+        }
+        tones[i].gain = 1.0f / AU_BENCH_OSCS;
+        tones[i].channel = (i % 3) - 1;
+    }
+    tones[0].gain = 1.0f;   /* when alone */
+
+    if(!(out = (float *)malloc(AU_BENCH_CALLBACK_FRAMES * 2 *
+                                sizeof(float)))) {
+        return;
+    }
+
+    for(i = 0; i < (int)(sizeof(impls)/sizeof(impls[0])); ++i) {
+        if(i && !AuOsc_SetImplementation(impls[i])) continue;
+        for(j = 0; j < (int)(sizeof(counts)/sizeof(counts[0])); ++j) {
+            if(!i && j) break;      /* libm only does one sine */
+            for(r = 0; r < AU_BENCH_REPEATS; ++r) {
+                rates[r] = oscRate_(tones, i ? counts[j] : 0, out);
+            }
+            resultBegin_("oscillator", j ? "bank" : "sine");
+            printf(", \"implementation\": \"%s\", \"oscillators\": %d, "
+                    "\"frames_per_sec\": %.0f", impls[i], counts[j],
+                    median_(rates, AU_BENCH_REPEATS));
+            resultEnd_();
+        }
+    }
+    AuOsc_SetImplementation(best_impl);
+
+    free(out);
+} /* benchOsc_ */
+
+/* Callback =============================================================== */
+
+/** Ask the kernel to page out #mem, so the next touch of each page
+ * faults.  Does nothing to locked memory, or where MADV_PAGEOUT
+ * (Linux 5.4+) isn't available.
+ * @return TRUE if the kernel took the request. */
+static BOOL evictRing_(const AuRingMemory *mem)
+{
+#ifdef MADV_PAGEOUT
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first, last;
+
+    if(!mem->data || mem->locked) return FALSE;
+    first = (uintptr_t)mem->data & ~(page - 1);
+    last = ((uintptr_t)mem->data + mem->bytes + page - 1) & ~(page - 1);
+    return madvise((void *)first, last - first, MADV_PAGEOUT) == 0;
+#else
+    (void)mem;
+    return FALSE;
+#endif
+} /* evictRing_ */
+
+/** Time up to AU_BENCH_CALLBACKS calls of PAPlayCallback_() on #pau,
+ * playing #filename, into #times.  The ring is topped up before each
+ * call, outside the timing, so only the callback's own work is
+ * measured.  If #evictions is not NULL, the ring is also paged out
+ * before each call, and *#evictions counts the times that worked.
+ * @return How many calls were timed. */
+static long timeCallbacks_(PAU pau, const char *filename, double *times,
+        long *evictions)
+{
+    PAU_Stream pst = &pau->stream;
+    Au_Userdata ud;
+    unsigned char *out;
+    double t;
+    long n = 0;
+    ring_buffer_size_t need;
+    PaStreamCallbackTimeInfo time_info;
+
+    ud.pau = pau;
+    ud.data = NULL;
+    memset(&time_info, 0, sizeof(time_info));
+    need = (AU_BENCH_CALLBACK_FRAMES + pau->block_frames - 1) /
+                pau->block_frames + 1;
+
+    out = (unsigned char *)malloc(
+            (size_t)AU_BENCH_CALLBACK_FRAMES * pau->frame_bytes);
+
+    while(out && n < AU_BENCH_CALLBACKS) {
+        ClockReset_(pau);
+        pau->clock_active = TRUE;
+        if(!StreamOpen_(pst, filename)) break;
+
+        while(n < AU_BENCH_CALLBACKS) {
+            /* Wait for a full ring, or the end of the file */
+            while( (AuRing_ReadAvailable(pst->sf_buffer) < need) &&
+                    !pst->sf_reader_at_eof ) {
+                StreamWakeReader_(pst);
+                sched_yield();
+            }
+            if(AuRing_ReadAvailable(pst->sf_buffer) < need) {
+                break;      /* near the end - start over */
+            }
+            if(evictions && evictRing_(&pst->sf_buffer_mem)) {
+                ++*evictions;
+            }
+
+            t = nowSecs_();
+            PAPlayCallback_(NULL, out, AU_BENCH_CALLBACK_FRAMES, &time_info,
+                            0, &ud);
+            times[n++] = nowSecs_() - t;
+        }
+        StreamClose_(pst);
+    }
+
+    free(out);
+    return n;
+} /* timeCallbacks_ */
+
+/** Time PAPlayCallback_() playing #filename to #format */
+static void benchCallback_(const char *filename, Au_SampleFormat format,
+        int rate, int channels)
+{
+    PAU pau;
+    double *times;
+    long n = 0;
+
+    if(!(pau = newNullOutput_(format, rate, channels, AURQ_PROFILE))) return;
+    if((times = (double *)malloc(AU_BENCH_CALLBACKS * sizeof(double)))) {
+        n = timeCallbacks_(pau, filename, times, NULL);
+    }
+
+    if(n > 0) {
+        resultBegin_("callback", FormatNames_[format]);
+        printf(", \"frames_per_callback\": %d, \"elem_bytes\": %ld, "
+                "\"ring_bytes\": %zu", AU_BENCH_CALLBACK_FRAMES,
+                pau->stream.sf_elem_bytes, pau->stream.sf_buffer_mem.bytes);
+        printPercentiles_(times, n);
+        resultEnd_();
+    }
+
+    free(times);
+    Au_Delete((HAU)pau);
+} /* benchCallback_ */
+
+/* Jitter ================================================================= */
+
+typedef struct Pressure {
+    unsigned char *mem;
+    volatile BOOL go;
+    long passes;
+} Pressure;
+
+/** Keep the memory system busy: dirty a byte in every page of the
+ * block, evicting the cache and the TLB as we go, then give the pages
+ * back so the next pass faults them all in again. */
+static void *pressureThread_(void *handle)
+{
+    Pressure *pr = (Pressure *)handle;
+    size_t i;
+
+    while(pr->go) {
+        for(i = 0; pr->go && i < AU_BENCH_PRESSURE_BYTES; i += 4096) {
+            ++pr->mem[i];
+        }
+#ifdef MADV_DONTNEED
+        madvise(pr->mem, AU_BENCH_PRESSURE_BYTES, MADV_DONTNEED);
+#endif
+        ++pr->passes;
+    }
+    return NULL;
+} /* pressureThread_ */
+
+/** Page faults taken so far by this thread, or by the process if the
+ * system can't tell threads apart */
+static void threadFaults_(long *minflt, long *majflt)
+{
+    struct rusage ru;
+    int ok;
+
+#ifdef RUSAGE_THREAD
+    ok = (getrusage(RUSAGE_THREAD, &ru) == 0);
+#else
+    ok = FALSE;
+#endif
+    if(!ok && getrusage(RUSAGE_SELF, &ru) != 0) {
+        memset(&ru, 0, sizeof(ru));
+    }
+    *minflt = ru.ru_minflt;
+    *majflt = ru.ru_majflt;
+} /* threadFaults_ */
+
+/** Time PAPlayCallback_() as benchCallback_() does, while another thread
+ * churns through memory and the ring is paged out between calls, with
+ * the ring in ordinary, locked, and huge pages. */
+static void benchJitter_(const char *filename, int rate, int channels)
+{
+    static const char *Names[] = { "default", "lock_memory", "huge_pages" };
+    Pressure pr;
+    pthread_t thread;
+    PAU pau;
+    double *times;
+    long n, evictions, minflt, majflt, minflt0, majflt0;
+    int mode;
+
+    pr.mem = (unsigned char *)mmap(NULL, AU_BENCH_PRESSURE_BYTES,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(pr.mem == MAP_FAILED) return;
+    if(!(times = (double *)malloc(AU_BENCH_CALLBACKS * sizeof(double)))) {
+        munmap(pr.mem, AU_BENCH_PRESSURE_BYTES);
+        return;
+    }
+
+    for(mode = 0; mode < 3; ++mode) {
+        if(!(pau = newNullOutputEx_(AUSF_I16, rate, channels, AURQ_PROFILE,
+                                    mode == 1, mode == 2))) {
+            continue;
+        }
+
+        pr.go = TRUE;
+        pr.passes = 0;
+        if(pthread_create(&thread, NULL, pressureThread_, &pr) != 0) {
+            Au_Delete((HAU)pau);
+            break;
+        }
+        evictions = 0;
+        threadFaults_(&minflt0, &majflt0);
+        n = timeCallbacks_(pau, filename, times, &evictions);
+        threadFaults_(&minflt, &majflt);
+        pr.go = FALSE;
+        pthread_join(thread, NULL);
+
+        if(n > 0) {
+            resultBegin_("jitter", Names[mode]);
+            printf(", \"ring_locked\": %s, \"ring_mapped\": %s, "
+                    "\"pressure_passes\": %ld, \"ring_evictions\": %ld, "
+                    "\"minflt\": %ld, \"majflt\": %ld",
+                    pau->stream.sf_buffer_mem.locked ? "true" : "false",
+                    pau->stream.sf_buffer_mem.mapped ? "true" : "false",
+                    pr.passes, evictions, minflt - minflt0,
+                    majflt - majflt0);
+            printPercentiles_(times, n);
+            resultEnd_();
+        }
+        Au_Delete((HAU)pau);
+    }
+
+    free(times);
+    munmap(pr.mem, AU_BENCH_PRESSURE_BYTES);
+} /* benchJitter_ */
+
+/* Pipes ================================================================== */
+
+/** A source for the pipe benchmark: #len bytes of #data, sent to #fd
+ * by pipeWriter_(), or read by pipeRead_() */
+typedef struct PipeFeed {
+    const unsigned char *data;
+    size_t len, off;
+
+    /** If TRUE, send AU_BENCH_PIPE_CHUNK at a time, slowly */
+    BOOL slow;
+
+    /** Once #off gets here, if it's short of #len, send nothing until
+     * #release.  Then end. */
+    size_t stall_at;
+    volatile BOOL release;
+
+    /** The pipe's write end, or -1 */
+    int fd;
+
+    /** Calls of pipeRead_() under way */
+    int reading;
+} PipeFeed;
+
+/** How many bytes #pf should send next, at most #max: 0 at the end */
+static size_t feedNext_(PipeFeed *pf, size_t max)
+{
+    size_t n;
+
+    if(pf->off >= pf->stall_at) {
+        while(pf->stall_at < pf->len && !pf->release) usleep(1000);
+        return 0;
+    }
+    n = pf->stall_at - pf->off;
+    if(pf->slow) {
+        usleep(AU_BENCH_PIPE_GAP_US);
+        if(n > AU_BENCH_PIPE_CHUNK) n = AU_BENCH_PIPE_CHUNK;
+    }
+    return (n > max) ? max : n;
+} /* feedNext_ */
+
+static void *pipeWriter_(void *handle)
+{
+    PipeFeed *pf = (PipeFeed *)handle;
+    size_t n;
+    ssize_t written;
+
+    while((n = feedNext_(pf, 64 * 1024)) > 0) {
+        if((written = write(pf->fd, pf->data + pf->off, n)) <= 0) break;
+        pf->off += written;
+    }
+    close(pf->fd);
+    return NULL;
+} /* pipeWriter_ */
+
+/** Au_ReadCallback over a PipeFeed */
+static long pipeRead_(void *user_data, void *buf, size_t len)
+{
+    PipeFeed *pf = (PipeFeed *)user_data;
+    size_t n;
+
+    __atomic_add_fetch(&pf->reading, 1, __ATOMIC_ACQ_REL);
+    n = feedNext_(pf, len);
+    memcpy(buf, pf->data + pf->off, n);
+    pf->off += n;
+    __atomic_sub_fetch(&pf->reading, 1, __ATOMIC_ACQ_REL);
+    return (long)n;
+} /* pipeRead_ */
+
+/** Read all of #filename into memory.
+ * @return The contents, to free(), or NULL on failure. */
+static unsigned char *readAll_(const char *filename, size_t *len)
+{
+    FILE *fp;
+    unsigned char *data = NULL;
+    long n;
+
+    if(!(fp = fopen(filename, "rb"))) return NULL;
+    if( (fseek(fp, 0, SEEK_END) == 0) && ((n = ftell(fp)) > 0) &&
+        (fseek(fp, 0, SEEK_SET) == 0) &&
+        (data = (unsigned char *)malloc(n)) ) {
+        if(fread(data, 1, n, fp) == (size_t)n) {
+            *len = n;
+        } else {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+    return data;
+} /* readAll_ */
+
+/** Start #pf on #pau: through a pipe from a writer thread if #use_fd,
+ * else through a callback.
+ * @return TRUE on success; FALSE on failure. */
+static BOOL pipeStart_(PAU pau, PipeFeed *pf, BOOL use_fd,
+        pthread_t *thread)
+{
+    int fds[2];
+
+    pf->off = 0;
+    pf->release = FALSE;
+    pf->fd = -1;
+    if(!use_fd) return Au_PlayCallback((HAU)pau, pipeRead_, pf);
+
+    if(pipe(fds) != 0) return FALSE;
+    pf->fd = fds[1];
+    if(pthread_create(thread, NULL, pipeWriter_, pf) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return FALSE;
+    }
+    if(!Au_PlayFd((HAU)pau, fds[0], TRUE)) {
+        close(fds[0]);
+        pf->release = TRUE;
+        pthread_join(*thread, NULL);
+        return FALSE;
+    }
+    return TRUE;
+} /* pipeStart_ */
+
+/** Render #filename to #outname, itself if #pf is NULL, else through
+ * a pipe fed by #pf as pipeStart_() does.
+ * @return Seconds taken, or -1 on failure. */
+static double renderThrough_(const char *filename, const char *outname,
+        int rate, int channels, PipeFeed *pf, BOOL use_fd)
+{
+    Au_Options opts;
+    PAU pau;
+    pthread_t thread;
+    BOOL ok;
+    double t;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.render_file = outname;
+    if(!(pau = (PAU)Au_NewEx(AUSF_I16, rate, channels, &opts, NULL))) {
+        return -1;
+    }
+
+    t = nowSecs_();
+    ok = pf ? pipeStart_(pau, pf, use_fd, &thread) :
+                Au_Play((HAU)pau, filename);
+    if(ok) Au_Wait((HAU)pau);
+    t = nowSecs_() - t;
+
+    if(ok && pf && use_fd) pthread_join(thread, NULL);
+    Au_Delete((HAU)pau);        /* closes #outname */
+    return ok ? t : -1;
+} /* renderThrough_ */
+
+/** Play #filename through pipes, and check the result.  Then time
+ * Au_Stop() on a stalled pipe. */
+static void benchPipe_(const char *filename, int rate, int channels)
+{
+    static const char *Names[] = { "fd", "fd_slow", "callback_slow" };
+    char refname[] = "/tmp/au_bench_ref_XXXXXX";
+    char outname[] = "/tmp/au_bench_out_XXXXXX";
+    unsigned char *ref = NULL, *out;
+    size_t ref_len = 0, out_len;
+    PipeFeed pf;
+    pthread_t thread;
+    PAU pau;
+    double t;
+    int i, fd;
+
+    signal(SIGPIPE, SIG_IGN);   /* if Au_PlayFd() gives up early */
+
+    memset(&pf, 0, sizeof(pf));
+    if(!(pf.data = readAll_(filename, &pf.len))) return;
+
+    if( ((fd = mkstemp(refname)) == -1) || (close(fd) != 0) ||
+        ((fd = mkstemp(outname)) == -1) || (close(fd) != 0) ) {
+        free((void *)pf.data);
+        return;
+    }
+
+    /* Playing the file itself, to compare with */
+    if(renderThrough_(filename, refname, rate, channels, NULL, FALSE) >= 0) {
+        ref = readAll_(refname, &ref_len);
+    }
+
+    for(i = 0; ref && i < 3; ++i) {
+        pf.slow = (i > 0);
+        pf.stall_at = pf.len;
+        t = renderThrough_(filename, outname, rate, channels, &pf, i < 2);
+        if(t < 0) continue;
+
+        out = readAll_(outname, &out_len);
+        resultBegin_("pipe", Names[i]);
+        printf(", \"bytes\": %zu, \"ms\": %.1f, \"matches_file\": %s",
+                pf.len, t * 1e3,
+                (out && out_len == ref_len && !memcmp(out, ref, ref_len)) ?
+                    "true" : "false");
+        resultEnd_();
+        free(out);
+    }
+
+    /* Stop while the source is stalled: the writer holds the pipe open
+     * and sends nothing, or the callback blocks */
+    for(i = 0; i < 2; ++i) {
+        if(!(pau = newNullOutput_(AUSF_I16, rate, channels, AURQ_PROFILE))) {
+            continue;
+        }
+        pf.slow = FALSE;
+        pf.stall_at = (pf.len < AU_BENCH_PIPE_STALL_BYTES) ? pf.len / 2 :
+                        AU_BENCH_PIPE_STALL_BYTES;
+        if(!pipeStart_(pau, &pf, i == 0, &thread)) {
+            Au_Delete((HAU)pau);
+            continue;
+        }
+        while(pf.off < pf.stall_at) usleep(1000);
+        usleep(100 * 1000);
+
+        t = nowSecs_();
+        Au_Stop((HAU)pau);
+        t = nowSecs_() - t;
+
+        pf.release = TRUE;
+        if(i == 0) pthread_join(thread, NULL);
+        Au_Delete((HAU)pau);
+
+        resultBegin_("pipe", i ? "stop_stalled_callback" :
+                                "stop_stalled_fd");
+        printf(", \"stop_ms\": %.1f", t * 1e3);
+        resultEnd_();
+    }
+
+    /* A callback still blocked after Au_Stop() returns on its own */
+    while(__atomic_load_n(&pf.reading, __ATOMIC_ACQUIRE)) usleep(1000);
+
+    unlink(refname);
+    unlink(outname);
+    free(ref);
+    free((void *)pf.data);
+} /* benchPipe_ */
+
+/* Concurrent outputs ===================================================== */
+
+/** Per-output state for benchConcurrent_() */
+typedef struct ConcurrentOutput {
+    PAU pau;
+    double *times;
+    long ntimes, cap;
+} ConcurrentOutput;
+
+/** Wraps PAPlayCallback_() to time it.  pa_callback_userdata is the
+ * ConcurrentOutput. */
+static int timedPlayCallback_(const void *input, void *output,
+    unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo,
+    PaStreamCallbackFlags statusFlags, void *handle )
+{
+    POW_UD_FAST
+    ConcurrentOutput *co = (ConcurrentOutput *)pud->data;
+    double t = nowSecs_();
+    int result = PAPlayCallback_(input, output, frameCount, timeInfo,
+                                    statusFlags, handle);
+    if(co->ntimes < co->cap) co->times[co->ntimes++] = nowSecs_() - t;
+    UNUSED(pau);
+    return result;
+} /* timedPlayCallback_ */
+
+/** Render #filename on #noutputs null outputs at once */
+static void benchConcurrent_(const char *filename, int noutputs,
+        int rate, int channels, long frames)
+{
+    ConcurrentOutput *cos;
+    double t, elapsed, *all;
+    long heap_before, heap_after, nall = 0;
+    int i, started = 0;
+
+    if(!(cos = (ConcurrentOutput *)calloc(noutputs,
+                                            sizeof(ConcurrentOutput)))) {
+        return;
+    }
+
+    heap_before = heapBytes_();
+    for(i = 0; i < noutputs; ++i) {
+        cos[i].pau = newNullOutput_(AUSF_I16, rate, channels, AURQ_PROFILE);
+        if(!cos[i].pau) break;
+        cos[i].cap = frames / cos[i].pau->block_frames + 2;
+        if(!(cos[i].times = (double *)malloc(cos[i].cap * sizeof(double)))) {
+            break;
+        }
+
+        /* What Au_Play() does, with the timing wrapper */
+        ClockReset_(cos[i].pau);
+        cos[i].pau->clock_active = TRUE;
+        if(!StreamOpen_(&cos[i].pau->stream, filename)) break;
+        cos[i].pau->pa_callback_userdata = &cos[i];
+        cos[i].pau->pa_callback = timedPlayCallback_;
+    }
+    heap_after = heapBytes_();
+
+    if(i == noutputs) {
+        t = nowSecs_();
+        for(started = 0; started < noutputs; ++started) {
+            if(!OutputStart_(cos[started].pau)) break;
+        }
+        for(i = 0; i < started; ++i) Au_Wait((HAU)cos[i].pau);
+        elapsed = nowSecs_() - t;
+
+        for(i = 0; i < noutputs; ++i) nall += cos[i].ntimes;
+        if( (started == noutputs) &&
+            (all = (double *)malloc(nall * sizeof(double))) ) {
+            for(nall = 0, i = 0; i < noutputs; ++i) {
+                memcpy(all + nall, cos[i].times,
+                        cos[i].ntimes * sizeof(double));
+                nall += cos[i].ntimes;
+            }
+            resultBegin_("concurrent", "null_sink_i16");
+            printf(", \"outputs\": %d, \"frames_per_sec\": %.0f", noutputs,
+                    (double)frames * noutputs / elapsed);
+            if(heap_before >= 0) {
+                printf(", \"heap_bytes_per_stream\": %ld",
+                        (heap_after - heap_before) / noutputs);
+            }
+            printPercentiles_(all, nall);
+            resultEnd_();
+            free(all);
+        }
+    }
+
+    for(i = 0; i < noutputs; ++i) {
+        if(cos[i].pau) Au_Delete((HAU)cos[i].pau);
+        free(cos[i].times);
+    }
+    free(cos);
+} /* benchConcurrent_ */
+
+/* Main =================================================================== */
+
+int main(int argc, char **argv)
+{
+    static const int counts[] = { 1, 4, 16 };
+    char tmpname[] = "/tmp/au_bench_XXXXXX";
+    const char *filename;
+    int samplerate, channels, i, fd;
+    Au_SampleFormat format;
+    long int len = -1;
+
+    if(!Au_Startup()) return 2;
+
+    if(argc > 1) {
+        filename = argv[1];
+    } else {
+        if((fd = mkstemp(tmpname)) == -1) return 3;
+        close(fd);
+        filename = tmpname;
+        if(!makeInput_(filename, 44100)) return 4;
+    }
+    if(!Au_InspectFile(filename, &samplerate, &channels, &format, &len) ||
+        len <= 0) {
+        return 5;
+    }
+
+    printf("{\n  \"input\": { \"file\": \"%s\", \"rate\": %d, "
+            "\"channels\": %d, \"frames\": %ld },\n",
+            (argc > 1) ? filename : "generated", samplerate, channels, len);
+    printf("  \"conversion\": \"%s\",\n  \"results\": [",
+            AuConv_Implementation());
+
+    benchRing_(FALSE);
+    benchRing_(TRUE);
+    benchConvert_();
+    benchDecode_(filename, samplerate, channels);
+    benchOsc_();
+    benchCallback_(filename, AUSF_I16, samplerate, channels);
+    benchCallback_(filename, AUSF_F32, samplerate, channels);
+    for(i = 0; i < (int)(sizeof(counts)/sizeof(counts[0])); ++i) {
+        benchConcurrent_(filename, counts[i], samplerate, channels, len);
+    }
+    benchJitter_(filename, samplerate, channels);
+    benchPipe_(filename, samplerate, channels);
+
+    printf("\n  ]\n}\n");
+
+    if(argc <= 1) unlink(tmpname);
+    Au_Shutdown();
+    return 0;
+} /* main */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -17,9 +17,6 @@
 #include <limits.h>
 #include "audio_utsl.h"
 
-extern unsigned int AU_PAPC_Count;
-extern unsigned int AU_SFFR_Count;
-
 int main(int argc, char **argv)
 {
     HAU hau;
@@ -30,6 +27,7 @@ int main(int argc, char **argv)
     int idx;
     int maxidx;
     double time;
+    Au_Stats stats;
 
     if(argc<2) return 1;
     if(!Au_Startup()) return 2;
@@ -64,7 +62,12 @@ int main(int argc, char **argv)
 
     for(idx=0; idx < maxidx; ++idx) {
         time = Au_GetTimeInPlayback(hau);
-        printf("Time %f\tpapc %d\tsffr %d\n", time, AU_PAPC_Count, AU_SFFR_Count);
+        Au_GetStats(hau, &stats);
+        printf("Time %f\tcallbacks %lu\tblocks %lu\tunderruns %lu\t"
+                "fill min %ld avg %.1f/%ld\tfirst sample %.0f us\n", time,
+                stats.callbacks, stats.blocks_decoded, stats.underruns,
+                stats.ring_fill_min, stats.ring_fill_avg, stats.ring_blocks,
+                stats.first_sample_us);
         if(time>0 && !Au_IsPlaying(hau)) break;
             /* Check time>0 because IsPlaying is not necessarily true
              * just after an Au_Play() call, at which point time=0.*/
@@ -14,26 +14,47 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #define AU_HIGH_LEVEL
     /* to pull in Au_HL_*() */
 #include "audio_utsl.h"
 
-extern unsigned long Sine_Most_Recent_frameCount;   /* from audio_utsl.c */
-
 int main(void)
 {
     HAU hau;    /* the audio output */
+    Au_Tone tones[2];
+    Au_Stats stats;
 
     if(!Au_Startup()) return 1;
     if(!(hau=Au_New(AUSF_F32, 44100, 2, NULL))) return 2;
         /* create an output. */
 
     Au_HL_Sine(hau, 440.0, 2);      /* 2-sec. A4 sine wave */
-    printf("Last callback frame count was %lu\n", Sine_Most_Recent_frameCount);
 
-    if(!Au_Delete(hau)) return 3;
-    if(!Au_Shutdown()) return 4;
+    /* Without blocking: a sweep from A3 to A5 on the left, and quiet
+     * noise on the right, for 2 sec. */
+    memset(tones, 0, sizeof(tones));
+    tones[0].wave = AUWF_SINE;
+    tones[0].freq_hz = 220.0;
+    tones[0].end_freq_hz = 880.0;
+    tones[0].sweep_secs = 2.0;
+    tones[0].sweep_log = TRUE;
+    tones[0].gain = 0.5f;
+    tones[0].channel = 0;
+    tones[1].wave = AUWF_NOISE;
+    tones[1].gain = 0.05f;
+    tones[1].channel = 1;
+    if(!Au_PlayTones(hau, tones, 2, 2.0)) return 3;
+    Au_Wait(hau);
+
+    if(Au_GetStats(hau, &stats)) {
+        printf("%lu callbacks, %llu frames\n", stats.callbacks,
+                stats.frames_rendered);
+    }
+
+    if(!Au_Delete(hau)) return 4;
+    if(!Au_Shutdown()) return 5;
 
     return 0;
 }
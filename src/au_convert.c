@@ -0,0 +1,682 @@
+/* au_convert.c: Sample-format conversion for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Headers ================================================================ */
+
+#include "au_convert.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+/* The SIMD kernels are compiled with per-function target attributes,
+ * so the rest of the library doesn't need -mavx2, and are only called
+ * if the CPU has the instructions. */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define AU_CONV_X86
+#include <immintrin.h>
+#endif
+
+/* Private definitions ==================================================== */
+
+/** How many samples AuConv_FromFloat() and AuConv_Convert() handle at
+ * a time when they need scratch space. */
+#define AU_CONV_CHUNK (1024)
+
+/** Conversion parameters for the integer formats */
+#define I32_SCALE (2147483648.0f)
+#define I32_MAX_F (2147483520.0f)   /* largest float below 2^31 */
+#define I24_SCALE (8388608.0f)
+#define I16_SCALE (32768.0f)
+#define I8_SCALE (128.0f)
+
+/** A set of kernels.  #noise may be NULL, or #n values of dither, in
+ * LSBs of #format, to add before rounding. */
+typedef struct AuConvKernels {
+    const char *name;
+    void (*to_float)(Au_SampleFormat format, const void *src, float *dest,
+            size_t n);
+    void (*from_float)(Au_SampleFormat format, const float *src,
+            void *dest, size_t n, const float *noise);
+    void (*noise)(AuConv_Dither *dither, float *dest, size_t n);
+} AuConvKernels;
+
+/** Get the size of a single sample, in bytes, or -1 if unknown. */
+static int sampleSizeBytes_(Au_SampleFormat format)
+{
+    switch(format) {
+        case AUSF_F32: return 4;
+        case AUSF_I32: return 4;
+        case AUSF_I24: return 3;
+        case AUSF_I16: return 2;
+        case AUSF_I8: return 1;
+        case AUSF_UI8: return 1;
+        default: return -1;
+    }
+} /* sampleSizeBytes_ */
+
+/** Whether dither applies when converting to #format */
+static BOOL formatDithers_(Au_SampleFormat format)
+{
+    return (format == AUSF_I24) || (format == AUSF_I16) ||
+            (format == AUSF_I8) || (format == AUSF_UI8);
+} /* formatDithers_ */
+
+/* Scalar kernels ========================================================= */
+
+/** Scale, dither, clip and round one sample. */
+static long quantize_(float x, float scale, float max, const float *noise,
+        size_t i)
+{
+    x *= scale;
+    if(noise) x += noise[i];
+    if(x < -scale) x = -scale;
+    if(x > max) x = max;
+    return lrintf(x);
+} /* quantize_ */
+
+static void ToFloatScalar_(Au_SampleFormat format, const void *src,
+        float *dest, size_t n)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    size_t i;
+
+    switch(format) {
+        case AUSF_F32:
+            memcpy(dest, src, n * sizeof(float));
+            break;
+        case AUSF_I32:
+            for(i = 0; i < n; ++i) {
+                dest[i] = ((const int *)src)[i] * (1.0f / I32_SCALE);
+            }
+            break;
+        case AUSF_I24:
+            for(i = 0; i < n; ++i, s += 3) {
+                int v = (int)((unsigned)s[0] << 8 | (unsigned)s[1] << 16 |
+                                (unsigned)s[2] << 24);
+                dest[i] = v * (1.0f / I32_SCALE);
+            }
+            break;
+        case AUSF_I16:
+            for(i = 0; i < n; ++i) {
+                dest[i] = ((const short *)src)[i] * (1.0f / I16_SCALE);
+            }
+            break;
+        case AUSF_I8:
+            for(i = 0; i < n; ++i) {
+                dest[i] = ((const signed char *)src)[i] * (1.0f / I8_SCALE);
+            }
+            break;
+        case AUSF_UI8:
+            for(i = 0; i < n; ++i) {
+                dest[i] = ((int)s[i] - 128) * (1.0f / I8_SCALE);
+            }
+            break;
+        default:
+            memset(dest, 0, n * sizeof(float));
+            break;
+    }
+} /* ToFloatScalar_ */
+
+static void FromFloatScalar_(Au_SampleFormat format, const float *src,
+        void *dest, size_t n, const float *noise)
+{
+    unsigned char *d = (unsigned char *)dest;
+    size_t i;
+    long v;
+
+    switch(format) {
+        case AUSF_F32:
+            memcpy(dest, src, n * sizeof(float));
+            break;
+        case AUSF_I32:
+            for(i = 0; i < n; ++i) {
+                ((int *)dest)[i] =
+                    (int)quantize_(src[i], I32_SCALE, I32_MAX_F, NULL, i);
+            }
+            break;
+        case AUSF_I24:
+            for(i = 0; i < n; ++i, d += 3) {
+                v = quantize_(src[i], I24_SCALE, I24_SCALE - 1, noise, i);
+                d[0] = (unsigned char)v;
+                d[1] = (unsigned char)(v >> 8);
+                d[2] = (unsigned char)(v >> 16);
+            }
+            break;
+        case AUSF_I16:
+            for(i = 0; i < n; ++i) {
+                ((short *)dest)[i] =
+                    (short)quantize_(src[i], I16_SCALE, I16_SCALE - 1, noise, i);
+            }
+            break;
+        case AUSF_I8:
+            for(i = 0; i < n; ++i) {
+                ((signed char *)dest)[i] =
+                    (signed char)quantize_(src[i], I8_SCALE, I8_SCALE - 1,
+                                            noise, i);
+            }
+            break;
+        case AUSF_UI8:
+            for(i = 0; i < n; ++i) {
+                d[i] = (unsigned char)(quantize_(src[i], I8_SCALE,
+                                        I8_SCALE - 1, noise, i) + 128);
+            }
+            break;
+        default:
+            break;
+    }
+} /* FromFloatScalar_ */
+
+/** One step of xorshift32, as a float in [-0.5, 0.5). */
+static float uniform_(unsigned int *state)
+{
+    union { unsigned int u; float f; } bits;
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    bits.u = (x >> 9) | 0x3f800000u;    /* [1, 2) */
+    return bits.f - 1.5f;
+} /* uniform_ */
+
+/** Fill #dest with TPDF noise in (-1, 1): the sum of two uniforms. */
+static void NoiseScalar_(AuConv_Dither *dither, float *dest, size_t n)
+{
+    size_t i;
+    for(i = 0; i < n; ++i) {
+        dest[i] = uniform_(&dither->state[0]) + uniform_(&dither->state[0]);
+    }
+} /* NoiseScalar_ */
+
+static const AuConvKernels ScalarKernels_ = {
+    "scalar", ToFloatScalar_, FromFloatScalar_, NoiseScalar_
+};
+
+#ifdef AU_CONV_X86
+
+/* SSE2 kernels =========================================================== */
+
+#define SSE2 __attribute__((target("sse2")))
+
+/** Scale, dither and clip four samples, then round them to ints. */
+static SSE2 __m128i QuantizeSSE2_(const float *src, __m128 scale,
+        __m128 min, __m128 max, const float *noise)
+{
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(src), scale);
+    if(noise) x = _mm_add_ps(x, _mm_loadu_ps(noise));
+    x = _mm_min_ps(_mm_max_ps(x, min), max);
+    return _mm_cvtps_epi32(x);      /* round to nearest */
+} /* QuantizeSSE2_ */
+
+static SSE2 void ToFloatSSE2_(Au_SampleFormat format, const void *src,
+        float *dest, size_t n)
+{
+    size_t i = 0;
+    __m128i v, lo, hi;
+    const __m128i zero = _mm_setzero_si128();
+
+    switch(format) {
+        case AUSF_I32: {
+            const __m128 k = _mm_set1_ps(1.0f / I32_SCALE);
+            const int *s = (const int *)src;
+            for(; i + 4 <= n; i += 4) {
+                v = _mm_loadu_si128((const __m128i *)(s + i));
+                _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(v), k));
+            }
+            break;
+        }
+        case AUSF_I16: {
+            const __m128 k = _mm_set1_ps(1.0f / I16_SCALE);
+            const short *s = (const short *)src;
+            for(; i + 8 <= n; i += 8) {
+                v = _mm_loadu_si128((const __m128i *)(s + i));
+                lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+                hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+                _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), k));
+                _mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), k));
+            }
+            break;
+        }
+        case AUSF_I8:
+        case AUSF_UI8: {
+            const __m128 k = _mm_set1_ps(1.0f / I8_SCALE);
+            const unsigned char *s = (const unsigned char *)src;
+            const __m128i bias = _mm_set1_epi32(128);
+            for(; i + 8 <= n; i += 8) {
+                v = _mm_loadl_epi64((const __m128i *)(s + i));
+                if(format == AUSF_I8) {     /* sign-extend to 16 bits */
+                    v = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+                    lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+                    hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+                } else {                    /* zero-extend, then unbias */
+                    v = _mm_unpacklo_epi8(v, zero);
+                    lo = _mm_sub_epi32(_mm_unpacklo_epi16(v, zero), bias);
+                    hi = _mm_sub_epi32(_mm_unpackhi_epi16(v, zero), bias);
+                }
+                _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), k));
+                _mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), k));
+            }
+            break;
+        }
+        default:    /* F32 is a copy; I24 needs SSSE3 shuffles */
+            break;
+    }
+
+    if(i < n) {     /* the rest */
+        ToFloatScalar_(format,
+                (const unsigned char *)src + i * sampleSizeBytes_(format),
+                dest + i, n - i);
+    }
+} /* ToFloatSSE2_ */
+
+static SSE2 void FromFloatSSE2_(Au_SampleFormat format, const float *src,
+        void *dest, size_t n, const float *noise)
+{
+    size_t i = 0;
+    __m128i lo, hi, v;
+
+    switch(format) {
+        case AUSF_I32: {
+            const __m128 k = _mm_set1_ps(I32_SCALE);
+            const __m128 min = _mm_set1_ps(-I32_SCALE);
+            const __m128 max = _mm_set1_ps(I32_MAX_F);
+            int *d = (int *)dest;
+            for(; i + 4 <= n; i += 4) {
+                _mm_storeu_si128((__m128i *)(d + i),
+                        QuantizeSSE2_(src + i, k, min, max, NULL));
+            }
+            break;
+        }
+        case AUSF_I16: {
+            const __m128 k = _mm_set1_ps(I16_SCALE);
+            const __m128 min = _mm_set1_ps(-I16_SCALE);
+            const __m128 max = _mm_set1_ps(I16_SCALE - 1);
+            short *d = (short *)dest;
+            for(; i + 8 <= n; i += 8) {
+                lo = QuantizeSSE2_(src + i, k, min, max, noise ? noise + i : NULL);
+                hi = QuantizeSSE2_(src + i + 4, k, min, max,
+                                    noise ? noise + i + 4 : NULL);
+                _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(lo, hi));
+            }
+            break;
+        }
+        case AUSF_I8:
+        case AUSF_UI8: {
+            const __m128 k = _mm_set1_ps(I8_SCALE);
+            const __m128 min = _mm_set1_ps(-I8_SCALE);
+            const __m128 max = _mm_set1_ps(I8_SCALE - 1);
+            const __m128i flip = _mm_set1_epi8(
+                                    (format == AUSF_UI8) ? (char)0x80 : 0);
+            unsigned char *d = (unsigned char *)dest;
+            for(; i + 8 <= n; i += 8) {
+                lo = QuantizeSSE2_(src + i, k, min, max, noise ? noise + i : NULL);
+                hi = QuantizeSSE2_(src + i + 4, k, min, max,
+                                    noise ? noise + i + 4 : NULL);
+                v = _mm_packs_epi32(lo, hi);
+                v = _mm_xor_si128(_mm_packs_epi16(v, v), flip);
+                _mm_storel_epi64((__m128i *)(d + i), v);
+            }
+            break;
+        }
+        default:    /* F32 is a copy; I24 needs SSSE3 shuffles */
+            break;
+    }
+
+    if(i < n) {     /* the rest */
+        FromFloatScalar_(format, src + i,
+                (unsigned char *)dest + i * sampleSizeBytes_(format), n - i,
+                noise ? noise + i : NULL);
+    }
+} /* FromFloatSSE2_ */
+
+/** Four lanes of uniform_(), using dither->state[0..3]. */
+static SSE2 __m128 UniformSSE2_(__m128i *state)
+{
+    __m128i x = *state;
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    *state = x;
+    x = _mm_or_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x3f800000));
+    return _mm_sub_ps(_mm_castsi128_ps(x), _mm_set1_ps(1.5f));
+} /* UniformSSE2_ */
+
+static SSE2 void NoiseSSE2_(AuConv_Dither *dither, float *dest, size_t n)
+{
+    size_t i = 0;
+    __m128i state = _mm_loadu_si128((const __m128i *)dither->state);
+    __m128 a, b;
+
+    for(; i + 4 <= n; i += 4) {
+        a = UniformSSE2_(&state);
+        b = UniformSSE2_(&state);
+        _mm_storeu_ps(dest + i, _mm_add_ps(a, b));
+    }
+    _mm_storeu_si128((__m128i *)dither->state, state);
+
+    if(i < n) NoiseScalar_(dither, dest + i, n - i);
+} /* NoiseSSE2_ */
+
+static const AuConvKernels SSE2Kernels_ = {
+    "sse2", ToFloatSSE2_, FromFloatSSE2_, NoiseSSE2_
+};
+
+/* AVX2 kernels =========================================================== */
+
+#define AVX2 __attribute__((target("avx2")))
+
+/** Scale, dither and clip eight samples, then round them to ints. */
+static AVX2 __m256i QuantizeAVX2_(const float *src, __m256 scale,
+        __m256 min, __m256 max, const float *noise)
+{
+    __m256 x = _mm256_mul_ps(_mm256_loadu_ps(src), scale);
+    if(noise) x = _mm256_add_ps(x, _mm256_loadu_ps(noise));
+    x = _mm256_min_ps(_mm256_max_ps(x, min), max);
+    return _mm256_cvtps_epi32(x);
+} /* QuantizeAVX2_ */
+
+static AVX2 void ToFloatAVX2_(Au_SampleFormat format, const void *src,
+        float *dest, size_t n)
+{
+    size_t i = 0;
+    __m256i v;
+
+    switch(format) {
+        case AUSF_I32: {
+            const __m256 k = _mm256_set1_ps(1.0f / I32_SCALE);
+            const int *s = (const int *)src;
+            for(; i + 8 <= n; i += 8) {
+                v = _mm256_loadu_si256((const __m256i *)(s + i));
+                _mm256_storeu_ps(dest + i,
+                        _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+            }
+            break;
+        }
+        case AUSF_I24: {
+            /* Put each sample's 3 bytes in the top of an int32, so the
+             * ints are the samples times 256.  Each load covers 16
+             * bytes for 12 bytes of data, so stop while there are at
+             * least 10 samples left. */
+            const __m256 k = _mm256_set1_ps(1.0f / I32_SCALE);
+            const __m128i spread = _mm_setr_epi8(
+                    -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+            const unsigned char *s = (const unsigned char *)src;
+            __m128i lo, hi;
+            for(; i + 10 <= n; i += 8) {
+                lo = _mm_shuffle_epi8(
+                        _mm_loadu_si128((const __m128i *)(s + 3 * i)), spread);
+                hi = _mm_shuffle_epi8(
+                        _mm_loadu_si128((const __m128i *)(s + 3 * i + 12)),
+                        spread);
+                v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+                _mm256_storeu_ps(dest + i,
+                        _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+            }
+            break;
+        }
+        case AUSF_I16: {
+            const __m256 k = _mm256_set1_ps(1.0f / I16_SCALE);
+            const short *s = (const short *)src;
+            for(; i + 8 <= n; i += 8) {
+                v = _mm256_cvtepi16_epi32(
+                        _mm_loadu_si128((const __m128i *)(s + i)));
+                _mm256_storeu_ps(dest + i,
+                        _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+            }
+            break;
+        }
+        case AUSF_I8:
+        case AUSF_UI8: {
+            const __m256 k = _mm256_set1_ps(1.0f / I8_SCALE);
+            const __m256i bias = _mm256_set1_epi32(128);
+            const unsigned char *s = (const unsigned char *)src;
+            for(; i + 8 <= n; i += 8) {
+                __m128i b = _mm_loadl_epi64((const __m128i *)(s + i));
+                if(format == AUSF_I8) {
+                    v = _mm256_cvtepi8_epi32(b);
+                } else {
+                    v = _mm256_sub_epi32(_mm256_cvtepu8_epi32(b), bias);
+                }
+                _mm256_storeu_ps(dest + i,
+                        _mm256_mul_ps(_mm256_cvtepi32_ps(v), k));
+            }
+            break;
+        }
+        default:    /* F32 is a copy */
+            break;
+    }
+
+    if(i < n) {     /* the rest */
+        ToFloatSSE2_(format,
+                (const unsigned char *)src + i * sampleSizeBytes_(format),
+                dest + i, n - i);
+    }
+} /* ToFloatAVX2_ */
+
+static AVX2 void FromFloatAVX2_(Au_SampleFormat format, const float *src,
+        void *dest, size_t n, const float *noise)
+{
+    size_t i = 0;
+    __m256i v;
+    __m128i lo, hi;
+
+    switch(format) {
+        case AUSF_I32: {
+            const __m256 k = _mm256_set1_ps(I32_SCALE);
+            const __m256 min = _mm256_set1_ps(-I32_SCALE);
+            const __m256 max = _mm256_set1_ps(I32_MAX_F);
+            int *d = (int *)dest;
+            for(; i + 8 <= n; i += 8) {
+                _mm256_storeu_si256((__m256i *)(d + i),
+                        QuantizeAVX2_(src + i, k, min, max, NULL));
+            }
+            break;
+        }
+        case AUSF_I24: {
+            /* Pack the low 3 bytes of each int.  Each store writes 16
+             * bytes for 12 bytes of data; the extra 4 are overwritten
+             * by the next store, so stop while there are at least 10
+             * samples left. */
+            const __m256 k = _mm256_set1_ps(I24_SCALE);
+            const __m256 min = _mm256_set1_ps(-I24_SCALE);
+            const __m256 max = _mm256_set1_ps(I24_SCALE - 1);
+            const __m128i pack = _mm_setr_epi8(
+                    0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+            unsigned char *d = (unsigned char *)dest;
+            for(; i + 10 <= n; i += 8) {
+                v = QuantizeAVX2_(src + i, k, min, max, noise ? noise + i : NULL);
+                _mm_storeu_si128((__m128i *)(d + 3 * i),
+                        _mm_shuffle_epi8(_mm256_castsi256_si128(v), pack));
+                _mm_storeu_si128((__m128i *)(d + 3 * i + 12),
+                        _mm_shuffle_epi8(_mm256_extracti128_si256(v, 1), pack));
+            }
+            break;
+        }
+        case AUSF_I16: {
+            const __m256 k = _mm256_set1_ps(I16_SCALE);
+            const __m256 min = _mm256_set1_ps(-I16_SCALE);
+            const __m256 max = _mm256_set1_ps(I16_SCALE - 1);
+            short *d = (short *)dest;
+            for(; i + 8 <= n; i += 8) {
+                v = QuantizeAVX2_(src + i, k, min, max, noise ? noise + i : NULL);
+                lo = _mm256_castsi256_si128(v);
+                hi = _mm256_extracti128_si256(v, 1);
+                _mm_storeu_si128((__m128i *)(d + i), _mm_packs_epi32(lo, hi));
+            }
+            break;
+        }
+        case AUSF_I8:
+        case AUSF_UI8: {
+            const __m256 k = _mm256_set1_ps(I8_SCALE);
+            const __m256 min = _mm256_set1_ps(-I8_SCALE);
+            const __m256 max = _mm256_set1_ps(I8_SCALE - 1);
+            const __m128i flip = _mm_set1_epi8(
+                                    (format == AUSF_UI8) ? (char)0x80 : 0);
+            unsigned char *d = (unsigned char *)dest;
+            for(; i + 8 <= n; i += 8) {
+                v = QuantizeAVX2_(src + i, k, min, max, noise ? noise + i : NULL);
+                lo = _mm_packs_epi32(_mm256_castsi256_si128(v),
+                                        _mm256_extracti128_si256(v, 1));
+                lo = _mm_xor_si128(_mm_packs_epi16(lo, lo), flip);
+                _mm_storel_epi64((__m128i *)(d + i), lo);
+            }
+            break;
+        }
+        default:    /* F32 is a copy */
+            break;
+    }
+
+    if(i < n) {     /* the rest */
+        FromFloatSSE2_(format, src + i,
+                (unsigned char *)dest + i * sampleSizeBytes_(format), n - i,
+                noise ? noise + i : NULL);
+    }
+} /* FromFloatAVX2_ */
+
+static const AuConvKernels AVX2Kernels_ = {
+    "avx2", ToFloatAVX2_, FromFloatAVX2_, NoiseSSE2_
+};
+
+#endif /* AU_CONV_X86 */
+
+/* Dispatch =============================================================== */
+
+/** The kernels in use */
+static const AuConvKernels *AuConvImpl_ = NULL;
+
+static pthread_once_t AuConvOnce_ = PTHREAD_ONCE_INIT;
+
+/** Pick the best kernels for this CPU. */
+static void AuConvSelect_(void)
+{
+    if(AuConvImpl_) return;     /* AuConv_SetImplementation() was called */
+    AuConvImpl_ = &ScalarKernels_;
+#ifdef AU_CONV_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        AuConvImpl_ = &AVX2Kernels_;
+    } else if(__builtin_cpu_supports("sse2")) {
+        AuConvImpl_ = &SSE2Kernels_;
+    }
+#endif
+} /* AuConvSelect_ */
+
+/** Get the kernels in use, choosing them if necessary. */
+static const AuConvKernels *impl_(void)
+{
+    pthread_once(&AuConvOnce_, AuConvSelect_);
+    return AuConvImpl_;
+} /* impl_ */
+
+const char *AuConv_Implementation(void)
+{
+    return impl_()->name;
+} /* AuConv_Implementation */
+
+BOOL AuConv_SetImplementation(const char *name)
+{
+    const AuConvKernels *k = NULL;
+
+    if(!name) return FALSE;
+    if(0 == strcmp(name, ScalarKernels_.name)) k = &ScalarKernels_;
+#ifdef AU_CONV_X86
+    __builtin_cpu_init();
+    if( (0 == strcmp(name, SSE2Kernels_.name)) &&
+        __builtin_cpu_supports("sse2") ) {
+        k = &SSE2Kernels_;
+    }
+    if( (0 == strcmp(name, AVX2Kernels_.name)) &&
+        __builtin_cpu_supports("avx2") ) {
+        k = &AVX2Kernels_;
+    }
+#endif
+    if(!k) return FALSE;
+
+    AuConvImpl_ = k;
+    pthread_once(&AuConvOnce_, AuConvSelect_);  /* so it won't override */
+    return TRUE;
+} /* AuConv_SetImplementation */
+
+/* Public functions ======================================================= */
+
+void AuConv_DitherInit(AuConv_Dither *dither, unsigned int seed)
+{
+    int i;
+    for(i = 0; i < 8; ++i) {
+        /* Spread the seed out with a Weyl sequence; xorshift needs
+         * nonzero state. */
+        dither->state[i] = (seed + (unsigned int)(i + 1) * 0x9E3779B9u) | 1;
+    }
+} /* AuConv_DitherInit */
+
+void AuConv_ToFloat(Au_SampleFormat format, const void *src, float *dest,
+        size_t n)
+{
+    impl_()->to_float(format, src, dest, n);
+} /* AuConv_ToFloat */
+
+void AuConv_FromFloat(Au_SampleFormat format, const float *src, void *dest,
+        size_t n, AuConv_Dither *dither)
+{
+    const AuConvKernels *k = impl_();
+    float noise[AU_CONV_CHUNK];
+    size_t done, count;
+    int size = sampleSizeBytes_(format);
+
+    if(!dither || !formatDithers_(format)) {
+        k->from_float(format, src, dest, n, NULL);
+        return;
+    }
+
+    for(done = 0; done < n; done += count) {
+        count = n - done;
+        if(count > AU_CONV_CHUNK) count = AU_CONV_CHUNK;
+        k->noise(dither, noise, count);
+        k->from_float(format, src + done,
+                (unsigned char *)dest + done * size, count, noise);
+    }
+} /* AuConv_FromFloat */
+
+BOOL AuConv_Convert(Au_SampleFormat from, const void *src,
+        Au_SampleFormat to, void *dest, size_t n, AuConv_Dither *dither)
+{
+    float buf[AU_CONV_CHUNK];
+    size_t done, count;
+    int from_size = sampleSizeBytes_(from), to_size = sampleSizeBytes_(to);
+
+    if(from_size < 0 || to_size < 0) return FALSE;
+
+    if(from == to) {
+        memcpy(dest, src, n * from_size);
+    } else if(from == AUSF_F32) {
+        AuConv_FromFloat(to, (const float *)src, dest, n, dither);
+    } else if(to == AUSF_F32) {
+        AuConv_ToFloat(from, src, (float *)dest, n);
+    } else {
+        for(done = 0; done < n; done += count) {
+            count = n - done;
+            if(count > AU_CONV_CHUNK) count = AU_CONV_CHUNK;
+            AuConv_ToFloat(from, (const unsigned char *)src + done * from_size,
+                    buf, count);
+            AuConv_FromFloat(to, buf,
+                    (unsigned char *)dest + done * to_size, count, dither);
+        }
+    }
+    return TRUE;
+} /* AuConv_Convert */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -0,0 +1,70 @@
+/* au_convert.h: Sample-format conversion for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AU_CONVERT_H_
+#define _AU_CONVERT_H_
+
+#include <stddef.h>
+#include "audio_utsl.h"
+
+/* Conversions go through float in [-1, 1).  An integer format with N
+ * bits maps to float by dividing by 2^(N-1); the other way, values
+ * are scaled by 2^(N-1), rounded to nearest, and clipped.  AUSF_I24 is
+ * packed, 3 bytes per sample, little-endian.  AUSF_UI8 is offset
+ * binary, with silence at 0x80.
+ *
+ * Each function picks the fastest kernels the CPU supports (AVX2,
+ * SSE2, or plain C) the first time it is called. */
+
+/** State for TPDF dither.  Pass one to AuConv_FromFloat() or
+ * AuConv_Convert() to add triangular noise of +/-1 LSB before
+ * rounding, which turns truncation distortion into a low, constant
+ * noise floor.  Only used when converting to AUSF_I24, AUSF_I16,
+ * AUSF_I8 or AUSF_UI8.  Each stream of audio should have its own. */
+typedef struct AuConv_Dither {
+    unsigned int state[8];
+} AuConv_Dither;
+
+/** Seed #dither.  Any #seed is fine, including 0. */
+void AuConv_DitherInit(AuConv_Dither *dither, unsigned int seed);
+
+/** Convert #n samples (not frames) of #format at #src to float. */
+void AuConv_ToFloat(Au_SampleFormat format, const void *src, float *dest,
+        size_t n);
+
+/** Convert #n floats at #src to #format.
+ * @param dither If non-NULL, add TPDF dither. */
+void AuConv_FromFloat(Au_SampleFormat format, const float *src, void *dest,
+        size_t n, AuConv_Dither *dither);
+
+/** Convert #n samples from any format to any other.  #src and #dest
+ * must not overlap.
+ * @param dither If non-NULL, add TPDF dither when narrowing.
+ * @return TRUE on success; FALSE if either format is AUSF_CUSTOM. */
+BOOL AuConv_Convert(Au_SampleFormat from, const void *src,
+        Au_SampleFormat to, void *dest, size_t n, AuConv_Dither *dither);
+
+/** Get the name of the kernels in use: "avx2", "sse2" or "scalar". */
+const char *AuConv_Implementation(void);
+
+/** Use the kernels called #name instead of the best available, e.g.,
+ * to compare them.  Not thread-safe: call before converting anything.
+ * @return TRUE on success; FALSE if #name is unknown or the CPU can't
+ *          run it. */
+BOOL AuConv_SetImplementation(const char *name);
+
+#endif /* _AU_CONVERT_H_ */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -0,0 +1,823 @@
+/* au_fileio.c: Read-ahead file input for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Headers ================================================================ */
+
+#include "au_fileio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef AU_USE_IO_URING
+#include <liburing.h>
+#endif
+
+/* Private definitions ==================================================== */
+
+/** The default for AuFileParams.chunk_bytes */
+#define AU_FILE_CHUNK_BYTES (64*1024)
+
+/** The default for AuFileParams.chunks */
+#define AU_FILE_CHUNKS (8)
+
+/** The least AuFileParams.chunks: the current one, one to read it into,
+ * and at least one read ahead */
+#define AU_FILE_MIN_CHUNKS (3)
+
+/** How many chunks a file caches without io_uring.  The kernel reads
+ * ahead into the page cache, so these only turn libsndfile's small
+ * reads into large ones.  Two, so a read back across a chunk boundary
+ * doesn't read both chunks again. */
+#define AU_FILE_SYNC_CHUNKS (2)
+
+typedef enum AuFileChunkState {
+    AFCS_EMPTY,
+    AFCS_READING,   /**< an io_uring read is in flight */
+    AFCS_READY
+} AuFileChunkState;
+
+typedef struct AuFileChunk {
+    AuFileChunkState state;
+
+    /** Which chunk of the file this is, counting from 0 */
+    sf_count_t index;
+
+    /** How many bytes of #data are valid, once AFCS_READY.  Less than
+     * AuFile.chunk_bytes only at the end of the file. */
+    long len;
+
+    unsigned char *data;
+} AuFileChunk;
+
+struct AuFile {
+    int fd;
+
+    /** The file's size, as of when it was opened */
+    sf_count_t size;
+
+    /** Where libsndfile is reading */
+    sf_count_t pos;
+
+    /** The size of each chunk */
+    long chunk_bytes;
+
+    /** How many chunks past the current one to read ahead.  Less than
+     * #nchunks with async reads, so there is always a chunk to read the
+     * current one into. */
+    int read_ahead;
+
+    /** The cache: #nchunks chunks, AuFileParams.chunks with async
+     * reads, AU_FILE_SYNC_CHUNKS without */
+    AuFileChunk *chunks;
+    int nchunks;
+
+    /** The storage for all the chunks */
+    unsigned char *data;
+
+    /** Without async reads, the last chunk we have asked the kernel to
+     * read ahead, or -1. */
+    sf_count_t advised_to;
+
+#ifdef AU_USE_IO_URING
+    /** Whether #ring has been set up */
+    int uring;
+
+    /** Whether to start reads on #ring.  Cleared if a submit fails. */
+    int async;
+
+    struct io_uring ring;
+
+    /** How many reads on #ring haven't completed */
+    int inflight;
+#endif
+};
+
+/** The size of chunk #index of #f, which is short at the end */
+static long FileChunkLen_(const AuFile *f, sf_count_t index)
+{
+    sf_count_t left = f->size - index * f->chunk_bytes;
+    if(left < 0) return 0;
+    return (left < f->chunk_bytes) ? (long)left : f->chunk_bytes;
+} /* FileChunkLen_ */
+
+/** Read chunk #index of #f into #c with pread(), waiting for it.
+ * @return TRUE if any of it could be read. */
+static int FileReadSync_(AuFile *f, AuFileChunk *c, sf_count_t index)
+{
+    sf_count_t off = index * f->chunk_bytes;
+    long want = FileChunkLen_(f, index), got = 0;
+    ssize_t n;
+
+    while(got < want) {
+        n = pread(f->fd, c->data + got, want - got, off + got);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        got += n;
+    }
+
+    c->index = index;
+    c->len = got;
+    c->state = (got > 0) ? AFCS_READY : AFCS_EMPTY;
+    return got > 0;
+} /* FileReadSync_ */
+
+/** Find chunk #index of #f in the cache, whether ready or still being
+ * read.  NULL if it isn't there. */
+static AuFileChunk *FileFind_(AuFile *f, sf_count_t index)
+{
+    int i;
+    for(i = 0; i < f->nchunks; ++i) {
+        if( (f->chunks[i].state != AFCS_EMPTY) &&
+            (f->chunks[i].index == index) ) {
+            return &f->chunks[i];
+        }
+    }
+    return NULL;
+} /* FileFind_ */
+
+/** Pick a chunk to reuse when reading at chunk #cur: an empty one, or
+ * else the ready one furthest from #cur that isn't one we are about to
+ * need.  NULL if every chunk is either needed or still being read.
+ * Without async reads, nothing is read ahead into the cache, so only
+ * #cur itself is needed. */
+static AuFileChunk *FileVictim_(AuFile *f, sf_count_t cur)
+{
+    AuFileChunk *c, *best = NULL;
+    sf_count_t dist, best_dist = -1;
+    int i;
+
+    int ahead = 0;
+
+#ifdef AU_USE_IO_URING
+    if(f->async) ahead = f->read_ahead;
+#endif
+
+    for(i = 0; i < f->nchunks; ++i) {
+        c = &f->chunks[i];
+        if(c->state == AFCS_EMPTY) return c;
+        if(c->state != AFCS_READY) continue;
+        if( (c->index >= cur) && (c->index <= cur + ahead) ) continue;
+        dist = (c->index < cur) ? cur - c->index : c->index - cur;
+        if(dist > best_dist) {
+            best = c;
+            best_dist = dist;
+        }
+    }
+    return best;
+} /* FileVictim_ */
+
+#ifdef AU_USE_IO_URING
+
+/** Collect one finished read from #f's ring.
+ * @param wait If TRUE, wait for one; otherwise, only take one that has
+ *          already finished.
+ * @return TRUE if a read was collected. */
+static int FileReap_(AuFile *f, int wait)
+{
+    struct io_uring_cqe *cqe;
+    AuFileChunk *c;
+    int res;
+
+    if(f->inflight <= 0) return 0;
+
+    do {
+        res = wait ? io_uring_wait_cqe(&f->ring, &cqe) :
+                     io_uring_peek_cqe(&f->ring, &cqe);
+    } while(wait && res == -EINTR);
+    if(res < 0 || !cqe) return 0;
+
+    c = (AuFileChunk *)io_uring_cqe_get_data(cqe);
+    res = cqe->res;
+    io_uring_cqe_seen(&f->ring, cqe);
+    --f->inflight;
+
+    if(res == FileChunkLen_(f, c->index)) {
+        c->len = res;
+        c->state = AFCS_READY;
+    } else if(res >= 0) {
+        FileReadSync_(f, c, c->index);      /* short read - finish it */
+    } else {
+        c->state = AFCS_EMPTY;      /* we'll try again when it's needed */
+    }
+    return 1;
+} /* FileReap_ */
+
+/** Start reading chunk #index of #f into #c on the ring.
+ * @return TRUE if the read was started. */
+static int FileStartRead_(AuFile *f, AuFileChunk *c, sf_count_t index)
+{
+    struct io_uring_sqe *sqe;
+
+    if(!(sqe = io_uring_get_sqe(&f->ring))) return 0;
+    io_uring_prep_read(sqe, f->fd, c->data, FileChunkLen_(f, index),
+            index * f->chunk_bytes);
+    io_uring_sqe_set_data(sqe, c);
+    if(io_uring_submit(&f->ring) < 1) {
+        f->async = 0;   /* don't rely on the ring from here on */
+        return 0;
+    }
+
+    c->index = index;
+    c->state = AFCS_READING;
+    ++f->inflight;
+    return 1;
+} /* FileStartRead_ */
+
+#endif /* AU_USE_IO_URING */
+
+/** Get chunk #index of #f, reading it if it isn't already cached, and
+ * waiting for it if it is still being read.
+ * @return The chunk, or NULL on error. */
+static AuFileChunk *FileChunk_(AuFile *f, sf_count_t index)
+{
+    AuFileChunk *c;
+
+    while(1) {
+        c = FileFind_(f, index);
+        if(c && c->state == AFCS_READY) return c;
+#ifdef AU_USE_IO_URING
+        if(c) {     /* in flight */
+            if(!FileReap_(f, 1)) return NULL;
+            continue;
+        }
+#endif
+
+        if(!(c = FileVictim_(f, index))) {
+#ifdef AU_USE_IO_URING
+            if(FileReap_(f, 1)) continue;   /* wait for a free chunk */
+#endif
+            return NULL;
+        }
+        return FileReadSync_(f, c, index) ? c : NULL;
+    }
+} /* FileChunk_ */
+
+/** Get the chunks after #cur on their way, so they are there when
+ * libsndfile gets to them. */
+static void FileReadAhead_(AuFile *f, sf_count_t cur)
+{
+    sf_count_t last = (f->size - 1) / f->chunk_bytes;
+    sf_count_t from, to;
+
+#ifdef AU_USE_IO_URING
+    if(f->async) {
+        AuFileChunk *c;
+        while(FileReap_(f, 0)) { }    /* collect what has finished */
+
+        for(from = cur + 1; from <= cur + f->read_ahead && from <= last;
+                ++from) {
+            if(FileFind_(f, from)) continue;
+            if(!(c = FileVictim_(f, cur))) break;
+            if(!FileStartRead_(f, c, from)) break;
+        }
+        return;
+    }
+#endif
+
+    /* Without async reads, have the kernel fetch the next few chunks
+     * into the page cache in the background. */
+    from = cur + 1;
+    if(f->advised_to >= from) from = f->advised_to + 1;
+    to = cur + f->read_ahead;
+    if(to > last) to = last;
+    if(from > to) return;
+
+    posix_fadvise(f->fd, from * f->chunk_bytes,
+            (to - from + 1) * f->chunk_bytes, POSIX_FADV_WILLNEED);
+    f->advised_to = to;
+} /* FileReadAhead_ */
+
+/** How much an AuPipe keeps behind the read position, so libsndfile can
+ * seek back a little */
+#define AU_PIPE_REWIND_BYTES (64*1024)
+
+/** How much an AuPipe buffers */
+#define AU_PIPE_BYTES (AU_PIPE_AHEAD_BYTES + AU_PIPE_REWIND_BYTES)
+
+/** How much an AuPipe asks the source for at once */
+#define AU_PIPE_READ_BYTES (64*1024)
+
+/** How often, in ms, a pipe reading a file descriptor checks whether
+ * it should stop */
+#define AU_PIPE_POLL_MS (100)
+
+struct AuPipe {
+    /** The source */
+    AuPipe_ReadFn read;
+    void *user_data;
+
+    /** The file descriptor from AuPipe_OpenFd(), or -1.  Closed by
+     * AuPipe_Close() if #close_fd. */
+    int fd;
+    int close_fd;
+
+    AuPipe_NotifyFn notify;
+    void *notify_arg;
+
+    /** The thread that reads from the source.  Detached: AuPipe_Stop()
+     * doesn't wait for a read of a callback source to return. */
+    pthread_t thread;
+
+    /** Protects everything below */
+    pthread_mutex_t mutex;
+
+    /** Broadcast when data arrives, when there is room for more, on
+     * AuPipe_Stop(), and when the thread stops notifying or exits */
+    pthread_cond_t changed;
+
+    /** Who still uses the pipe: the owner until AuPipe_Close(), and the
+     * thread until it exits.  The last one frees it. */
+    int refs;
+
+    /** Set while the thread runs, and while it calls #notify */
+    int pumping;
+    int notifying;
+
+    /** AU_PIPE_BYTES bytes, used circularly: stream byte n lives at
+     * buf[n % AU_PIPE_BYTES]. */
+    unsigned char *buf;
+
+    /** Stream offsets: the oldest byte still in #buf, one past the
+     * newest, and where libsndfile is reading.  base <= end.  #pos may
+     * be past #end after a seek forward. */
+    sf_count_t base, end, pos;
+
+    /** Set when the source has ended or failed */
+    int done;
+
+    /** How far past #pos the reader is waiting for data to reach
+     * before it is notified, or 0 if it isn't (AuPipe_Available()) */
+    sf_count_t want;
+
+    /** Set by AuPipe_Stop() */
+    int stop;
+};
+
+/* Pipes ================================================================== */
+
+/** Drop a reference to #p, which is locked, and unlock it.  Frees #p,
+ * and closes its file descriptor if it owns it, if that was the
+ * last. */
+static void PipeRelease_(AuPipe *p)
+{
+    int last = (--p->refs == 0);
+
+    pthread_mutex_unlock(&p->mutex);
+    if(!last) return;
+
+    if(p->close_fd && p->fd >= 0) close(p->fd);
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->mutex);
+    free(p->buf);
+    free(p);
+} /* PipeRelease_ */
+
+/** AuPipe_ReadFn for a file descriptor.  Waits in poll() rather than
+ * read(), so it notices AuPipe_Stop(). */
+static long PipeFdRead_(void *user_data, void *buf, size_t len)
+{
+    AuPipe *p = (AuPipe *)user_data;
+    struct pollfd pfd;
+    ssize_t n;
+    int res;
+
+    while(!__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE)) {
+        pfd.fd = p->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        res = poll(&pfd, 1, AU_PIPE_POLL_MS);
+        if(res < 0 && errno != EINTR) return -1;
+        if(res <= 0) continue;
+
+        n = read(p->fd, buf, len);
+        if(n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        return (long)n;
+    }
+    return 0;
+} /* PipeFdRead_ */
+
+/** The pipe's thread: keep #buf as full as the reader allows */
+static void *PipePump_(void *handle)
+{
+    AuPipe *p = (AuPipe *)handle;
+    sf_count_t keep, room, off;
+    long got;
+    int notify;
+
+    pthread_mutex_lock(&p->mutex);
+    while(!p->stop && !p->done) {
+        /* Make room by dropping what is well behind the reader */
+        keep = p->pos - AU_PIPE_REWIND_BYTES;
+        if(keep > p->end) keep = p->end;
+        if(keep > p->base) p->base = keep;
+
+        room = AU_PIPE_BYTES - (p->end - p->base);
+        if(room <= 0) {
+            pthread_cond_wait(&p->changed, &p->mutex);
+            continue;
+        }
+        off = p->end % AU_PIPE_BYTES;
+        if(room > AU_PIPE_BYTES - off) room = AU_PIPE_BYTES - off;
+        if(room > AU_PIPE_READ_BYTES) room = AU_PIPE_READ_BYTES;
+
+        /* Nothing else touches buf past #end, so no lock needed */
+        pthread_mutex_unlock(&p->mutex);
+        got = p->read(p->user_data, p->buf + off, (size_t)room);
+        pthread_mutex_lock(&p->mutex);
+
+        if(got <= 0) p->done = 1;
+        else p->end += got;
+        pthread_cond_broadcast(&p->changed);
+
+        notify = p->notify && !p->stop &&
+                    (p->done || (p->want && (p->end - p->pos >= p->want)));
+        if(notify) {
+            p->want = 0;
+            p->notifying = 1;
+            pthread_mutex_unlock(&p->mutex);
+            p->notify(p->notify_arg);
+            pthread_mutex_lock(&p->mutex);
+            p->notifying = 0;
+            pthread_cond_broadcast(&p->changed);
+        }
+    }
+
+    p->pumping = 0;
+    pthread_cond_broadcast(&p->changed);
+    PipeRelease_(p);        /* unlocks */
+
+    return NULL;
+} /* PipePump_ */
+
+static sf_count_t PipeGetLen_(void *user_data)
+{
+    AuPipe *p = (AuPipe *)user_data;
+    sf_count_t len;
+
+    /* Unknown until the end */
+    pthread_mutex_lock(&p->mutex);
+    len = p->done ? p->end : SF_COUNT_MAX;
+    pthread_mutex_unlock(&p->mutex);
+    return len;
+} /* PipeGetLen_ */
+
+static sf_count_t PipeSeek_(sf_count_t offset, int whence, void *user_data)
+{
+    AuPipe *p = (AuPipe *)user_data;
+    sf_count_t pos = -1;
+
+    pthread_mutex_lock(&p->mutex);
+    switch(whence) {
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = p->pos + offset; break;
+        case SEEK_END: if(p->done) pos = p->end + offset; break;
+        default: break;
+    }
+    if(pos >= p->base) {    /* can't go back past what we've kept */
+        p->pos = pos;
+        pthread_cond_broadcast(&p->changed);
+    } else {
+        pos = -1;
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return pos;
+} /* PipeSeek_ */
+
+/** Read #count bytes, waiting for them if need be.  libsndfile takes a
+ * short read as the end of the file, so only return one at the end. */
+static sf_count_t PipeRead_(void *ptr, sf_count_t count, void *user_data)
+{
+    AuPipe *p = (AuPipe *)user_data;
+    unsigned char *out = (unsigned char *)ptr;
+    sf_count_t done = 0, n, off;
+
+    pthread_mutex_lock(&p->mutex);
+    while(done < count) {
+        if(p->pos >= p->end) {
+            if(p->done || p->stop) break;
+            pthread_cond_wait(&p->changed, &p->mutex);
+            continue;
+        }
+        off = p->pos % AU_PIPE_BYTES;
+        n = p->end - p->pos;
+        if(n > AU_PIPE_BYTES - off) n = AU_PIPE_BYTES - off;
+        if(n > count - done) n = count - done;
+        memcpy(out + done, p->buf + off, n);
+        done += n;
+        p->pos += n;
+        pthread_cond_broadcast(&p->changed);    /* there may be room */
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return done;
+} /* PipeRead_ */
+
+static sf_count_t PipeWrite_(const void *ptr, sf_count_t count,
+        void *user_data)
+{
+    (void)ptr;
+    (void)count;
+    (void)user_data;
+    return 0;   /* read-only */
+} /* PipeWrite_ */
+
+static sf_count_t PipeTell_(void *user_data)
+{
+    AuPipe *p = (AuPipe *)user_data;
+    sf_count_t pos;
+    pthread_mutex_lock(&p->mutex);
+    pos = p->pos;
+    pthread_mutex_unlock(&p->mutex);
+    return pos;
+} /* PipeTell_ */
+
+static SF_VIRTUAL_IO PipeVirtualIO_ = {
+    PipeGetLen_, PipeSeek_, PipeRead_, PipeWrite_, PipeTell_
+};
+
+/** Start #p, which has its source filled in.  Frees #p on failure. */
+static AuPipe *PipeStart_(AuPipe *p, AuPipe_NotifyFn notify,
+        void *notify_arg)
+{
+    p->notify = notify;
+    p->notify_arg = notify_arg;
+    p->refs = 1;
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->changed, NULL);
+
+    if(!(p->buf = (unsigned char *)malloc(AU_PIPE_BYTES))) {
+        p->close_fd = 0;
+        AuPipe_Close(p);
+        return NULL;
+    }
+
+    p->refs = 2;
+    p->pumping = 1;
+    if(pthread_create(&p->thread, NULL, PipePump_, p) != 0) {
+        p->refs = 1;
+        p->pumping = 0;
+        p->close_fd = 0;
+        AuPipe_Close(p);
+        return NULL;
+    }
+    pthread_detach(p->thread);
+
+    return p;
+} /* PipeStart_ */
+
+/* libsndfile virtual I/O ================================================= */
+
+static sf_count_t FileGetLen_(void *user_data)
+{
+    return ((AuFile *)user_data)->size;
+} /* FileGetLen_ */
+
+static sf_count_t FileSeek_(sf_count_t offset, int whence, void *user_data)
+{
+    AuFile *f = (AuFile *)user_data;
+    sf_count_t pos;
+
+    switch(whence) {
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = f->pos + offset; break;
+        case SEEK_END: pos = f->size + offset; break;
+        default: return -1;
+    }
+    if(pos < 0) return -1;
+
+    if(pos / f->chunk_bytes != f->pos / f->chunk_bytes) {
+        f->advised_to = -1;     /* read-ahead starts over from here */
+    }
+    f->pos = pos;
+    return pos;
+} /* FileSeek_ */
+
+static sf_count_t FileRead_(void *ptr, sf_count_t count, void *user_data)
+{
+    AuFile *f = (AuFile *)user_data;
+    unsigned char *out = (unsigned char *)ptr;
+    sf_count_t done = 0, index, off, n;
+    AuFileChunk *c;
+
+    while(done < count && f->pos < f->size) {
+        index = f->pos / f->chunk_bytes;
+        if(!(c = FileChunk_(f, index))) break;
+
+        off = f->pos - index * f->chunk_bytes;
+        n = c->len - off;
+        if(n <= 0) break;   /* the file got shorter */
+        if(n > count - done) n = count - done;
+
+        memcpy(out + done, c->data + off, n);
+        done += n;
+        f->pos += n;
+
+        FileReadAhead_(f, index);
+    }
+
+    return done;
+} /* FileRead_ */
+
+static sf_count_t FileWrite_(const void *ptr, sf_count_t count,
+        void *user_data)
+{
+    (void)ptr;
+    (void)count;
+    (void)user_data;
+    return 0;   /* read-only */
+} /* FileWrite_ */
+
+static sf_count_t FileTell_(void *user_data)
+{
+    return ((AuFile *)user_data)->pos;
+} /* FileTell_ */
+
+static SF_VIRTUAL_IO FileVirtualIO_ = {
+    FileGetLen_, FileSeek_, FileRead_, FileWrite_, FileTell_
+};
+
+/* Public functions ======================================================= */
+
+SNDFILE *AuFile_SfOpen(const char *filename, SF_INFO *info,
+        const AuFileParams *params, AuFile **file)
+{
+    AuFile *f;
+    SNDFILE *sf;
+    struct stat st;
+    int i, chunks = AU_FILE_CHUNKS;
+
+    *file = NULL;
+    if(!(f = (AuFile *)calloc(1, sizeof(AuFile)))) return NULL;
+    f->fd = open(filename, O_RDONLY);
+    if( (f->fd == -1) || (fstat(f->fd, &st) != 0) ) {
+        AuFile_Close(f);
+        return NULL;
+    }
+
+    /* Pipes and the like can't be read by offset, so let libsndfile
+     * handle them as usual. */
+    if(!S_ISREG(st.st_mode)) {
+        AuFile_Close(f);
+        return sf_open(filename, SFM_READ, info);
+    }
+
+    f->chunk_bytes = AU_FILE_CHUNK_BYTES;
+    if(params && params->chunks > 0) chunks = params->chunks;
+    if(chunks < AU_FILE_MIN_CHUNKS) chunks = AU_FILE_MIN_CHUNKS;
+    if(params && params->chunk_bytes > 0) f->chunk_bytes = params->chunk_bytes;
+    f->read_ahead = chunks - 2;
+    f->nchunks = AU_FILE_SYNC_CHUNKS;
+
+#ifdef AU_USE_IO_URING
+    /* If the kernel doesn't support io_uring, or it's blocked, use
+     * pread() instead.  Only then is it worth caching the read-ahead
+     * ourselves. */
+    if(io_uring_queue_init(chunks, &f->ring, 0) == 0) {
+        f->uring = f->async = 1;
+        f->nchunks = chunks;
+    }
+#endif
+
+    if( !(f->chunks = (AuFileChunk *)calloc(f->nchunks,
+                                            sizeof(AuFileChunk))) ||
+        !(f->data = (unsigned char *)malloc(
+                    (size_t)f->nchunks * f->chunk_bytes)) ) {
+        AuFile_Close(f);
+        return NULL;
+    }
+    for(i = 0; i < f->nchunks; ++i) {
+        f->chunks[i].state = AFCS_EMPTY;
+        f->chunks[i].data = f->data + (size_t)i * f->chunk_bytes;
+    }
+    f->size = st.st_size;
+    f->advised_to = -1;
+    posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if(!(sf = sf_open_virtual(&FileVirtualIO_, SFM_READ, info, f))) {
+        AuFile_Close(f);
+        return NULL;
+    }
+
+    *file = f;
+    return sf;
+} /* AuFile_SfOpen */
+
+void AuFile_Close(AuFile *file)
+{
+    if(!file) return;
+
+#ifdef AU_USE_IO_URING
+    if(file->uring) {
+        /* The kernel may still be writing into the chunks */
+        while(FileReap_(file, 1)) { }
+        io_uring_queue_exit(&file->ring);
+    }
+#endif
+
+    if(file->fd != -1) close(file->fd);
+    free(file->data);
+    free(file->chunks);
+    free(file);
+} /* AuFile_Close */
+
+AuPipe *AuPipe_OpenFd(int fd, int close_fd, AuPipe_NotifyFn notify,
+        void *notify_arg)
+{
+    AuPipe *p;
+
+    if(fd < 0) return NULL;
+    if(!(p = (AuPipe *)calloc(1, sizeof(AuPipe)))) return NULL;
+    p->read = PipeFdRead_;
+    p->user_data = p;
+    p->fd = fd;
+    p->close_fd = close_fd;
+    return PipeStart_(p, notify, notify_arg);
+} /* AuPipe_OpenFd */
+
+AuPipe *AuPipe_OpenCallback(AuPipe_ReadFn read, void *user_data,
+        AuPipe_NotifyFn notify, void *notify_arg)
+{
+    AuPipe *p;
+
+    if(!read) return NULL;
+    if(!(p = (AuPipe *)calloc(1, sizeof(AuPipe)))) return NULL;
+    p->read = read;
+    p->user_data = user_data;
+    p->fd = -1;
+    return PipeStart_(p, notify, notify_arg);
+} /* AuPipe_OpenCallback */
+
+SNDFILE *AuPipe_SfOpen(AuPipe *pipe, SF_INFO *info)
+{
+    return sf_open_virtual(&PipeVirtualIO_, SFM_READ, info, pipe);
+} /* AuPipe_SfOpen */
+
+long AuPipe_Available(AuPipe *pipe, long want)
+{
+    sf_count_t avail;
+
+    if(want > AU_PIPE_AHEAD_BYTES) want = AU_PIPE_AHEAD_BYTES;
+
+    pthread_mutex_lock(&pipe->mutex);
+    if(pipe->done || pipe->stop) {
+        avail = -1;
+    } else {
+        avail = pipe->end - pipe->pos;
+        if(avail < 0) avail = 0;    /* after a seek forward */
+        pipe->want = (avail < want) ? want : 0;
+    }
+    pthread_mutex_unlock(&pipe->mutex);
+    return (long)avail;
+} /* AuPipe_Available */
+
+void AuPipe_Stop(AuPipe *pipe)
+{
+    pthread_mutex_lock(&pipe->mutex);
+    __atomic_store_n(&pipe->stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&pipe->changed);
+
+    /* PipeFdRead_() notices within AU_PIPE_POLL_MS, so wait for it to
+     * be done with the file descriptor.  A callback may block for as
+     * long as it likes, so leave it be. */
+    while(pipe->notifying || (pipe->pumping && pipe->fd >= 0)) {
+        pthread_cond_wait(&pipe->changed, &pipe->mutex);
+    }
+    pthread_mutex_unlock(&pipe->mutex);
+} /* AuPipe_Stop */
+
+void AuPipe_Close(AuPipe *pipe)
+{
+    if(!pipe) return;
+    AuPipe_Stop(pipe);
+    pthread_mutex_lock(&pipe->mutex);
+    PipeRelease_(pipe);     /* unlocks */
+} /* AuPipe_Close */
+
+const char *AuFile_Implementation(const AuFile *file)
+{
+#ifdef AU_USE_IO_URING
+    if(file && file->async) return "io_uring";
+#else
+    (void)file;
+#endif
+    return "pread";
+} /* AuFile_Implementation */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
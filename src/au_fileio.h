@@ -0,0 +1,132 @@
+/* au_fileio.h: Read-ahead file input for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AU_FILEIO_H_
+#define _AU_FILEIO_H_
+
+#include <stddef.h>
+#include <sndfile.h>
+
+/* Files opened here are read by libsndfile through SF_VIRTUAL_IO, out
+ * of a small per-file cache of large chunks.  Reads ahead of the
+ * current position are started before libsndfile asks for them, so
+ * decoding rarely has to wait for the disk.
+ *
+ * Built with AU_USE_IO_URING (Linux, liburing), the read-ahead is
+ * asynchronous io_uring reads straight into the cache.  Otherwise, or
+ * if the kernel refuses io_uring, chunks are read with pread(), and
+ * the read-ahead is a posix_fadvise() hint so the kernel fetches them
+ * into the page cache in the background.  The cache then only holds
+ * two chunks, since the page cache holds the rest.
+ *
+ * An AuFile is not thread-safe: use it from one thread at a time. */
+
+/** A file open for reading.  Opaque. */
+typedef struct AuFile AuFile;
+
+/** How an AuFile reads.  0 in a field means the default. */
+typedef struct AuFileParams {
+    /** How far to read ahead, in chunks, plus two.  With io_uring,
+     * this many chunks are cached.  At least 3.  Default 8. */
+    int chunks;
+
+    /** The size of each read, in bytes.  Default 64 KiB. */
+    long chunk_bytes;
+} AuFileParams;
+
+/** Open #filename with libsndfile for reading, through an AuFile.
+ * @param info As for sf_open()
+ * @param params How to read it, or NULL for the defaults
+ * @param file Set to the AuFile on success.  Pass it to AuFile_Close()
+ *          after you sf_close() the return value.
+ * @return The SNDFILE, or NULL on failure. */
+SNDFILE *AuFile_SfOpen(const char *filename, SF_INFO *info,
+        const AuFileParams *params, AuFile **file);
+
+/** Free #file, waiting for any reads still in flight.  NULL is OK. */
+void AuFile_Close(AuFile *file);
+
+/** Get the name of the I/O method #file uses: "io_uring" or "pread". */
+const char *AuFile_Implementation(const AuFile *file);
+
+/* Pipes, sockets and other streams that can't seek.  A thread of the
+ * pipe's own reads from the source, which may block as long as it
+ * likes, into a large buffer.  libsndfile reads from the buffer.
+ * Only short seeks backwards, e.g., while libsndfile reads the
+ * header, are possible. */
+
+/** A stream being read.  Opaque. */
+typedef struct AuPipe AuPipe;
+
+/** The most an AuPipe buffers ahead of the read position */
+#define AU_PIPE_AHEAD_BYTES (960*1024)
+
+/** Reads from a stream.  Called on the pipe's thread, which
+ * AuPipe_Stop() doesn't wait for, so it may block as long as it likes.
+ * @return How many bytes it put in #buf (at most #len), 0 at the end,
+ *          or <0 on error. */
+typedef long (*AuPipe_ReadFn)(void *user_data, void *buf, size_t len);
+
+/** Called on the pipe's thread when as much data has arrived as the
+ * last AuPipe_Available() wanted, or at the end of the stream. */
+typedef void (*AuPipe_NotifyFn)(void *arg);
+
+/** Start reading file descriptor #fd, e.g., a pipe or socket, into an
+ * AuPipe.  Doesn't wait for any data: open it with AuPipe_SfOpen()
+ * once AuPipe_Available() says the header has arrived.
+ * @param close_fd If TRUE, AuPipe_Close() closes #fd.  Not on failure.
+ * @param notify If non-NULL, called with #notify_arg as data arrives.
+ * @return The AuPipe, or NULL on failure.  Pass it to AuPipe_Close()
+ *          after you sf_close() what AuPipe_SfOpen() returned. */
+AuPipe *AuPipe_OpenFd(int fd, int close_fd, AuPipe_NotifyFn notify,
+        void *notify_arg);
+
+/** As AuPipe_OpenFd(), but reading by calling #read. */
+AuPipe *AuPipe_OpenCallback(AuPipe_ReadFn read, void *user_data,
+        AuPipe_NotifyFn notify, void *notify_arg);
+
+/** Open #pipe with libsndfile.  This reads the header, so if less than
+ * that has arrived, it waits for more, until AuPipe_Stop().  Call it
+ * once, when AuPipe_Available() says the header is most likely there.
+ * Reads through the SNDFILE likewise wait for data that hasn't
+ * arrived, so only ask for what AuPipe_Available() says is there.
+ * @param info As for sf_open()
+ * @return The SNDFILE, or NULL on failure. */
+SNDFILE *AuPipe_SfOpen(AuPipe *pipe, SF_INFO *info);
+
+/** How many bytes can be read from #pipe without waiting for the
+ * source.  If fewer than #want, the notify function is called once
+ * #want bytes have arrived (at most AU_PIPE_AHEAD_BYTES), or the source
+ * ends.
+ * @return The byte count, or -1 if reads never wait because the source
+ *          has ended or AuPipe_Stop() has been called. */
+long AuPipe_Available(AuPipe *pipe, long want);
+
+/** Stop reading from the source.  Once this returns, #pipe's thread
+ * won't call the notify function again, nor start another read from
+ * the source.  From AuPipe_OpenFd(), it is done with the file
+ * descriptor, which takes up to 100 ms.  From AuPipe_OpenCallback(),
+ * a read already under way isn't waited for: it finishes on #pipe's
+ * thread, and what it read is thrown away.  Reads still get what's
+ * buffered.  Called by AuPipe_Close(). */
+void AuPipe_Stop(AuPipe *pipe);
+
+/** Stop #pipe and free it.  NULL is OK.  If a read of a callback source
+ * is still under way, #pipe's thread frees it once the read returns. */
+void AuPipe_Close(AuPipe *pipe);
+
+#endif /* _AU_FILEIO_H_ */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -0,0 +1,260 @@
+/* au_infocache.c: On-disk cache of file metadata for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Headers ================================================================ */
+
+#include "au_infocache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Private definitions ==================================================== */
+
+/** The first line of a cache file.  Change the number whenever the
+ * format, or the meaning of AuInfoData.format, changes. */
+#define AU_INFOCACHE_MAGIC "audio-utsl info cache 1\n"
+
+/** How many slots a new cache has.  A power of two. */
+#define AU_INFOCACHE_MIN_SLOTS (64)
+
+typedef struct AuInfoEntry {
+    char *path;         /**< NULL if the slot is empty */
+    unsigned long hash;
+    AuInfoKey key;
+    AuInfoData data;
+} AuInfoEntry;
+
+/* A hash table with linear probing.  Entries are never removed. */
+struct AuInfoCache {
+    AuInfoEntry *slots;
+    unsigned long nslots;   /**< a power of two */
+    unsigned long count;
+
+    /** Set by AuInfoCache_Store(), cleared by AuInfoCache_Save() */
+    int dirty;
+};
+
+/** FNV-1a */
+static unsigned long Hash_(const char *s)
+{
+    unsigned long h = 2166136261UL;
+    while(*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619UL;
+    }
+    return h;
+} /* Hash_ */
+
+/** Find the slot for #path: where it is, or the empty one where it
+ * would go. */
+static AuInfoEntry *Find_(const AuInfoCache *c, const char *path,
+        unsigned long hash)
+{
+    unsigned long i = hash & (c->nslots - 1);
+    AuInfoEntry *e;
+
+    while(1) {
+        e = &c->slots[i];
+        if(!e->path) return e;
+        if(e->hash == hash && !strcmp(e->path, path)) return e;
+        i = (i + 1) & (c->nslots - 1);
+    }
+} /* Find_ */
+
+/** Double the number of slots in #c.
+ * @return FALSE if out of memory. */
+static int Grow_(AuInfoCache *c)
+{
+    AuInfoEntry *old = c->slots, *e;
+    unsigned long nold = c->nslots, i;
+
+    if(!(c->slots = (AuInfoEntry *)calloc(nold * 2, sizeof(AuInfoEntry)))) {
+        c->slots = old;
+        return 0;
+    }
+    c->nslots = nold * 2;
+    for(i = 0; i < nold; ++i) {
+        if(!old[i].path) continue;
+        e = Find_(c, old[i].path, old[i].hash);
+        *e = old[i];
+    }
+    free(old);
+    return 1;
+} /* Grow_ */
+
+/** Parse one line of a cache file into #key and #data.
+ * @return The path, which points into #line, or NULL if the line is
+ *          bad. */
+static char *ParseLine_(char *line, AuInfoKey *key, AuInfoData *data)
+{
+    int used = -1;
+    size_t len;
+
+    if(sscanf(line, "%lld %lld %ld %d %d %d %d %ld %n",
+            &key->size, &key->mtime_s, &key->mtime_ns, &data->ok,
+            &data->samplerate, &data->channels, &data->format, &data->len,
+            &used) < 8 || used < 0) {
+        return NULL;
+    }
+    line += used;
+    len = strlen(line);
+    if(len && line[len - 1] == '\n') line[--len] = '\0';
+    return len ? line : NULL;
+} /* ParseLine_ */
+
+/* Public functions ======================================================= */
+
+int AuInfoCache_Key(const char *filename, AuInfoKey *key)
+{
+    struct stat st;
+
+    if(stat(filename, &st) != 0) return 0;
+    key->size = (long long)st.st_size;
+    key->mtime_s = (long long)st.st_mtime;
+#if defined(__APPLE__)
+    key->mtime_ns = (long)st.st_mtimespec.tv_nsec;
+#elif defined(__linux__) || defined(__CYGWIN__)
+    key->mtime_ns = (long)st.st_mtim.tv_nsec;
+#else
+    key->mtime_ns = 0;
+#endif
+    return 1;
+} /* AuInfoCache_Key */
+
+AuInfoCache *AuInfoCache_Load(const char *filename)
+{
+    AuInfoCache *c;
+    FILE *fp;
+    char *line = NULL, *path;
+    size_t cap = 0;
+    AuInfoKey key;
+    AuInfoData data;
+
+    if(!(c = (AuInfoCache *)calloc(1, sizeof(AuInfoCache)))) return NULL;
+    c->nslots = AU_INFOCACHE_MIN_SLOTS;
+    if(!(c->slots = (AuInfoEntry *)calloc(c->nslots, sizeof(AuInfoEntry)))) {
+        free(c);
+        return NULL;
+    }
+
+    if(!filename || !(fp = fopen(filename, "r"))) return c;
+
+    if( (getline(&line, &cap, fp) > 0) && !strcmp(line, AU_INFOCACHE_MAGIC) ) {
+        while(getline(&line, &cap, fp) > 0) {
+            if(!(path = ParseLine_(line, &key, &data))) continue;
+            if(!AuInfoCache_Store(c, path, &key, &data)) break;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    c->dirty = 0;       /* it matches the file */
+    return c;
+} /* AuInfoCache_Load */
+
+int AuInfoCache_Lookup(const AuInfoCache *cache, const char *path,
+        const AuInfoKey *key, AuInfoData *data)
+{
+    const AuInfoEntry *e = Find_(cache, path, Hash_(path));
+
+    if(!e->path) return 0;
+    if( (e->key.size != key->size) || (e->key.mtime_s != key->mtime_s) ||
+        (e->key.mtime_ns != key->mtime_ns) ) {
+        return 0;       /* it has changed */
+    }
+    *data = e->data;
+    return 1;
+} /* AuInfoCache_Lookup */
+
+int AuInfoCache_Store(AuInfoCache *cache, const char *path,
+        const AuInfoKey *key, const AuInfoData *data)
+{
+    unsigned long hash;
+    AuInfoEntry *e;
+
+    if(strchr(path, '\n')) return 1;    /* can't be saved - skip it */
+
+    /* Keep the table at most 3/4 full */
+    if( (cache->count + 1) * 4 > cache->nslots * 3 ) {
+        if(!Grow_(cache)) return 0;
+    }
+
+    hash = Hash_(path);
+    e = Find_(cache, path, hash);
+    if(!e->path) {
+        if(!(e->path = strdup(path))) return 0;
+        e->hash = hash;
+        ++cache->count;
+    }
+    e->key = *key;
+    e->data = *data;
+    cache->dirty = 1;
+    return 1;
+} /* AuInfoCache_Store */
+
+int AuInfoCache_Save(AuInfoCache *cache, const char *filename)
+{
+    FILE *fp;
+    char *tmpname;
+    size_t len;
+    unsigned long i;
+    const AuInfoEntry *e;
+    int ok;
+
+    if(!cache->dirty) return 1;
+
+    /* Write a new file beside the old one, then replace it, so readers
+     * never see half a cache */
+    len = strlen(filename);
+    if(!(tmpname = (char *)malloc(len + 5))) return 0;
+    memcpy(tmpname, filename, len);
+    memcpy(tmpname + len, ".tmp", 5);
+
+    if(!(fp = fopen(tmpname, "w"))) {
+        free(tmpname);
+        return 0;
+    }
+
+    ok = (fputs(AU_INFOCACHE_MAGIC, fp) >= 0);
+    for(i = 0; ok && i < cache->nslots; ++i) {
+        e = &cache->slots[i];
+        if(!e->path) continue;
+        ok = fprintf(fp, "%lld %lld %ld %d %d %d %d %ld %s\n",
+                e->key.size, e->key.mtime_s, e->key.mtime_ns, e->data.ok,
+                e->data.samplerate, e->data.channels, e->data.format,
+                e->data.len, e->path) > 0;
+    }
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && (rename(tmpname, filename) == 0);
+    if(!ok) remove(tmpname);
+    free(tmpname);
+
+    if(ok) cache->dirty = 0;
+    return ok;
+} /* AuInfoCache_Save */
+
+void AuInfoCache_Delete(AuInfoCache *cache)
+{
+    unsigned long i;
+
+    if(!cache) return;
+    for(i = 0; i < cache->nslots; ++i) free(cache->slots[i].path);
+    free(cache->slots);
+    free(cache);
+} /* AuInfoCache_Delete */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -0,0 +1,79 @@
+/* au_infocache.h: On-disk cache of file metadata for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AU_INFOCACHE_H_
+#define _AU_INFOCACHE_H_
+
+/* What Au_InspectFiles() learned about each file, keyed by path, size
+ * and modification time, so a file is only opened again once it
+ * changes.  The cache file is text, one file per line, and is
+ * replaced atomically (write, then rename) when saved.  A cache file
+ * that is missing, unreadable, or from another version is treated as
+ * empty.
+ *
+ * Lookups don't change the cache, so any number of threads may look
+ * up at once, as long as none is storing. */
+
+/** A cache.  Opaque. */
+typedef struct AuInfoCache AuInfoCache;
+
+/** Identifies a version of a file */
+typedef struct AuInfoKey {
+    long long size;
+    long long mtime_s;
+    long mtime_ns;      /**< 0 where the platform doesn't say */
+} AuInfoKey;
+
+/** What is known about a file.  The fields other than #ok are only
+ * meaningful if #ok. */
+typedef struct AuInfoData {
+    int ok;             /**< whether libsndfile could open the file */
+    int samplerate;
+    int channels;
+    int format;         /**< an Au_SampleFormat */
+    long len;           /**< frames, or -1 if unknown */
+} AuInfoData;
+
+/** Get the key for the current version of #filename.
+ * @return TRUE on success; FALSE if #filename can't be stat()ed. */
+int AuInfoCache_Key(const char *filename, AuInfoKey *key);
+
+/** Create a cache, loading what's in #filename, if anything.
+ * @param filename The cache file, or NULL for an empty cache
+ * @return The cache, or NULL if out of memory. */
+AuInfoCache *AuInfoCache_Load(const char *filename);
+
+/** Look up #path.
+ * @return TRUE, with #data filled in, if #path is cached with #key. */
+int AuInfoCache_Lookup(const AuInfoCache *cache, const char *path,
+        const AuInfoKey *key, AuInfoData *data);
+
+/** Remember #data for #path as of #key, replacing anything there was.
+ * Paths containing newlines aren't cached.
+ * @return FALSE if out of memory. */
+int AuInfoCache_Store(AuInfoCache *cache, const char *path,
+        const AuInfoKey *key, const AuInfoData *data);
+
+/** Write #cache to #filename, if anything has been stored since it was
+ * loaded.
+ * @return TRUE on success; FALSE on failure. */
+int AuInfoCache_Save(AuInfoCache *cache, const char *filename);
+
+/** Free #cache.  NULL is OK. */
+void AuInfoCache_Delete(AuInfoCache *cache);
+
+#endif /* _AU_INFOCACHE_H_ */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
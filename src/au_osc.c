@@ -0,0 +1,470 @@
+/* au_osc.c: Oscillator bank for audio-utsl test tones.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Headers ================================================================ */
+
+#include "au_osc.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* As in au_convert.c: per-function target attributes, and only called
+ * if the CPU has the instructions. */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define AU_OSC_X86
+#include <immintrin.h>
+#endif
+
+/* Private definitions ==================================================== */
+
+/** How many frames of one oscillator are rendered at a time */
+#define AU_OSC_CHUNK (256)
+
+/** A phase, as a signed 32-bit int, to [-1, 1) */
+#define PHASE_SCALE (1.0f / 2147483648.0f)
+
+/** One cycle, in phase-accumulator units */
+#define PHASE_CYCLE (4294967296.0)
+
+/** Taylor coefficients for sin(t), t in [-pi/2, pi/2].  The error is
+ * below 6e-8, i.e., under float rounding. */
+#define S3 (-1.6666667e-1f)
+#define S5 (8.3333333e-3f)
+#define S7 (-1.9841270e-4f)
+#define S9 (2.7557319e-6f)
+#define S11 (-2.5052108e-8f)
+#define PI_F (3.14159265f)
+
+typedef struct AuOsc {
+    Au_Waveform wave;
+    int channel;            /**< -1 for all */
+    float gain;
+
+    uint32_t phase;
+    uint32_t inc;           /**< phase per frame */
+
+    /* Sweeps.  #inc_f is #inc before rounding. */
+    long steps_left;        /**< 0 if not sweeping */
+    long step_frames_left;  /**< until the next step */
+    double inc_f, inc_end;
+    double step;            /**< added to inc_f each step, or */
+    double ratio;           /**< multiplied into it, if log */
+    BOOL log;
+
+    /** xorshift32 state, one per SIMD lane.  Never 0. */
+    uint32_t noise[4];
+} AuOsc;
+
+struct AuOscBank {
+    AuOsc *oscs;
+    int count;
+    int channels;
+
+    /** One oscillator's chunk */
+    float scratch[AU_OSC_CHUNK];
+};
+
+/** A set of kernels.  #render writes #n frames of #osc, times its
+ * gain, to #dest, and advances its phase (and noise). */
+typedef struct AuOscKernels {
+    const char *name;
+    void (*render)(AuOsc *osc, float *dest, size_t n);
+} AuOscKernels;
+
+/** Convert a frequency to a phase increment */
+static double incFor_(double freq_hz, int sample_rate)
+{
+    if(!(freq_hz > 0.0)) return 0.0;    /* also NaN */
+    if(freq_hz > sample_rate / 2.0) freq_hz = sample_rate / 2.0;
+    return freq_hz / sample_rate * PHASE_CYCLE;
+} /* incFor_ */
+
+/** Move #osc to the next frequency of its sweep */
+static void SweepStep_(AuOsc *osc)
+{
+    if(--osc->steps_left == 0) {
+        osc->inc_f = osc->inc_end;      /* no accumulated error */
+    } else if(osc->log) {
+        osc->inc_f *= osc->ratio;
+    } else {
+        osc->inc_f += osc->step;
+    }
+    osc->inc = (uint32_t)(osc->inc_f + 0.5);
+    osc->step_frames_left = AU_OSC_SWEEP_FRAMES;
+} /* SweepStep_ */
+
+/** Add #n frames of #osc from bank->scratch to #dest */
+static void Mix_(const AuOscBank *bank, const AuOsc *osc, float *dest,
+        size_t n)
+{
+    const float *src = bank->scratch;
+    int channels = bank->channels, c;
+    size_t i;
+
+    if(channels == 1) {
+        for(i = 0; i < n; ++i) dest[i] += src[i];
+    } else if(osc->channel >= 0) {
+        dest += osc->channel;
+        for(i = 0; i < n; ++i) dest[i * channels] += src[i];
+    } else {
+        for(i = 0; i < n; ++i) {
+            for(c = 0; c < channels; ++c) *dest++ += src[i];
+        }
+    }
+} /* Mix_ */
+
+/* Scalar kernels ========================================================= */
+
+/** sin(pi * x), x in [-1, 1) */
+static float SinPi_(float x)
+{
+    float t, t2;
+
+    /* Fold into [-1/2, 1/2], where sin is monotonic */
+    x = (x > 0.5f) ? 1.0f - x : x;
+    x = (x < -0.5f) ? -1.0f - x : x;
+
+    t = x * PI_F;
+    t2 = t * t;
+    return t * (1.0f + t2 * (S3 + t2 * (S5 + t2 * (S7 + t2 *
+                (S9 + t2 * S11)))));
+} /* SinPi_ */
+
+/** One step of xorshift32, as a float in [-1, 1). */
+static float uniform_(uint32_t *state)
+{
+    union { uint32_t u; float f; } bits;
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    bits.u = (x >> 9) | 0x40000000u;    /* [2, 4) */
+    return bits.f - 3.0f;
+} /* uniform_ */
+
+static void RenderScalar_(AuOsc *osc, float *dest, size_t n)
+{
+    uint32_t phase = osc->phase, inc = osc->inc;
+    float gain = osc->gain, x;
+    size_t i;
+
+    switch(osc->wave) {
+        case AUWF_SINE:
+            for(i = 0; i < n; ++i, phase += inc) {
+                dest[i] = gain * SinPi_((int32_t)phase * PHASE_SCALE);
+            }
+            break;
+
+        case AUWF_SQUARE:
+            for(i = 0; i < n; ++i, phase += inc) {
+                dest[i] = (phase < 0x80000000u) ? gain : -gain;
+            }
+            break;
+
+        case AUWF_SAW:
+            for(i = 0; i < n; ++i, phase += inc) {
+                dest[i] = gain * ((int32_t)phase * PHASE_SCALE);
+            }
+            break;
+
+        case AUWF_TRIANGLE:     /* in phase with the sine */
+            for(i = 0; i < n; ++i, phase += inc) {
+                x = (int32_t)phase * PHASE_SCALE;
+                x = (x > 0.5f) ? 1.0f - x : x;
+                x = (x < -0.5f) ? -1.0f - x : x;
+                dest[i] = gain * 2.0f * x;
+            }
+            break;
+
+        case AUWF_NOISE:
+            for(i = 0; i < n; ++i) {
+                dest[i] = gain * uniform_(&osc->noise[0]);
+            }
+            break;
+    }
+
+    osc->phase = phase;
+} /* RenderScalar_ */
+
+static const AuOscKernels ScalarKernels_ = { "scalar", RenderScalar_ };
+
+#ifdef AU_OSC_X86
+
+/* SSE2 kernels =========================================================== */
+
+#define SSE2 __attribute__((target("sse2")))
+
+/** Four phases to [-1, 1) */
+static SSE2 __m128 PhaseToFloatSSE2_(__m128i phase)
+{
+    return _mm_mul_ps(_mm_cvtepi32_ps(phase), _mm_set1_ps(PHASE_SCALE));
+} /* PhaseToFloatSSE2_ */
+
+/** Fold four values in [-1, 1) into [-1/2, 1/2], as in SinPi_() */
+static SSE2 __m128 FoldSSE2_(__m128 x)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    x = _mm_min_ps(x, _mm_sub_ps(one, x));
+    return _mm_max_ps(x, _mm_sub_ps(_mm_setzero_ps(), _mm_add_ps(one, x)));
+} /* FoldSSE2_ */
+
+/** Four lanes of SinPi_() */
+static SSE2 __m128 SinPiSSE2_(__m128 x)
+{
+    __m128 t, t2, p;
+
+    t = _mm_mul_ps(FoldSSE2_(x), _mm_set1_ps(PI_F));
+    t2 = _mm_mul_ps(t, t);
+    p = _mm_add_ps(_mm_set1_ps(S9), _mm_mul_ps(t2, _mm_set1_ps(S11)));
+    p = _mm_add_ps(_mm_set1_ps(S7), _mm_mul_ps(t2, p));
+    p = _mm_add_ps(_mm_set1_ps(S5), _mm_mul_ps(t2, p));
+    p = _mm_add_ps(_mm_set1_ps(S3), _mm_mul_ps(t2, p));
+    p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(t2, p));
+    return _mm_mul_ps(t, p);
+} /* SinPiSSE2_ */
+
+/** Four lanes of uniform_(), using osc->noise[0..3] */
+static SSE2 __m128 UniformSSE2_(__m128i *state)
+{
+    __m128i x = *state;
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    *state = x;
+    x = _mm_or_si128(_mm_srli_epi32(x, 9), _mm_set1_epi32(0x40000000));
+    return _mm_sub_ps(_mm_castsi128_ps(x), _mm_set1_ps(3.0f));
+} /* UniformSSE2_ */
+
+static SSE2 void RenderSSE2_(AuOsc *osc, float *dest, size_t n)
+{
+    size_t i = 0;
+    uint32_t p = osc->phase, inc = osc->inc;
+    const __m128 gain = _mm_set1_ps(osc->gain);
+    const __m128i step = _mm_set1_epi32((int)(inc * 4));
+    const __m128i sign = _mm_set1_epi32((int)0x80000000u);
+    const __m128i one_bits = _mm_castps_si128(_mm_set1_ps(1.0f));
+    __m128i phase = _mm_setr_epi32((int)p, (int)(p + inc),
+                        (int)(p + inc * 2), (int)(p + inc * 3));
+    __m128i state;
+    __m128 x;
+
+    switch(osc->wave) {
+        case AUWF_SINE:
+            for(; i + 4 <= n; i += 4) {
+                x = SinPiSSE2_(PhaseToFloatSSE2_(phase));
+                _mm_storeu_ps(dest + i, _mm_mul_ps(gain, x));
+                phase = _mm_add_epi32(phase, step);
+            }
+            break;
+
+        case AUWF_SQUARE:   /* +/-1: the phase's sign bit on 1.0f */
+            for(; i + 4 <= n; i += 4) {
+                x = _mm_castsi128_ps(_mm_or_si128(
+                        _mm_and_si128(phase, sign), one_bits));
+                _mm_storeu_ps(dest + i, _mm_mul_ps(gain, x));
+                phase = _mm_add_epi32(phase, step);
+            }
+            break;
+
+        case AUWF_SAW:
+            for(; i + 4 <= n; i += 4) {
+                x = PhaseToFloatSSE2_(phase);
+                _mm_storeu_ps(dest + i, _mm_mul_ps(gain, x));
+                phase = _mm_add_epi32(phase, step);
+            }
+            break;
+
+        case AUWF_TRIANGLE:
+            for(; i + 4 <= n; i += 4) {
+                x = FoldSSE2_(PhaseToFloatSSE2_(phase));
+                x = _mm_add_ps(x, x);
+                _mm_storeu_ps(dest + i, _mm_mul_ps(gain, x));
+                phase = _mm_add_epi32(phase, step);
+            }
+            break;
+
+        case AUWF_NOISE:
+            state = _mm_loadu_si128((const __m128i *)osc->noise);
+            for(; i + 4 <= n; i += 4) {
+                _mm_storeu_ps(dest + i, _mm_mul_ps(gain,
+                                UniformSSE2_(&state)));
+            }
+            _mm_storeu_si128((__m128i *)osc->noise, state);
+            break;
+    }
+
+    osc->phase = p + inc * (uint32_t)i;
+    if(i < n) RenderScalar_(osc, dest + i, n - i);
+} /* RenderSSE2_ */
+
+static const AuOscKernels SSE2Kernels_ = { "sse2", RenderSSE2_ };
+
+#endif /* AU_OSC_X86 */
+
+/* Dispatch =============================================================== */
+
+/** The kernels in use */
+static const AuOscKernels *AuOscImpl_ = NULL;
+
+static pthread_once_t AuOscOnce_ = PTHREAD_ONCE_INIT;
+
+/** Pick the best kernels for this CPU. */
+static void AuOscSelect_(void)
+{
+    if(AuOscImpl_) return;      /* AuOsc_SetImplementation() was called */
+    AuOscImpl_ = &ScalarKernels_;
+#ifdef AU_OSC_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2")) AuOscImpl_ = &SSE2Kernels_;
+#endif
+} /* AuOscSelect_ */
+
+/** Get the kernels in use, choosing them if necessary. */
+static const AuOscKernels *impl_(void)
+{
+    pthread_once(&AuOscOnce_, AuOscSelect_);
+    return AuOscImpl_;
+} /* impl_ */
+
+const char *AuOsc_Implementation(void)
+{
+    return impl_()->name;
+} /* AuOsc_Implementation */
+
+BOOL AuOsc_SetImplementation(const char *name)
+{
+    const AuOscKernels *k = NULL;
+
+    if(!name) return FALSE;
+    if(0 == strcmp(name, ScalarKernels_.name)) k = &ScalarKernels_;
+#ifdef AU_OSC_X86
+    __builtin_cpu_init();
+    if( (0 == strcmp(name, SSE2Kernels_.name)) &&
+        __builtin_cpu_supports("sse2") ) {
+        k = &SSE2Kernels_;
+    }
+#endif
+    if(!k) return FALSE;
+
+    AuOscImpl_ = k;
+    pthread_once(&AuOscOnce_, AuOscSelect_);    /* so it won't override */
+    return TRUE;
+} /* AuOsc_SetImplementation */
+
+/* Public functions ======================================================= */
+
+AuOscBank *AuOsc_New(const Au_Tone *tones, int count, int channels,
+        int sample_rate)
+{
+    AuOscBank *bank;
+    const Au_Tone *t;
+    AuOsc *osc;
+    double frames;
+    int i, j;
+
+    if(count < 0 || channels < 1 || sample_rate < 1) return NULL;
+    for(i = 0; i < count; ++i) {
+        if( ((int)tones[i].wave < 0) ||
+            ((int)tones[i].wave > (int)AUWF_NOISE) ||
+            (tones[i].channel >= channels) ) {
+            return NULL;
+        }
+    }
+
+    if(!(bank = (AuOscBank *)calloc(1, sizeof(AuOscBank)))) return NULL;
+    if( count && !(bank->oscs = (AuOsc *)calloc(count, sizeof(AuOsc))) ) {
+        free(bank);
+        return NULL;
+    }
+    bank->count = count;
+    bank->channels = channels;
+
+    for(i = 0; i < count; ++i) {
+        t = &tones[i];
+        osc = &bank->oscs[i];
+        osc->wave = t->wave;
+        osc->channel = (t->channel < 0) ? -1 : t->channel;
+        osc->gain = t->gain;
+        osc->inc_f = incFor_(t->freq_hz, sample_rate);
+        osc->inc = (uint32_t)(osc->inc_f + 0.5);
+        for(j = 0; j < 4; ++j) {
+            osc->noise[j] = ((uint32_t)(i + 1) * 0x9E3779B9u +
+                                (uint32_t)(j + 1) * 0x7F4A7C15u) | 1;
+        }
+
+        frames = t->sweep_secs * sample_rate;
+        if( !(t->end_freq_hz > 0.0) || !(frames >= 1.0) ||
+            (t->end_freq_hz == t->freq_hz) ) {
+            continue;       /* steady */
+        }
+
+        osc->inc_end = incFor_(t->end_freq_hz, sample_rate);
+        osc->steps_left = (long)ceil(frames / AU_OSC_SWEEP_FRAMES);
+        osc->step_frames_left = AU_OSC_SWEEP_FRAMES;
+        osc->log = t->sweep_log && (osc->inc_f > 0.0);
+        if(osc->log) {
+            osc->ratio = pow(osc->inc_end / osc->inc_f,
+                                1.0 / osc->steps_left);
+        } else {
+            osc->step = (osc->inc_end - osc->inc_f) / osc->steps_left;
+        }
+    }
+
+    return bank;
+} /* AuOsc_New */
+
+void AuOsc_Delete(AuOscBank *bank)
+{
+    if(!bank) return;
+    free(bank->oscs);
+    free(bank);
+} /* AuOsc_Delete */
+
+void AuOsc_Render(AuOscBank *bank, float *dest, size_t frames)
+{
+    const AuOscKernels *k = impl_();
+    AuOsc *osc;
+    size_t done, n;
+    int i;
+
+    memset(dest, 0, frames * bank->channels * sizeof(float));
+
+    for(i = 0; i < bank->count; ++i) {
+        osc = &bank->oscs[i];
+        for(done = 0; done < frames; done += n) {
+            n = frames - done;
+            if(n > AU_OSC_CHUNK) n = AU_OSC_CHUNK;
+            if( (osc->steps_left > 0) &&
+                (n > (size_t)osc->step_frames_left) ) {
+                n = osc->step_frames_left;
+            }
+
+            k->render(osc, bank->scratch, n);
+            Mix_(bank, osc, dest + done * bank->channels, n);
+
+            if( (osc->steps_left > 0) &&
+                ((osc->step_frames_left -= (long)n) == 0) ) {
+                SweepStep_(osc);
+            }
+        }
+    }
+} /* AuOsc_Render */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
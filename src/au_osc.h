@@ -0,0 +1,65 @@
+/* au_osc.h: Oscillator bank for audio-utsl test tones.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AU_OSC_H_
+#define _AU_OSC_H_
+
+#include <stddef.h>
+#include "audio_utsl.h"
+
+/* A bank of oscillators, each an Au_Tone, summed into interleaved
+ * float.  Each oscillator is a 32-bit phase accumulator, so its
+ * frequency is exact to within rate/2^32 and its phase never drifts.
+ * Waveforms are computed from the phase: sine by a polynomial, the
+ * others directly.  Square, saw and triangle are not band-limited.
+ * Sweeps step the frequency every AU_OSC_SWEEP_FRAMES frames, keeping
+ * the phase continuous.
+ *
+ * The kernels are chosen the first time a bank renders, as for
+ * AuConv_*(): SSE2 on x86, or plain C. */
+
+/** A sweeping oscillator's frequency changes this often, in frames */
+#define AU_OSC_SWEEP_FRAMES (16)
+
+/** An oscillator bank.  Opaque. */
+typedef struct AuOscBank AuOscBank;
+
+/** Create a bank of #count oscillators, as described by #tones, for
+ * #channels channels at #sample_rate.  Frequencies are limited to
+ * [0, #sample_rate/2].
+ * @return The bank, or NULL if out of memory or a tone is invalid
+ *          (unknown waveform, or a channel #channels or above). */
+AuOscBank *AuOsc_New(const Au_Tone *tones, int count, int channels,
+        int sample_rate);
+
+/** Free #bank.  NULL is OK. */
+void AuOsc_Delete(AuOscBank *bank);
+
+/** Render the next #frames frames of #bank into #dest, replacing what
+ * was there. */
+void AuOsc_Render(AuOscBank *bank, float *dest, size_t frames);
+
+/** Get the name of the kernels in use: "sse2" or "scalar". */
+const char *AuOsc_Implementation(void);
+
+/** Use the kernels called #name instead of the best available, e.g.,
+ * to compare them.  Not thread-safe: call before rendering anything.
+ * @return TRUE on success; FALSE if #name is unknown or the CPU can't
+ *          run it. */
+BOOL AuOsc_SetImplementation(const char *name);
+
+#endif /* _AU_OSC_H_ */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
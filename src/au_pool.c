@@ -0,0 +1,256 @@
+/* au_pool.c: Worker-thread pool for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Headers ================================================================ */
+
+/* For pthread_setaffinity_np() */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "au_pool.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#define AU_POOL_AFFINITY
+#endif
+
+/* Private definitions ==================================================== */
+
+struct AuPool {
+    /** Protects #ready, #should_exit, and the tasks' busy flags */
+    pthread_mutex_t mutex;
+
+    /** Broadcast whenever a task finishes running, for AuPool_Cancel() */
+    pthread_cond_t finished;
+
+    /** Posted once per signal, and once per worker at exit */
+    sem_t wakeups;
+
+    /** Tasks signaled since a worker last looked.  A lock-free stack:
+     * AuPool_Signal() pushes, and workers take the whole thing at once,
+     * so there is no ABA problem. */
+    AuPoolTask *signaled;
+
+    /** Signaled tasks that workers have seen but not yet run */
+    AuPoolTask *ready;
+
+    int should_exit;
+
+    /** The workers.  #nthreads of them were started. */
+    pthread_t *threads;
+    int nthreads;
+};
+
+/** Move everything from pool->signaled to pool->ready.  Call with the
+ * pool locked. */
+static void PoolDrain_(AuPool *pool)
+{
+    AuPoolTask *task, *next;
+    task = __atomic_exchange_n(&pool->signaled, NULL, __ATOMIC_ACQUIRE);
+    for(; task; task = next) {
+        next = task->next;
+        task->next = pool->ready;
+        pool->ready = task;
+    }
+} /* PoolDrain_ */
+
+/** Take the most urgent task that isn't already running off
+ * pool->ready, and mark it busy.  Call with the pool locked.
+ * @return The task, or NULL if there is none. */
+static AuPoolTask *PoolPick_(AuPool *pool)
+{
+    AuPoolTask **link, **best_link = NULL, *task;
+    long urgency, best = 0;
+
+    for(link = &pool->ready; *link; link = &(*link)->next) {
+        if((*link)->busy) continue;
+        urgency = (*link)->urgency ? (*link)->urgency(*link) : 0;
+        if(!best_link || urgency < best) {
+            best_link = link;
+            best = urgency;
+        }
+    }
+    if(!best_link) return NULL;
+
+    task = *best_link;
+    *best_link = task->next;
+    task->next = NULL;
+    task->busy = 1;
+
+    /* From here on, a signal means "run again afterwards" */
+    __atomic_store_n(&task->pending, 0, __ATOMIC_SEQ_CST);
+    return task;
+} /* PoolPick_ */
+
+static void *PoolWorker_(void *handle)
+{
+    AuPool *pool = (AuPool *)handle;
+    AuPoolTask *task;
+
+    while(1) {
+        if(sem_wait(&pool->wakeups) != 0) continue;     /* EINTR */
+
+        pthread_mutex_lock(&pool->mutex);
+        if(pool->should_exit) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;  /* EXIT POINT */
+        }
+        PoolDrain_(pool);
+        task = PoolPick_(pool);
+        pthread_mutex_unlock(&pool->mutex);
+
+        if(!task) continue;     /* e.g., it was already running */
+        task->run(task);
+
+        pthread_mutex_lock(&pool->mutex);
+        task->busy = 0;
+        /* If it was signaled while it ran, the worker that woke up for
+         * that signal may have skipped it.  Make sure someone runs it. */
+        if(__atomic_load_n(&task->pending, __ATOMIC_SEQ_CST)) {
+            sem_post(&pool->wakeups);
+        }
+        pthread_cond_broadcast(&pool->finished);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    return NULL;
+} /* PoolWorker_ */
+
+/* Public functions ======================================================= */
+
+AuPool *AuPool_New(int threads, const int *cpus, int ncpus)
+{
+    AuPool *pool;
+
+    if(threads < 1) return NULL;
+    if(!(pool = (AuPool *)calloc(1, sizeof(AuPool)))) return NULL;
+
+    if(!(pool->threads = (pthread_t *)calloc(threads, sizeof(pthread_t)))) {
+        free(pool);
+        return NULL;
+    }
+    if(sem_init(&pool->wakeups, 0, 0) == -1) {
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+
+    for(pool->nthreads = 0; pool->nthreads < threads; ++pool->nthreads) {
+        if(pthread_create(&pool->threads[pool->nthreads], NULL,
+                    PoolWorker_, pool) != 0) {
+            AuPool_Delete(pool);
+            return NULL;
+        }
+#ifdef AU_POOL_AFFINITY
+        if(cpus && ncpus > 0) {
+            /* Best effort: a CPU we can't have is not fatal */
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[pool->nthreads % ncpus], &set);
+            pthread_setaffinity_np(pool->threads[pool->nthreads],
+                    sizeof(set), &set);
+        }
+#else
+        (void)cpus;
+        (void)ncpus;
+#endif
+    }
+
+    return pool;
+} /* AuPool_New */
+
+void AuPool_Delete(AuPool *pool)
+{
+    int i;
+    if(!pool) return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->should_exit = 1;
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(i = 0; i < pool->nthreads; ++i) sem_post(&pool->wakeups);
+    for(i = 0; i < pool->nthreads; ++i) pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->finished);
+    pthread_mutex_destroy(&pool->mutex);
+    sem_destroy(&pool->wakeups);
+    free(pool->threads);
+    free(pool);
+} /* AuPool_Delete */
+
+int AuPool_Threads(const AuPool *pool)
+{
+    return pool ? pool->nthreads : 0;
+} /* AuPool_Threads */
+
+void AuPoolTask_Init(AuPoolTask *task, AuPoolRunFn run,
+        AuPoolUrgencyFn urgency, void *arg)
+{
+    task->run = run;
+    task->urgency = urgency;
+    task->arg = arg;
+    task->next = NULL;
+    task->pending = 0;
+    task->busy = 0;
+} /* AuPoolTask_Init */
+
+void AuPool_Signal(AuPool *pool, AuPoolTask *task)
+{
+    AuPoolTask *head;
+
+    /* Already queued and not yet running?  Then it will see this. */
+    if(__atomic_exchange_n(&task->pending, 1, __ATOMIC_SEQ_CST)) return;
+
+    head = __atomic_load_n(&pool->signaled, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while(!__atomic_compare_exchange_n(&pool->signaled, &head, task, 1,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    sem_post(&pool->wakeups);
+} /* AuPool_Signal */
+
+void AuPool_Cancel(AuPool *pool, AuPoolTask *task)
+{
+    AuPoolTask **link;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    /* Ignore signals from now on.  If it's queued, it stays queued
+     * until we take it out below. */
+    __atomic_store_n(&task->pending, 1, __ATOMIC_SEQ_CST);
+
+    PoolDrain_(pool);
+    for(link = &pool->ready; *link; link = &(*link)->next) {
+        if(*link == task) {
+            *link = task->next;
+            task->next = NULL;
+            break;
+        }
+    }
+
+    while(task->busy) pthread_cond_wait(&pool->finished, &pool->mutex);
+
+    pthread_mutex_unlock(&pool->mutex);
+} /* AuPool_Cancel */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -0,0 +1,81 @@
+/* au_pool.h: Worker-thread pool for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AU_POOL_H_
+#define _AU_POOL_H_
+
+/* A fixed set of worker threads that run tasks on request.  A task is
+ * a long-lived object (e.g., one stream's reader) that is signaled
+ * whenever it has work to do.  Signaling is lock-free and never
+ * blocks, so it is safe from a PortAudio callback.
+ *
+ * Signals coalesce: signaling a task that hasn't started running yet
+ * does nothing more.  Signaling a task while it runs makes it run
+ * again afterwards.  A task never runs on two workers at once.  When
+ * several tasks are waiting, an idle worker takes the most urgent. */
+
+/** A pool.  Opaque. */
+typedef struct AuPool AuPool;
+
+typedef struct AuPoolTask AuPoolTask;
+
+/** Do a task's work.  Called on a worker thread. */
+typedef void (*AuPoolRunFn)(AuPoolTask *task);
+
+/** How urgent a task is: lower runs first.  Called with the pool
+ * locked, so it must be quick and must not call into the pool. */
+typedef long (*AuPoolUrgencyFn)(AuPoolTask *task);
+
+/** A task.  Embed one in your own structure and set it up with
+ * AuPoolTask_Init().  The fields are private. */
+struct AuPoolTask {
+    AuPoolRunFn run;
+    AuPoolUrgencyFn urgency;
+    void *arg;
+    AuPoolTask *next;
+    int pending;
+    int busy;
+};
+
+/** Create a pool of #threads workers.
+ * @param cpus If non-NULL, #ncpus CPU numbers.  Worker i runs only on
+ *          cpus[i % ncpus], where the platform supports it.
+ * @return The pool, or NULL on failure. */
+AuPool *AuPool_New(int threads, const int *cpus, int ncpus);
+
+/** Stop the workers and free #pool.  Cancel all tasks first.  NULL is
+ * OK. */
+void AuPool_Delete(AuPool *pool);
+
+/** How many workers #pool has */
+int AuPool_Threads(const AuPool *pool);
+
+/** Set up #task.  #urgency may be NULL, meaning all the same.  #arg is
+ * for the caller's use. */
+void AuPoolTask_Init(AuPoolTask *task, AuPoolRunFn run,
+        AuPoolUrgencyFn urgency, void *arg);
+
+/** Ask for #task to run.  Any thread.  Never blocks. */
+void AuPool_Signal(AuPool *pool, AuPoolTask *task);
+
+/** Take #task out of #pool: forget any pending signal, and wait for
+ * it to finish if it is running.  Nothing else may signal #task during
+ * this call; signals after it are ignored until the next
+ * AuPoolTask_Init().  Not from a worker thread. */
+void AuPool_Cancel(AuPool *pool, AuPoolTask *task);
+
+#endif /* _AU_POOL_H_ */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -0,0 +1,398 @@
+/* au_resample.c: Sample-rate conversion for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Headers ================================================================ */
+
+#include "au_resample.h"
+
+#include <string.h>
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* The AVX2 kernel is compiled with a target attribute and only called
+ * if the CPU has the instructions.  See au_convert.c. */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define AU_RS_X86
+#include <immintrin.h>
+#endif
+
+/* Private definitions ==================================================== */
+
+/** Use one filter per phase when the reduced output/input ratio has a
+ * numerator up to this; otherwise interpolate a table this size. */
+#define AU_RS_MAX_PHASES (512)
+
+/** How many input frames of history to keep room for, beyond the
+ * filter length.  Input is copied in up to this many frames at a
+ * time. */
+#define AU_RS_HIST_FRAMES (1024)
+
+/** The longest filter, in taps, however much we are downsampling */
+#define AU_RS_MAX_TAPS (1024)
+
+/** Filter design for each Au_ResampleQuality */
+static const struct {
+    /** Zero crossings of the sinc on each side of the center */
+    int zero_crossings;
+    /** Kaiser window beta: higher is more stopband, wider transition */
+    double beta;
+    /** Cutoff, as a fraction of the lower Nyquist frequency */
+    double rolloff;
+} AuRsQualities_[] = {
+    /* AURQ_PROFILE */  { 0, 0, 0 },    /* not used */
+    /* AURQ_FAST */     { 4, 5.0, 0.85 },
+    /* AURQ_MEDIUM */   { 16, 8.0, 0.92 },
+    /* AURQ_BEST */     { 32, 10.0, 0.96 },
+};
+
+/** A dot product of two float vectors.  #n is a multiple of 8. */
+typedef float (*AuRsDot)(const float *a, const float *b, int n);
+
+/** The internal details of a resampler. */
+struct AuResampler {
+    int channels;
+
+    /** Filter length.  A multiple of 8. */
+    int taps;
+
+    /** Output/input rate ratio, in lowest terms */
+    long L, M;
+
+    /** Rows in #coeffs, less one.  L unless #interp. */
+    int phases;
+
+    /** Whether to interpolate between rows of #coeffs */
+    BOOL interp;
+
+    /** phases+1 filters of #taps each.  Row r is for an output that
+     * falls r/phases of the way between two input frames. */
+    float *coeffs;
+
+    /** With #interp, the filter for the current output */
+    float *blend;
+
+    /** Input history: one row of #hist_cap floats per channel, so the
+     * dot products run over contiguous memory. */
+    float *hist;
+    long hist_cap;
+
+    /** How many frames of #hist are valid */
+    long hist_len;
+
+    /** Where in #hist the filter for the next output starts */
+    long ipos;
+
+    /** How far the next output is past ipos, in units of 1/L frame */
+    long frac;
+
+    AuRsDot dot;
+    const char *dot_name;
+};
+
+/* Dot products =========================================================== */
+
+static float DotScalar_(const float *a, const float *b, int n)
+{
+    float acc[4] = { 0, 0, 0, 0 };
+    int i;
+    for(i = 0; i < n; i += 4) {     /* four chains, like the SIMD ones */
+        acc[0] += a[i] * b[i];
+        acc[1] += a[i + 1] * b[i + 1];
+        acc[2] += a[i + 2] * b[i + 2];
+        acc[3] += a[i + 3] * b[i + 3];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+} /* DotScalar_ */
+
+#ifdef __SSE__
+static float DotSSE_(const float *a, const float *b, int n)
+{
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    float lanes[4];
+    int i;
+    for(i = 0; i < n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                            _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                            _mm_loadu_ps(b + i + 4)));
+    }
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+} /* DotSSE_ */
+#endif
+
+#ifdef AU_RS_X86
+static __attribute__((target("avx2,fma")))
+float DotAVX2_(const float *a, const float *b, int n)
+{
+    __m256 acc = _mm256_setzero_ps();
+    __m128 sum;
+    int i;
+    for(i = 0; i < n; i += 8) {
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i),
+                                acc);
+    }
+    sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                        _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+} /* DotAVX2_ */
+#endif
+
+/* Filter design ========================================================== */
+
+static long gcd_(long a, long b)
+{
+    long t;
+    while(b) { t = a % b; a = b; b = t; }
+    return a;
+} /* gcd_ */
+
+/** The zeroth-order modified Bessel function of the first kind */
+static double besselI0_(double x)
+{
+    double sum = 1.0, term = 1.0, q = x * x / 4.0;
+    int k;
+    for(k = 1; k < 64 && term > sum * 1e-12; ++k) {
+        term *= q / ((double)k * k);
+        sum += term;
+    }
+    return sum;
+} /* besselI0_ */
+
+/** Fill in rs->coeffs.  Each row is a Kaiser-windowed sinc, shifted
+ * by its phase and normalized to unity gain at DC. */
+static void DesignFilter_(AuResampler *rs, double cutoff, double beta)
+{
+    int r, k;
+    double d, x, v, sum, half = rs->taps / 2.0, i0beta = besselI0_(beta);
+    float *row;
+
+    for(r = 0; r <= rs->phases; ++r) {
+        row = rs->coeffs + (size_t)r * rs->taps;
+        sum = 0.0;
+        for(k = 0; k < rs->taps; ++k) {
+            /* Distance from the output time to this tap, in input frames */
+            d = k - (half - 1) - (double)r / rs->phases;
+            x = d / half;
+            if(fabs(x) >= 1.0) {
+                v = 0.0;
+            } else {
+                v = cutoff * ((d == 0.0) ? 1.0 :
+                        sin(M_PI * cutoff * d) / (M_PI * cutoff * d));
+                v *= besselI0_(beta * sqrt(1.0 - x * x)) / i0beta;
+            }
+            row[k] = (float)v;
+            sum += v;
+        }
+        for(k = 0; k < rs->taps; ++k) row[k] = (float)(row[k] / sum);
+    }
+} /* DesignFilter_ */
+
+/* Public functions ======================================================= */
+
+AuResampler *AuRs_New(int in_rate, int out_rate, int channels,
+        Au_ResampleQuality quality)
+{
+    AuResampler *rs;
+    long g;
+    double cutoff, half;
+
+    if(in_rate < 1 || out_rate < 1 || channels < 1) return NULL;
+    if( ((int)quality <= (int)AURQ_PROFILE) ||
+        ((size_t)quality >= sizeof(AuRsQualities_)/sizeof(AuRsQualities_[0])) ) {
+        return NULL;
+    }
+
+    if(!(rs = (AuResampler *)malloc(sizeof(AuResampler)))) return NULL;
+    memset(rs, 0, sizeof(AuResampler));
+
+    do {    /* init with rollback */
+        rs->channels = channels;
+        g = gcd_(in_rate, out_rate);
+        rs->L = out_rate / g;
+        rs->M = in_rate / g;
+        rs->interp = (rs->L > AU_RS_MAX_PHASES);
+        rs->phases = rs->interp ? AU_RS_MAX_PHASES : (int)rs->L;
+
+        /* When downsampling, cut off below the output's Nyquist, and
+         * stretch the filter to match, so the transition band is the
+         * same width relative to the output rate. */
+        cutoff = AuRsQualities_[quality].rolloff;
+        if(rs->M > rs->L) cutoff *= (double)rs->L / rs->M;
+        half = ceil(AuRsQualities_[quality].zero_crossings / cutoff);
+        rs->taps = ((int)(2 * half) + 7) & ~7;
+        if(rs->taps > AU_RS_MAX_TAPS) rs->taps = AU_RS_MAX_TAPS;
+
+        if(!(rs->coeffs = (float *)malloc(
+                (size_t)(rs->phases + 1) * rs->taps * sizeof(float)))) break;
+        if(!(rs->blend = (float *)malloc(rs->taps * sizeof(float)))) break;
+        rs->hist_cap = rs->taps + AU_RS_HIST_FRAMES;
+        if(!(rs->hist = (float *)malloc(
+                (size_t)rs->hist_cap * channels * sizeof(float)))) break;
+
+        DesignFilter_(rs, cutoff, AuRsQualities_[quality].beta);
+
+        rs->dot = DotScalar_;
+        rs->dot_name = "scalar";
+#ifdef __SSE__
+        rs->dot = DotSSE_;
+        rs->dot_name = "sse";
+#endif
+#ifdef AU_RS_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            rs->dot = DotAVX2_;
+            rs->dot_name = "avx2";
+        }
+#endif
+
+        AuRs_Reset(rs);
+        return rs;      /* Success exit */
+    } while(0);
+
+    AuRs_Delete(rs);
+    return NULL;
+} /* AuRs_New */
+
+void AuRs_Delete(AuResampler *rs)
+{
+    if(!rs) return;
+    free(rs->coeffs);
+    free(rs->blend);
+    free(rs->hist);
+    free(rs);
+} /* AuRs_Delete */
+
+void AuRs_Reset(AuResampler *rs)
+{
+    int c;
+
+    /* Start with half a filter of silence, so the first output lines
+     * up with the first input frame. */
+    rs->hist_len = rs->taps / 2 - 1;
+    for(c = 0; c < rs->channels; ++c) {
+        memset(rs->hist + (size_t)c * rs->hist_cap, 0,
+                rs->hist_len * sizeof(float));
+    }
+    rs->ipos = 0;
+    rs->frac = 0;
+} /* AuRs_Reset */
+
+long AuRs_FlushFrames(const AuResampler *rs)
+{
+    return rs->taps / 2 + 1;
+} /* AuRs_FlushFrames */
+
+const char *AuRs_Implementation(const AuResampler *rs)
+{
+    return rs->dot_name;
+} /* AuRs_Implementation */
+
+/** Get the filter for an output rs->frac/rs->L past rs->ipos. */
+static const float *filterFor_(AuResampler *rs)
+{
+    double pos;
+    long r;
+    float w;
+    const float *row0, *row1;
+    int k;
+
+    if(!rs->interp) return rs->coeffs + (size_t)rs->frac * rs->taps;
+
+    pos = (double)rs->frac * rs->phases / rs->L;
+    r = (long)pos;
+    w = (float)(pos - r);
+    row0 = rs->coeffs + (size_t)r * rs->taps;
+    row1 = row0 + rs->taps;
+    for(k = 0; k < rs->taps; ++k) {
+        rs->blend[k] = row0[k] + w * (row1[k] - row0[k]);
+    }
+    return rs->blend;
+} /* filterFor_ */
+
+size_t AuRs_Process(AuResampler *rs, const float *in, size_t in_frames,
+        size_t *in_used, float *out, size_t out_frames)
+{
+    size_t produced = 0, used = 0, n, i;
+    long drop;
+    int c;
+    const float *h;
+    float *row;
+
+    while(1) {
+        /* Make all the output the history allows */
+        while( (produced < out_frames) &&
+                (rs->ipos + rs->taps <= rs->hist_len) ) {
+            h = filterFor_(rs);
+            for(c = 0; c < rs->channels; ++c) {
+                *out++ = rs->dot(h,
+                        rs->hist + (size_t)c * rs->hist_cap + rs->ipos,
+                        rs->taps);
+            }
+            ++produced;
+            rs->frac += rs->M;
+            rs->ipos += rs->frac / rs->L;
+            rs->frac %= rs->L;
+        }
+        if(produced == out_frames || used == in_frames) break;
+
+        /* Drop history we no longer need.  When downsampling, the next
+         * filter may start past the end of the history, so skip input
+         * too. */
+        drop = (rs->ipos < rs->hist_len) ? rs->ipos : rs->hist_len;
+        if(drop > 0) {
+            for(c = 0; c < rs->channels; ++c) {
+                row = rs->hist + (size_t)c * rs->hist_cap;
+                memmove(row, row + drop, (rs->hist_len - drop) * sizeof(float));
+            }
+            rs->hist_len -= drop;
+            rs->ipos -= drop;
+        }
+        if(rs->ipos > 0) {
+            n = in_frames - used;
+            if(n > (size_t)rs->ipos) n = rs->ipos;
+            used += n;
+            rs->ipos -= n;
+            continue;
+        }
+
+        /* Take in more input, splitting it up by channel */
+        n = in_frames - used;
+        if(n > (size_t)(rs->hist_cap - rs->hist_len)) {
+            n = rs->hist_cap - rs->hist_len;
+        }
+        for(c = 0; c < rs->channels; ++c) {
+            row = rs->hist + (size_t)c * rs->hist_cap + rs->hist_len;
+            for(i = 0; i < n; ++i) {
+                row[i] = in[(used + i) * rs->channels + c];
+            }
+        }
+        used += n;
+        rs->hist_len += n;
+    }
+
+    *in_used = used;
+    return produced;
+} /* AuRs_Process */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -0,0 +1,66 @@
+/* au_resample.h: Sample-rate conversion for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AU_RESAMPLE_H_
+#define _AU_RESAMPLE_H_
+
+#include <stddef.h>
+#include "audio_utsl.h"
+
+/* A polyphase windowed-sinc (Kaiser) resampler for interleaved float
+ * audio.  It works in streaming fashion: feed it input as it arrives,
+ * and it keeps the filter history between calls.  Output frame n is
+ * input time n * in_rate / out_rate, with no added delay.
+ *
+ * When out_rate/in_rate reduces to a fraction with a small enough
+ * numerator (e.g., 160/147 for 44.1 kHz -> 48 kHz), there is one
+ * precomputed filter per output phase.  Otherwise, adjacent phases of
+ * a finer table are interpolated. */
+
+/** A resampler.  Opaque. */
+typedef struct AuResampler AuResampler;
+
+/** Create a resampler.  #quality must not be AURQ_PROFILE.
+ * @return The resampler, or NULL on failure. */
+AuResampler *AuRs_New(int in_rate, int out_rate, int channels,
+        Au_ResampleQuality quality);
+
+/** Free #rs.  NULL is OK. */
+void AuRs_Delete(AuResampler *rs);
+
+/** Forget all input, as if #rs had just been created. */
+void AuRs_Reset(AuResampler *rs);
+
+/** How many frames of silence to feed #rs after the last real input
+ * frame so that all the output from the real input comes out. */
+long AuRs_FlushFrames(const AuResampler *rs);
+
+/** Resample.  Stops when the output is full or the input is used up,
+ * whichever comes first.  Input that has been used is kept inside #rs
+ * as needed, so pass only new input next time.
+ * @param in #in_frames interleaved frames of input
+ * @param in_used Set to how many input frames were used
+ * @param out Room for #out_frames interleaved frames of output
+ * @return The number of output frames produced. */
+size_t AuRs_Process(AuResampler *rs, const float *in, size_t in_frames,
+        size_t *in_used, float *out, size_t out_frames);
+
+/** Get the name of the dot-product kernel in use: "avx2", "sse" or
+ * "scalar". */
+const char *AuRs_Implementation(const AuResampler *rs);
+
+#endif /* _AU_RESAMPLE_H_ */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
@@ -0,0 +1,201 @@
+/* au_ring.c: Single-producer, single-consumer ring buffer for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Headers ================================================================ */
+
+#include "au_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "pa_memorybarrier.h"
+
+/* Private definitions ==================================================== */
+
+#if defined(__linux__)
+/** The huge-page size AU_RING_MEM_HUGE rounds up to (x86-64, arm64) */
+#define AU_RING_HUGE_PAGE ((size_t)2 * 1024 * 1024)
+#endif
+
+/** Point #data1..#size2 at #count elements of #ring from #index, which
+ * may wrap around the end. */
+static void Regions_(AuRing *ring, ring_buffer_size_t index,
+        ring_buffer_size_t count, void **data1, ring_buffer_size_t *size1,
+        void **data2, ring_buffer_size_t *size2)
+{
+    ring_buffer_size_t first;
+
+    index &= ring->small_mask;
+    *data1 = &ring->buffer[index * ring->elem_bytes];
+    if(index + count > ring->size) {
+        first = ring->size - index;
+        *size1 = first;
+        *data2 = &ring->buffer[0];
+        *size2 = count - first;
+    } else {
+        *size1 = count;
+        *data2 = NULL;
+        *size2 = 0;
+    }
+} /* Regions_ */
+
+#ifdef AU_RING_HUGE_PAGE
+/** Map #bytes, rounded up to whole huge pages, for #mem.  Uses reserved
+ * huge pages if there are any, or else asks for transparent ones.
+ * @return TRUE on success. */
+static int MapHuge_(AuRingMemory *mem, size_t bytes)
+{
+    size_t len = (bytes + AU_RING_HUGE_PAGE - 1) & ~(AU_RING_HUGE_PAGE - 1);
+    void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if(p == MAP_FAILED) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) return 0;
+#ifdef MADV_HUGEPAGE
+        madvise(p, len, MADV_HUGEPAGE);     /* only a hint */
+#endif
+    }
+
+    mem->data = p;
+    mem->bytes = len;
+    mem->mapped = 1;
+    return 1;
+} /* MapHuge_ */
+#endif /* AU_RING_HUGE_PAGE */
+
+/* Public functions ======================================================= */
+
+ring_buffer_size_t AuRing_Init(AuRing *ring, ring_buffer_size_t elem_bytes,
+        ring_buffer_size_t count, void *data)
+{
+    if( (count <= 0) || (((count - 1) & count) != 0) ) return -1;
+
+    ring->size = count;
+    ring->big_mask = count * 2 - 1;
+    ring->small_mask = count - 1;
+    ring->elem_bytes = elem_bytes;
+    ring->buffer = (char *)data;
+    AuRing_Flush(ring);
+    return 0;
+} /* AuRing_Init */
+
+void AuRing_Flush(AuRing *ring)
+{
+    ring->write_index = ring->read_index = 0;
+    ring->cached_read = ring->cached_write = 0;
+} /* AuRing_Flush */
+
+ring_buffer_size_t AuRing_ReadAvailable(const AuRing *ring)
+{
+    return (ring->write_index - ring->read_index) & ring->big_mask;
+} /* AuRing_ReadAvailable */
+
+ring_buffer_size_t AuRing_GetWriteRegions(AuRing *ring,
+        ring_buffer_size_t count, void **data1, ring_buffer_size_t *size1,
+        void **data2, ring_buffer_size_t *size2)
+{
+    ring_buffer_size_t w = ring->write_index, avail;
+
+    /* Only look at the consumer's line if our copy says we're short */
+    avail = ring->size - ((w - ring->cached_read) & ring->big_mask);
+    if(avail < count) {
+        ring->cached_read = ring->read_index;
+        avail = ring->size - ((w - ring->cached_read) & ring->big_mask);
+    }
+    if(count > avail) count = avail;
+
+    Regions_(ring, w, count, data1, size1, data2, size2);
+    if(avail) PaUtil_FullMemoryBarrier();   /* write after read */
+    return count;
+} /* AuRing_GetWriteRegions */
+
+void AuRing_AdvanceWriteIndex(AuRing *ring, ring_buffer_size_t count)
+{
+    /* The elements before the index that says they're there */
+    PaUtil_WriteMemoryBarrier();
+    ring->write_index = (ring->write_index + count) & ring->big_mask;
+} /* AuRing_AdvanceWriteIndex */
+
+ring_buffer_size_t AuRing_GetReadRegions(AuRing *ring,
+        ring_buffer_size_t count, void **data1, ring_buffer_size_t *size1,
+        void **data2, ring_buffer_size_t *size2)
+{
+    ring_buffer_size_t r = ring->read_index, avail;
+
+    /* Only look at the producer's line if our copy says we're short */
+    avail = (ring->cached_write - r) & ring->big_mask;
+    if(avail < count) {
+        ring->cached_write = ring->write_index;
+        avail = (ring->cached_write - r) & ring->big_mask;
+    }
+    if(count > avail) count = avail;
+
+    Regions_(ring, r, count, data1, size1, data2, size2);
+    if(avail) PaUtil_ReadMemoryBarrier();   /* read after read */
+    return count;
+} /* AuRing_GetReadRegions */
+
+void AuRing_AdvanceReadIndex(AuRing *ring, ring_buffer_size_t count)
+{
+    /* Finish reading the elements before handing them back */
+    PaUtil_FullMemoryBarrier();
+    ring->read_index = (ring->read_index + count) & ring->big_mask;
+} /* AuRing_AdvanceReadIndex */
+
+int AuRing_AllocMemory(AuRingMemory *mem, size_t bytes, int flags)
+{
+    memset(mem, 0, sizeof(AuRingMemory));
+    bytes = (bytes + AU_CACHE_LINE - 1) & ~(size_t)(AU_CACHE_LINE - 1);
+    if(bytes == 0) bytes = AU_CACHE_LINE;
+
+#ifdef AU_RING_HUGE_PAGE
+    if(flags & AU_RING_MEM_HUGE) MapHuge_(mem, bytes);
+#endif
+    if(!mem->data) {
+        if(posix_memalign(&mem->data, AU_CACHE_LINE, bytes) != 0) {
+            mem->data = NULL;
+            return 0;
+        }
+        mem->bytes = bytes;
+    }
+
+    if(flags & AU_RING_MEM_LOCK) {
+        mem->locked = (mlock(mem->data, mem->bytes) == 0);
+    }
+
+    /* Touch every page now, so the first use doesn't fault */
+    memset(mem->data, 0, mem->bytes);
+    return 1;
+} /* AuRing_AllocMemory */
+
+void AuRing_FreeMemory(AuRingMemory *mem)
+{
+    if(!mem->data) return;
+    if(mem->locked) munlock(mem->data, mem->bytes);
+    if(mem->mapped) {
+        munmap(mem->data, mem->bytes);
+    } else {
+        free(mem->data);
+    }
+    memset(mem, 0, sizeof(AuRingMemory));
+} /* AuRing_FreeMemory */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
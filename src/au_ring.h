@@ -0,0 +1,123 @@
+/* au_ring.h: Single-producer, single-consumer ring buffer for audio-utsl.
+ * Copyright (c) 2018 Chris White (cxw/Incline).
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * https://www.apache.org/licenses/LICENSE-2.0.
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _AU_RING_H_
+#define _AU_RING_H_
+
+#include <stddef.h>
+#include "pa_ringbuffer.h"      /* for ring_buffer_size_t */
+
+/* The same algorithm and API as PortAudio's PaUtilRingBuffer, laid out
+ * for two threads on two cores.  PaUtilRingBuffer keeps both indices
+ * side by side, so every advance by one thread invalidates the cache
+ * line the other is polling.  Here, what the producer writes, what the
+ * consumer writes, and the settings both only read are a whole cache
+ * line apart, however the AuRing itself is aligned.  Each side also
+ * keeps its own copy of the other's index, and only reads the real one
+ * when its copy says the ring is full (or empty).
+ *
+ * The producer calls AuRing_GetWriteRegions() and
+ * AuRing_AdvanceWriteIndex(); the consumer calls
+ * AuRing_GetReadRegions() and AuRing_AdvanceReadIndex().  Either may
+ * call AuRing_ReadAvailable(). */
+
+/** The size of a cache line, or more */
+#define AU_CACHE_LINE (64)
+
+typedef struct AuRing {
+    /* Set by AuRing_Init(), then only read */
+    ring_buffer_size_t size;        /**< elements; a power of 2 */
+    ring_buffer_size_t big_mask;    /**< wraps indices, with an extra bit
+                                         to tell full from empty */
+    ring_buffer_size_t small_mask;  /**< fits indices to the buffer */
+    ring_buffer_size_t elem_bytes;
+    char *buffer;
+    char pad0_[AU_CACHE_LINE];
+
+    /* The producer's */
+    volatile ring_buffer_size_t write_index;
+    ring_buffer_size_t cached_read;     /**< read_index, as last seen */
+    char pad1_[AU_CACHE_LINE];
+
+    /* The consumer's */
+    volatile ring_buffer_size_t read_index;
+    ring_buffer_size_t cached_write;    /**< write_index, as last seen */
+    char pad2_[AU_CACHE_LINE];
+} AuRing;
+
+/** Set up #ring, empty, over #count elements of #elem_bytes each at
+ * #data.
+ * @return 0 on success; -1 if #count isn't a power of 2. */
+ring_buffer_size_t AuRing_Init(AuRing *ring, ring_buffer_size_t elem_bytes,
+        ring_buffer_size_t count, void *data);
+
+/** Empty #ring.  Only while neither side is using it. */
+void AuRing_Flush(AuRing *ring);
+
+/** How many elements are waiting to be read */
+ring_buffer_size_t AuRing_ReadAvailable(const AuRing *ring);
+
+/** As PaUtil_GetRingBufferWriteRegions(): get up to #count free
+ * elements, which may wrap around.  Producer only.
+ * @return How many elements the regions hold. */
+ring_buffer_size_t AuRing_GetWriteRegions(AuRing *ring,
+        ring_buffer_size_t count, void **data1, ring_buffer_size_t *size1,
+        void **data2, ring_buffer_size_t *size2);
+
+/** Publish #count elements written into the write regions.  Producer
+ * only. */
+void AuRing_AdvanceWriteIndex(AuRing *ring, ring_buffer_size_t count);
+
+/** As PaUtil_GetRingBufferReadRegions(): get up to #count elements to
+ * read, which may wrap around.  Consumer only.
+ * @return How many elements the regions hold. */
+ring_buffer_size_t AuRing_GetReadRegions(AuRing *ring,
+        ring_buffer_size_t count, void **data1, ring_buffer_size_t *size1,
+        void **data2, ring_buffer_size_t *size2);
+
+/** Free #count elements that have been read.  Consumer only. */
+void AuRing_AdvanceReadIndex(AuRing *ring, ring_buffer_size_t count);
+
+/* Memory for the elements.  It always starts on a cache line, and is
+ * zeroed so every page is faulted in before the audio thread sees it.
+ * The elements themselves are packed at whatever size the caller gave
+ * AuRing_Init(). */
+
+/** Flags for AuRing_AllocMemory() */
+#define AU_RING_MEM_LOCK (1)    /**< mlock() it so it can't be paged out */
+#define AU_RING_MEM_HUGE (2)    /**< back it with huge pages, on Linux */
+
+/** Memory from AuRing_AllocMemory() */
+typedef struct AuRingMemory {
+    void *data;
+    size_t bytes;       /**< as allocated, which may be rounded up */
+    int mapped;         /**< from mmap(), not posix_memalign() */
+    int locked;         /**< mlock() succeeded */
+} AuRingMemory;
+
+/** Allocate #bytes for a ring's elements.  If locking or huge pages
+ * aren't available (e.g., RLIMIT_MEMLOCK is too low), you get
+ * ordinary memory.
+ * @param flags AU_RING_MEM_* flags
+ * @return TRUE on success; FALSE if out of memory. */
+int AuRing_AllocMemory(AuRingMemory *mem, size_t bytes, int flags);
+
+/** Free memory from AuRing_AllocMemory(), and clear #mem.  OK if
+ * nothing was allocated. */
+void AuRing_FreeMemory(AuRingMemory *mem);
+
+#endif /* _AU_RING_H_ */
+
+/* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
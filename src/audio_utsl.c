@@ -22,14 +22,28 @@
 #include <portaudio.h>
 
 #include <pthread.h>
-#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #define _USE_MATH_DEFINES
     /* Or you don't get M_PI from math.h on my system */
 #include <math.h>
 
-#include "pa_ringbuffer.h"
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "au_convert.h"
+#include "au_fileio.h"
+#include "au_infocache.h"
+#include "au_osc.h"
+#include "au_pool.h"
+#include "au_resample.h"
+#include "au_ring.h"
+#include "pa_memorybarrier.h"
 
 /* Private definitions ==================================================== */
 
@@ -63,18 +77,67 @@ STATIC_ASSERT( sizeof(float) == 4, "float must be 4 bytes");
 #define UNUSED(x) ((void)(x))
 
 /* Internal parameters ------------------------------------------ */
-/* TODO make these variables? */
 
-/** The maximum number of channels we support */
-#define PA_MAX_CHANNELS (2)
+/** The maximum number of channels we support.  Only a sanity check:
+ * ring-buffer blocks are sized for the actual channel count. */
+#define PA_MAX_CHANNELS (64)
 
-/** The number of frames in a PortAudio buffer */
+/** The default number of frames in a ring-buffer block
+ * (AULP_DEFAULT).  Au_NewEx() can override this. */
 #define PA_BUFFER_FRAMECOUNT (256)
 
-/** The number of PortAudio buffers in a libsndfile ring buffer.
- * Must be a power of 2 (PortAudio requirement). */
+/** The most frames a ring-buffer block can hold (FRBuf.frames) */
+#define AU_BLOCK_FRAMES_MAX (65535)
+
+/** Ring-buffer elements are padded to a multiple of this, so each
+ * block's data starts suitably aligned for the conversion kernels.
+ * Only the ring's storage as a whole starts on a cache line. */
+#define AU_FRBUF_ALIGN (16)
+
+/** The default number of blocks in a libsndfile ring buffer
+ * (AULP_DEFAULT).  Must be a power of 2 (PortAudio requirement).
+ * Au_NewEx() can override this. */
 #define PA_RING_BUFFERCOUNT (32)
 
+/** In adaptive mode, a callback that leaves fewer than
+ * 1/AU_ADAPT_LOW_FRACTION of the current read-ahead in the ring counts
+ * as a near-underrun. */
+#define AU_ADAPT_LOW_FRACTION (4)
+
+/** In adaptive mode, shrink the read-ahead after this many times its
+ * length has played without a near-underrun. */
+#define AU_ADAPT_STABLE_RINGS (16)
+
+/** The callback wakes a stream's reader once there are no more than
+ * 1/AU_WAKE_LOW_FRACTION of the current read-ahead left in the ring.
+ * The reader then refills the whole read-ahead. */
+#define AU_WAKE_LOW_FRACTION (2)
+
+/** The most reader threads Au_Startup() starts by default, however
+ * many CPUs there are.  Au_SetReaderThreads() can ask for more. */
+#define AU_READER_THREADS_MAX (8)
+
+/** The most threads Au_InspectFiles() uses.  Inspecting is mostly
+ * waiting on the disk, so it uses up to two per CPU. */
+#define AU_INSPECT_THREADS_MAX (16)
+
+/** How many files an Au_InspectFiles() thread takes at a time */
+#define AU_INSPECT_CLAIM (16)
+
+/** When resampling, how many frames the reader decodes at a time */
+#define AU_RS_READ_FRAMES (4096)
+
+/** How much of a pipe's stream the reader waits for before reading
+ * the header (SFPipeOpen_()).  Enough for most headers, but quick to
+ * come from a slow source: half a second at 128 kbit/s.  A longer
+ * header makes SFPipeOpen_() wait for the rest. */
+#define AU_PIPE_HEADER_BYTES (8*1024)
+
+/** Compressed formats are decoded from whatever the decoder has read
+ * ahead, so a reader decoding from a pipe (SFPipeBudget_()) leaves this
+ * much of what has arrived for the decoder to read ahead into. */
+#define AU_PIPE_SLACK_BYTES (64*1024)
+
 /** PAPlayCallback_() State.  Sent by the SF reader to the playback
  * thread. */
 typedef enum PPPS {
@@ -84,6 +147,23 @@ typedef enum PPPS {
     PPPS_Stopped
 } PPPS;
 
+/** What has become of the PPPS_Stopped block the reader sent, if any.
+ * See Au_Stream.eof_state. */
+typedef enum AUEOF {
+    /** None is in the ring */
+    AUEOF_NONE,
+    /** None is in the ring, but the reader has published everything
+     * there is, and is holding the block back (SFReaderMayStop_()) */
+    AUEOF_HELD,
+    /** One is in the ring, and will end playback */
+    AUEOF_SENT,
+    /** One is in the ring, but Au_Enqueue() has queued another file
+     * since, so the callback will skip it */
+    AUEOF_REVOKED,
+    /** The callback has reached it, so playback is over */
+    AUEOF_TAKEN
+} AUEOF;
+
 /** Counts of frames. */
 typedef long int Au_FrameCount;
 
@@ -99,17 +179,383 @@ typedef struct Au_Userdata {
 } Au_Userdata, *PAU_Userdata;
 
 /** A buffer from the file reader to the PA callback.
- * The data member is large enough to hold the largest buffer.
- * required */
+ * The block size is set per output (Au_Output.block_frames), and the
+ * frame size depends on the format and channel count, so the data
+ * member is sized when the ring buffer is allocated.  Use
+ * Au_Stream.sf_elem_bytes, not sizeof(FRBuf), to step through the
+ * ring.  The header is kept to 16 bytes, since it is paid once per
+ * block. */
 typedef struct FRBuf {
-    /** What the playback routine should do. */
-    PPPS state;
     /** What position we're at in the file. */
-    Au_FrameCount pos_frames;
-    /** The audio data */
-    unsigned char data[PA_BUFFER_FRAMECOUNT * PA_MAX_CHANNELS * sizeof(float)];
+    int64_t pos_frames;
+    /** The low 32 bits of Au_Stream.seek_gen when the block was read.
+     * Blocks from before the latest Au_Seek() are skipped. */
+    uint32_t gen;
+    /** How many frames of data are valid.  Less than
+     * Au_Output.block_frames only at the end of the file. */
+    uint16_t frames;
+    /** What the playback routine should do: a PPPS. */
+    uint8_t state;
+    uint8_t reserved_;
+    /** The audio data: Au_Output.block_frames frames of
+     * Au_Output.frame_bytes each. */
+    unsigned char data[];
 } FRBuf, *PFRBuf;
 
+/** A file waiting in an output's play queue.  See Au_Enqueue(). */
+typedef struct Au_QueueEntry {
+    struct Au_QueueEntry *next;
+    char filename[];
+} Au_QueueEntry, *PAU_QueueEntry;
+
+/** A file decoded into memory, in the decoded-sample cache.  The
+ * HAUSAMPLE handed to the caller points to one of these. */
+typedef struct Au_Sample {
+    /** The cache's LRU list, most recently used first */
+    struct Au_Sample *prev, *next;
+
+    /** The next sample in the same hash bucket, and SampleHash_() of
+     * this one's key */
+    struct Au_Sample *hash_next;
+    unsigned long hash;
+
+    /** Outstanding Au_SampleLoad() handles plus playbacks.  Can't be
+     * evicted while nonzero.  Protected by SampleCacheMutex_. */
+    int refs;
+
+    /** What the data is, so it can only be played on matching outputs */
+    Au_SampleFormat format;
+    int sample_rate;
+    int channels;
+    int frame_bytes;
+
+    /** How much data there is */
+    Au_FrameCount frames;
+
+    /** The decoded data, frames*frame_bytes bytes */
+    unsigned char *data;
+
+    /** The file the data came from */
+    char filename[];
+} Au_Sample, *PAU_Sample;
+
+/** Buffering parameters for each Au_LatencyProfile. */
+static const struct {
+    long block_frames;
+    long ring_blocks;
+    BOOL low_latency;       /**< use the device's default low latency */
+    Au_ResampleQuality resample_quality;
+} AuProfiles_[] = {
+    /* AULP_DEFAULT */      { PA_BUFFER_FRAMECOUNT, PA_RING_BUFFERCOUNT, FALSE,
+                                AURQ_MEDIUM },
+    /* AULP_INTERACTIVE */  { 64, 16, TRUE, AURQ_FAST },
+    /* AULP_ROBUST */       { 1024, 128, FALSE, AURQ_BEST },
+};
+
+/** The reader and ring buffer that stream one file (or one queue of
+ * files) to a playback callback.  The reader runs on the shared
+ * ReaderPool_ whenever the ring needs filling.  Au_Play() uses the one in
+ * Au_Output; each file voice in the mixer has its own. */
+typedef struct Au_Stream {
+    /** The output this stream plays on, for the format and buffering
+     * parameters */
+    PAU pau;
+
+    /* --- Buffering ---------------------------------- */
+
+    /** How many blocks of read-ahead the reader currently keeps.
+     * Equal to Au_Output.ring_blocks unless Au_Output.adaptive.
+     * Written only by the reader thread. */
+    volatile long ring_target;
+
+    /** How many times the callback has left less than
+     * 1/AU_ADAPT_LOW_FRACTION of ring_target in the ring.  Written only
+     * by the callback. */
+    volatile unsigned long near_underruns;
+
+    /** The reader's copy of near_underruns as of its last wakeup */
+    unsigned long adapt_seen_underruns;
+
+    /** Blocks the reader has sent since the last near-underrun or
+     * ring_target change. */
+    long adapt_stable_blocks;
+
+    /* --- libsndfile - input ------------------------- */
+
+    /** The reader's task on ReaderPool_.  Signaled when the ring
+     * drains to the low watermark (see StreamWakeReader_()), or when
+     * the reader has other work to do.  Signals that arrive before it
+     * runs are merged, so the callback costs the reader at most one
+     * run per refill. */
+    AuPoolTask sf_task;
+
+    /** TRUE from a successful StreamOpen_() until StreamClose_(), i.e.,
+     * while sf_task may run.  Stored with release semantics, since
+     * StreamPipeNotify_() reads it on the pipe's thread. */
+    BOOL sf_reader_active;
+
+    /** Set by the reader if it can't read any more.  It then does
+     * nothing when it runs. */
+    BOOL sf_reader_failed;
+
+    /** The file currently being read. */
+    SNDFILE *sf_fd;
+
+    /** The read-ahead cache libsndfile reads sf_fd through, or NULL */
+    AuFile *sf_file;
+
+    /** When playing from a pipe (Au_PlayFd(), Au_PlayCallback()), the
+     * AuPipe libsndfile reads the first sf_fd through.  The reader
+     * only reads the header, and only decodes, what has already
+     * arrived (SFPipeBudget_()), so it doesn't wait on the source.
+     * Kept until StreamClose_(), even after the reader moves on to
+     * queued files, so it's safe to stop from any thread.  NULL
+     * otherwise. */
+    AuPipe *sf_pipe;
+
+    /** Set by the reader once it has tried to read #sf_pipe's header
+     * (SFPipeOpen_()), and whether that failed */
+    BOOL sf_pipe_opened;
+    BOOL sf_pipe_failed;
+
+    /** While sf_fd reads #sf_pipe, the most bytes a frame of it can
+     * take, and how much the decoder may read ahead (SFPipeOpen_()).
+     * 0 otherwise. */
+    long sf_pipe_frame_bytes;
+    long sf_pipe_slack;
+
+    /** The next file to read, opened by the reader thread ahead of
+     * time so it can start as soon as sf_fd ends.  NULL if none. */
+    SNDFILE *sf_next_fd;
+
+    /** The read-ahead cache for sf_next_fd, or NULL */
+    AuFile *sf_next_file;
+
+    /** When playing from memory (Au_PlayMemory()), the buffer.  sf_fd
+     * reads it through MemVirtualIO_, unless #mem_direct.  NULL when
+     * playing a file. */
+    const unsigned char *mem_data;
+
+    /** The size of mem_data, and where in it sf_fd (or, with
+     * #mem_direct, the reader) is, in bytes */
+    sf_count_t mem_len, mem_pos;
+
+    /** Whether to free() mem_data when done with it */
+    BOOL mem_owned;
+
+    /** If TRUE, mem_data is raw PCM in the output's format and sample
+     * rate, so there's no sf_fd: SFReadStream_() just points sf_out at
+     * the next frames. */
+    BOOL mem_direct;
+
+    /** Set by the reader thread once it has decided to send the
+     * PPPS_Stopped block, so it doesn't keep reading past EOF.
+     * Written with queue_mutex held. */
+    BOOL sf_reader_at_eof;
+
+    /** An AUEOF.  The reader sets AUEOF_HELD or AUEOF_SENT (the latter
+     * along with #sf_reader_at_eof).  From there, the callback
+     * (AUEOF_TAKEN, on reaching the block or, if held, an empty ring)
+     * and Au_Enqueue() (AUEOF_NONE or AUEOF_REVOKED) race with
+     * compare-and-swap, so exactly one wins: either playback ends, or
+     * the new file joins the same ring.  The callback puts a revoked
+     * block back to AUEOF_NONE when it skips it.  The reader only
+     * sends a PPPS_Stopped block from AUEOF_NONE or AUEOF_HELD, so
+     * there is never more than one in the ring. */
+    volatile int eof_state;
+
+    /** Files waiting to be played after sf_fd, oldest first.  Filled
+     * by Au_Enqueue() and emptied by the reader thread. */
+    PAU_QueueEntry queue_head, queue_tail;
+
+    /** Protects queue_head, queue_tail, and changes to
+     * sf_reader_at_eof.  Never touched by the PortAudio callback.
+     * Lives as long as the Au_Stream, not just one StreamOpen_(). */
+    pthread_mutex_t queue_mutex;
+
+    /** Where the reader thread decodes data before splitting it into
+     * FRBufs.  Large enough to fill the whole ring buffer at once.
+     * Like the other buffers sized by the output's settings
+     * (sf_float_stage, sf_buffer_mem, and the resampler's), it is
+     * allocated by the first StreamOpen_() and kept until
+     * StreamDestroy_(), so later plays don't have to allocate. */
+    unsigned char *sf_stage;
+
+    /** Where the last SFReadStream_() left its frames: sf_stage, or,
+     * with #mem_direct, mem_data. */
+    const unsigned char *sf_out;
+
+    /** Where libsndfile decodes to, as floats, before conversion into
+     * sf_stage.  The same number of frames as sf_stage.  NULL if the
+     * output is AUSF_F32, since then we decode straight to sf_stage. */
+    float *sf_float_stage;
+
+    /** The reader's dither state, if Au_Output.dither */
+    AuConv_Dither sf_dither;
+
+    /* --- Sample-rate conversion --------------------- */
+
+    /** The sample rate of sf_fd */
+    int sf_rate;
+
+    /** The sample rate of sf_next_fd */
+    int sf_next_rate;
+
+    /** Converts sf_fd to the output's rate, or NULL if sf_fd is
+     * already at that rate.  Only used by the reader thread once it
+     * has started. */
+    AuResampler *resampler;
+
+    /** The input rate #resampler was made for */
+    int rs_rate;
+
+    /** What the resampler reads from: decoded frames of sf_fd, plus
+     * room for the silence that flushes the resampler at EOF. */
+    float *rs_in;
+    long rs_in_cap;
+
+    /** The frames of rs_in not yet used, from rs_in_pos to rs_in_len */
+    long rs_in_pos, rs_in_len;
+
+    /** Whether sf_fd has hit EOF, so rs_in ends with the flush */
+    BOOL rs_eof;
+
+    /** Frames read from sf_fd, and frames produced from them.  Used to
+     * trim the flush's output so the length comes out exact. */
+    sf_count_t rs_in_total, rs_out_total;
+
+    /* --- Seeking ------------------------------------ */
+
+    /** Bumped by Au_Seek() after it sets seek_frame.  Written only by
+     * the calling thread. */
+    volatile unsigned long seek_gen;
+
+    /** Where the latest Au_Seek() asked to go, in output frames */
+    volatile Au_FrameCount seek_frame;
+
+    /** The seek_gen the reader is reading for.  Only accessed by the
+     * reader thread once it has started. */
+    unsigned long sf_gen;
+
+    /** The seek_gen the callback is playing.  Only accessed by the
+     * callback once the stream has started. */
+    unsigned long play_gen;
+
+    /* --- Playback buffer ---------------------------- */
+
+    /** The ring buffer that is loaded by the reader thread.  Holds
+     * FRBuf structures. */
+    AuRing sf_buffer_storage;
+
+    /** How we access the ring buffer */
+    AuRing *sf_buffer;
+
+    /** The memory area where the ring buffer lives, starting on a
+     * cache line, and locked or on huge pages if Au_Options asks.
+     * Elements are sf_elem_bytes apart, not whole lines. */
+    AuRingMemory sf_buffer_mem;
+
+    /** The size of each FRBuf in sf_buffer_mem, including data[] */
+    long sf_elem_bytes;
+
+    /** The current frame count in the stream.  Not mutex-protected
+     * because it is only accessed by the reader (SFReaderFill_()). */
+    Au_FrameCount playback_frames;
+
+    /** How many frames of the FRBuf at the read index StreamRead_()
+     * has already output.  PortAudio may ask for any number of frames,
+     * so blocks are consumed partially and across callbacks.  Only
+     * accessed by the callback (and by StreamOpen_() before the stream
+     * starts). */
+    Au_FrameCount play_block_offset;
+
+    /** When StreamOpen_() was called, from nowNs_(), until the
+     * callback first outputs a block; then 0.  For
+     * Au_Stats.first_sample_us.  Set before the output starts, and
+     * afterwards only touched by the callback. */
+    unsigned long long play_start_ns;
+
+    /** TRUE until the callback has output the first block after
+     * StreamOpen_(), a seek, or (with AUUP_CONTINUE) an underrun.
+     * Meanwhile, the callback waits for Au_Output.prefill_blocks of
+     * read-ahead, and an empty ring just means the reader hasn't
+     * caught up, not that playback is over.  Only accessed by the
+     * callback (and by StreamOpen_()). */
+    BOOL play_waiting;
+
+} Au_Stream, *PAU_Stream;
+
+/** The counters behind Au_GetStats().  Each is updated with a relaxed
+ * atomic add (see STAT_ADD_), which costs a few nanoseconds and never
+ * blocks, so they are always on.  Several threads may update them:
+ * the callback, and each reader thread. */
+typedef struct Au_StatCounters {
+    unsigned long underruns;
+    unsigned long fill_samples;
+    unsigned long long fill_sum;
+    long fill_min;              /**< -1 until the first sample */
+    unsigned long long decode_ns;
+    unsigned long decode_blocks;
+    unsigned long reader_wakeups;
+    unsigned long long frames;
+    unsigned long callbacks;
+    unsigned long callback_hist[AU_STATS_HIST_BUCKETS];
+    unsigned long first_samples;
+    unsigned long long first_sample_ns;
+    unsigned long long first_sample_last_ns;
+} Au_StatCounters;
+
+/** Mixer voice states.  A slot goes FREE -> ACTIVE in the control
+ * thread, ACTIVE -> DONE in the callback, and DONE -> FREE in the
+ * control thread once it has released the voice's source.  The control
+ * thread reserves the slot (Au_Voice.reserved) for the FREE -> ACTIVE
+ * and DONE -> FREE steps, so it can do them without mixer_mutex. */
+typedef enum AUVS {
+    AUVS_FREE,
+    AUVS_ACTIVE,
+    AUVS_DONE
+} AUVS;
+
+/** One sound being mixed.  See Au_MixerPlaySample(). */
+typedef struct Au_Voice {
+    /** Where the slot is in its life cycle.  Whoever moves it on uses
+     * a write barrier first, so the other side sees everything else. */
+    volatile AUVS state;
+
+    /** Set, under mixer_mutex, while a control thread owns the slot,
+     * releasing the old source or opening a new one without the lock.
+     * No other thread claims or reaps it meanwhile.  The callback
+     * doesn't look at this. */
+    BOOL reserved;
+
+    /** Set by the control thread to ask the callback to fade the voice
+     * out and finish it.  A voice with this set no longer counts
+     * against Au_Output.max_voices. */
+    volatile BOOL stop_requested;
+
+    /** The gain the caller asked for */
+    volatile float gain;
+
+    /** The gain the callback used for the last chunk.  Changes are
+     * ramped over one chunk so they don't click. */
+    float applied_gain;
+
+    /** Higher-priority voices are stolen last */
+    int priority;
+
+    /** Start order.  Also the voice ID the caller sees. */
+    long serial;
+
+    /** The source: a cached sample, or else #stream */
+    PAU_Sample sample;
+
+    /** The next frame of #sample to play */
+    Au_FrameCount sample_pos;
+
+    /** The source for file voices */
+    Au_Stream stream;
+} Au_Voice, *PAU_Voice;
+
 /** The internal details of a single output (HAU). */
 typedef struct Au_Output {
     /* --- General parameters ------------------------- */
@@ -123,6 +569,42 @@ typedef struct Au_Output {
     /** The number of channels */
     int channels;
 
+    /** The size of one frame (one sample of each channel), in bytes */
+    int frame_bytes;
+
+    /* --- Buffering ---------------------------------- */
+
+    /** The number of frames in each FRBuf */
+    long block_frames;
+
+    /** The number of FRBufs in the ring buffer.  A power of 2. */
+    long ring_blocks;
+
+    /** Whether to adapt Au_Stream.ring_target to how playback is going */
+    BOOL adaptive;
+
+    /** With #adaptive, the smallest ring_target.  A power of 2. */
+    long min_ring_blocks;
+
+    /** Whether to dither when converting to #format */
+    BOOL dither;
+
+    /** What to do when a stream's ring runs dry */
+    Au_UnderrunPolicy underrun_policy;
+
+    /** Blocks of read-ahead to wait for before starting, or resuming
+     * after a seek or underrun.  At most #ring_blocks. */
+    long prefill_blocks;
+
+    /** How to resample files that aren't at #sample_rate */
+    Au_ResampleQuality resample_quality;
+
+    /** AU_RING_MEM_* flags for the streams' ring buffers */
+    int ring_mem_flags;
+
+    /** How the streams read files */
+    AuFileParams file_params;
+
     /* --- PortAudio - output ------------------------- */
 
     /** The PortAudio stream */
@@ -135,62 +617,145 @@ typedef struct Au_Output {
     /* Userdata for the pa_callback */
     void *pa_callback_userdata;
 
-    /* --- libsndfile - input ------------------------- */
+    /* --- Offline rendering -------------------------- */
 
-    /** The thread that reads from the input file */
-    pthread_t sf_reader_thread_storage;
+    /** If TRUE, there is no pa_stream: a render thread calls
+     * pa_callback as fast as it can and writes the output to
+     * render_fd. */
+    BOOL render;
 
-    /** How we access the reader thread.  NULL means
-     * sf_reader_thread_storage does not have a valid value. */
-    pthread_t *sf_reader_thread;
+    /** The file being rendered to, or NULL to throw the output away */
+    SNDFILE *render_fd;
 
-    /** The semaphore that the reader thread blocks on.  Signaled when
-     * the reader pulls data from the ring buffer, or when the reader
-     * thread should exit. */
-    sem_t sf_reader_semaphore_storage;
+    /** The render thread, while the output is "started".  NULL if not
+     * running. */
+    pthread_t render_thread_storage;
+    pthread_t *render_thread;
 
-    /** How we refer to sf_reader_semaphore_storage.  Since it's a
-     * pointer, we can check it for NULLs. */
-    sem_t *sf_reader_semaphore;
+    /** Set by OutputStop_() to stop the render thread */
+    volatile BOOL render_should_exit;
 
-    /** If TRUE, the reader should exit when it wakes up.  Set by the
-     * calling thread. */
-    BOOL sf_reader_should_exit;
+    /** TRUE from OutputStart_() until the callback finishes or
+     * OutputStop_().  The offline counterpart of Pa_IsStreamActive(). */
+    volatile BOOL render_active;
 
-    /** The file currently being read.  TODO refactor for playlist support. */
-    SNDFILE *sf_fd;
+    /** One block of output, and the same as ints for libsndfile */
+    unsigned char *render_buf;
+    int *render_ints;
 
-    /* --- Playback buffer ---------------------------- */
+    /** Frames written so far, for the callbacks' timeInfo */
+    Au_FrameCount render_frames;
 
-    /** The ring buffer that is loaded by the reader thread.  Holds
-     * FRBuf structures. */
-    PaUtilRingBuffer sf_buffer_storage;
+    /** How many frames of the last buffer were real audio.  Callbacks
+     * set this when they return paComplete so the render thread can
+     * leave off the silence after the end. */
+    unsigned long render_valid_frames;
 
-    /** How we access the ring buffer */
-    PaUtilRingBuffer *sf_buffer;
+    /* --- File playback ------------------------------ */
 
-    /** The memory area where the ring buffer lives. */
-    void *sf_buffer_data;
+    /** The reader and ring buffer for Au_Play() and Au_Enqueue() */
+    Au_Stream stream;
 
-    /** The current time in the stream, if nonnegative. */
-    PaTime playback_time;
+    /* --- Playback clock ----------------------------- */
 
-    /** The time the stream started, if nonnegative. */
-    PaTime playback_start_time;
+    /** The playback clock is a seqlock: PAPlayCallback_() is the only
+     * writer, and increments this before and after each update.  It is
+     * odd while an update is in progress.  Readers retry until they
+     * see the same even value on both sides of their read.  See
+     * ClockPublish_() and ClockRead_(). */
+    volatile unsigned int clock_seq;
 
-    /** Whether or not a file is playing */
-    BOOL is_playing;
+    /** The position of the first frame of the most recent callback
+     * buffer, or negative if no buffer has been played yet. */
+    volatile Au_FrameCount clock_pos_frames;
 
-    /** The mutex protecting playback_time, playback_start_time,
-     * and is_playing. */
-    pthread_mutex_t playback_time_mutex_storage;
+    /** The number of frames in the most recent callback buffer */
+    volatile unsigned long clock_frames;
 
-    /** How we access playback_time_mutex_storage. */
-    pthread_mutex_t *playback_time_mutex;
+    /** When the first frame of that buffer will hit the DAC, as
+     * reported in timeInfo->outputBufferDacTime.  0 if unknown. */
+    volatile PaTime clock_dac_time;
 
-    /** The current frame count in the stream.  Not mutex-protected
-     * because it is only accessed by the SFFileReader_() thread. */
-    Au_FrameCount playback_frames;
+    /** Whether or not a file is playing.  Written only by the callback
+     * (and by Au_Play()/Au_Stop() while the stream is stopped). */
+    volatile BOOL is_playing;
+
+    /** TRUE between Au_Play() and Au_Stop(). */
+    BOOL clock_active;
+
+    /* --- Playback from memory ----------------------- */
+
+    /** The cached sample PASamplePlayCallback_() is playing, if any.
+     * Holds a reference, released by Au_Stop(). */
+    PAU_Sample sample;
+
+    /** The next frame of #sample to play.  Only accessed by the
+     * callback while the stream is running. */
+    Au_FrameCount sample_pos;
+
+    /** Seek requests for #sample, as for Au_Stream.seek_gen and
+     * Au_Stream.seek_frame.  sample_gen is the callback's copy of
+     * sample_seek_gen. */
+    volatile unsigned long sample_seek_gen;
+    volatile Au_FrameCount sample_seek_frame;
+    unsigned long sample_gen;
+
+    /* --- Mixer -------------------------------------- */
+
+    /** The voice slots, or NULL if the mixer isn't running.  There
+     * are twice #max_voices, so stolen voices can fade out while their
+     * replacements start. */
+    PAU_Voice voices;
+
+    /** How many slots #voices has */
+    int voice_slots;
+
+    /** The most voices that may play at once.  See Au_MixerStart(). */
+    int max_voices;
+
+    /** The serial number of the most recent voice */
+    long voice_serial;
+
+    /** Protects the control-thread side of #voices.  Never touched by
+     * the PortAudio callback. */
+    pthread_mutex_t mixer_mutex;
+
+    /** Frames mixed since Au_MixerStart().  Only accessed by the
+     * callback. */
+    Au_FrameCount mix_frames;
+
+    /** Callback scratch space: the float mix, one voice's chunk in
+     * float, and one voice's chunk in #format */
+    float *mix_accum, *mix_voice;
+    unsigned char *mix_raw;
+
+    /** The mixer's dither state, if #dither */
+    AuConv_Dither mix_dither;
+
+    /* --- Tones -------------------------------------- */
+
+    /** The oscillators PAToneCallback_() is playing, if any.  Freed by
+     * Au_Stop(). */
+    AuOscBank *tones;
+
+    /** Frames of tone still to play, or -1 to play until Au_Stop().
+     * Only accessed by the callback while the stream is running. */
+    Au_FrameCount tone_frames_left;
+
+    /** Frames played since Au_PlayTones().  Only accessed by the
+     * callback. */
+    Au_FrameCount tone_pos;
+
+    /** Callback scratch space: one chunk of the tones in float, unless
+     * #format is AUSF_F32 */
+    float *tone_float;
+
+    /** The tones' dither state, if #dither */
+    AuConv_Dither tone_dither;
+
+    /* --- Statistics --------------------------------- */
+
+    Au_StatCounters stats;
 
 } Au_Output;
 
@@ -212,47 +777,166 @@ typedef struct Au_Output {
     if(!pau) return FALSE;
 
 
+/** Add to, or read, a statistics counter in any thread */
+#define STAT_ADD_(counter, n) \
+    __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+#define STAT_GET_(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
 /* Globals ================================================================ */
 BOOL AuInitialized_ = FALSE;
 
+/** The threads that run every stream's reader.  Started by
+ * Au_Startup(). */
+static AuPool *ReaderPool_ = NULL;
+
+/** How Au_Startup() starts ReaderPool_.  See Au_SetReaderThreads(). */
+static int ReaderPoolThreads_ = 0;
+static int *ReaderPoolCpus_ = NULL;
+static int ReaderPoolNCpus_ = 0;
+
 /* Internal helpers ======================================================= */
 
-/** Get the size of a PortAudio buffer, in bytes.
+/** A monotonic time in nanoseconds, for timing things */
+static unsigned long long nowNs_(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* nowNs_ */
+
+/** Get the size of a single sample, in bytes.
  * @return The size, or -1 on error. */
-int bufferSizeBytes_(PAU pau)
+static int sampleSizeBytes_(Au_SampleFormat format)
 {
-    if(!pau) return -1;
-    int format_size;
-
-    switch(pau->format) {
-        case AUSF_F32: format_size = 4; break;
-        case AUSF_I32: format_size = 4; break;
-        case AUSF_I24: format_size = 3; /*TODO aligned?*/ break;
-        case AUSF_I16: format_size = 2; break;
-        case AUSF_I8: format_size = 1; break;
-        case AUSF_UI8: format_size = 1; break;
+    switch(format) {
+        case AUSF_F32: return 4;
+        case AUSF_I32: return 4;
+        case AUSF_I24: return 3;    /* packed */
+        case AUSF_I16: return 2;
+        case AUSF_I8: return 1;
+        case AUSF_UI8: return 1;
         case AUSF_CUSTOM: return -1;
                             /* TODO figure this out */
-                          break;
-        default: return -1; break;
+        default: return -1;
     }
+} /* sampleSizeBytes_ */
+
+/** Get the byte value that represents silence in #format. */
+static unsigned char silenceByte_(Au_SampleFormat format)
+{
+    return (format == AUSF_UI8) ? 0x80 : 0;
+} /* silenceByte_ */
+
+/** Get the size of a PortAudio buffer, in bytes.
+ * @return The size, or -1 on error. */
+int bufferSizeBytes_(PAU pau)
+{
+    if(!pau) return -1;
+    int format_size = sampleSizeBytes_(pau->format);
+    if(format_size < 0) return -1;
 
-    return PA_BUFFER_FRAMECOUNT * pau->channels * format_size;
+    return pau->block_frames * pau->channels * format_size;
 } /* bufferSizeBytes_ */
 
+/** Round #n up to a power of 2.  Returns 1 for n<=1. */
+static long roundUpPow2_(long n)
+{
+    long retval = 1;
+    while(retval < n) retval <<= 1;
+    return retval;
+} /* roundUpPow2_ */
+
+/** Greatest common divisor of two positive numbers */
+static long gcd_(long a, long b)
+{
+    long t;
+    while(b) { t = a % b; a = b; b = t; }
+    return a;
+} /* gcd_ */
+
+/* Playback clock ======================================================= */
+
+/** A consistent copy of the playback clock */
+typedef struct ClockSnapshot {
+    Au_FrameCount pos_frames;
+    unsigned long frames;
+    PaTime dac_time;
+    BOOL is_playing;
+} ClockSnapshot;
+
+/** Publish the playback clock.  Call only from the PortAudio callback.
+ * Lock-free and wait-free. */
+static void ClockPublish_(PAU pau, Au_FrameCount pos_frames,
+        unsigned long frames, PaTime dac_time, BOOL is_playing)
+{
+    ++pau->clock_seq;               /* now odd: update in progress */
+    PaUtil_WriteMemoryBarrier();
+    pau->clock_pos_frames = pos_frames;
+    pau->clock_frames = frames;
+    pau->clock_dac_time = dac_time;
+    pau->is_playing = is_playing;
+    PaUtil_WriteMemoryBarrier();
+    ++pau->clock_seq;               /* even again: done */
+} /* ClockPublish_ */
+
+/** Mark the output as not playing, leaving the position alone. */
+static void ClockStop_(PAU pau)
+{
+    ClockPublish_(pau, pau->clock_pos_frames, pau->clock_frames,
+            pau->clock_dac_time, FALSE);
+} /* ClockStop_ */
+
+/** Read the playback clock from any thread without locking.  Only
+ * retries if it races with a ClockPublish_() call, which is short. */
+static void ClockRead_(PAU pau, ClockSnapshot *snap)
+{
+    unsigned int seq;
+    do {
+        seq = pau->clock_seq;
+        PaUtil_ReadMemoryBarrier();
+        snap->pos_frames = pau->clock_pos_frames;
+        snap->frames = pau->clock_frames;
+        snap->dac_time = pau->clock_dac_time;
+        snap->is_playing = pau->is_playing;
+        PaUtil_ReadMemoryBarrier();
+    } while((seq & 1) || (seq != pau->clock_seq));
+} /* ClockRead_ */
+
+/** Reset the clock to "nothing played yet".  Only call while the
+ * stream is stopped. */
+static void ClockReset_(PAU pau)
+{
+    ClockPublish_(pau, -1, 0, 0, FALSE);
+} /* ClockReset_ */
+
 /* PortAudio callbacks ==================================================== */
 
 /** Main callback for all PortAudio streams.
  * The callback is a thunk to the actual callback, stored in pau.
+ * Also times it, for Au_GetStats().
  */
 static int PACallback_(const void *input, void *output,
     unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo,
     PaStreamCallbackFlags statusFlags, void *handle )
 {
+    unsigned long long start, us;
+    int result, bucket;
     POW_FAST
     Au_Userdata ud = {pau, pau->pa_callback_userdata};
-    return pau->pa_callback(input, output, frameCount, timeInfo,
+
+    start = nowNs_();
+    result = pau->pa_callback(input, output, frameCount, timeInfo,
             statusFlags, (void *)&ud);
+
+    /* Bucket 0 is under 1 us; bucket i is [2^(i-1), 2^i) us */
+    us = (nowNs_() - start) / 1000;
+    bucket = us ? 64 - __builtin_clzll(us) : 0;
+    if(bucket >= AU_STATS_HIST_BUCKETS) bucket = AU_STATS_HIST_BUCKETS - 1;
+    STAT_ADD_(pau->stats.callback_hist[bucket], 1);
+    STAT_ADD_(pau->stats.callbacks, 1);
+    STAT_ADD_(pau->stats.frames, frameCount);
+
+    return result;
 }
 
 static int PAEmptyCallback_(const void *input, void *output,
@@ -262,134 +946,2072 @@ static int PAEmptyCallback_(const void *input, void *output,
     return paComplete;      /* no audio */
 }
 
+/* Output sinks =========================================================== */
+
+/* An output is either a PortAudio stream or a file being rendered
+ * offline.  Code outside this section uses these functions rather than
+ * calling Pa_*Stream() on pau->pa_stream. */
+
+/** Write #frames frames of pau->render_buf to the render file.
+ * @return TRUE on success; FALSE on failure. */
+static BOOL RenderWrite_(PAU pau, sf_count_t frames)
+{
+    sf_count_t written;
+    size_t n = (size_t)frames * pau->channels;
+
+    if(frames <= 0 || !pau->render_fd) return TRUE;
+
+    if(pau->format == AUSF_F32) {
+        written = sf_writef_float(pau->render_fd, (float *)pau->render_buf,
+                                    frames);
+    } else if(pau->format == AUSF_I32) {
+        written = sf_writef_int(pau->render_fd, (int *)pau->render_buf,
+                                    frames);
+    } else {
+        /* Widening to I32 is exact, and libsndfile narrows it again
+         * by shifting, so the file matches the output bit for bit. */
+        AuConv_Convert(pau->format, pau->render_buf, AUSF_I32,
+                pau->render_ints, n, NULL);
+        written = sf_writef_int(pau->render_fd, pau->render_ints, frames);
+    }
+    return (written == frames);
+} /* RenderWrite_ */
+
+/** The offline counterpart of PortAudio's audio thread: calls the
+ * callback for block after block, as fast as it can, and writes each
+ * block to the render file. */
+static void *RenderThread_(void *handle)
+{
+    PAU pau = (PAU)handle;
+    PaStreamCallbackTimeInfo time_info;
+    int result = paContinue;
+
+    while(!pau->render_should_exit && result == paContinue) {
+        memset(&time_info, 0, sizeof(time_info));
+        time_info.currentTime = time_info.outputBufferDacTime =
+            (PaTime)pau->render_frames / pau->sample_rate;
+        pau->render_valid_frames = 0;
+
+        result = PACallback_(NULL, pau->render_buf, pau->block_frames,
+                            &time_info, 0, pau);
+
+        /* The last buffer ends with padding; leave it out */
+        if(!RenderWrite_(pau, (result == paContinue) ? pau->block_frames :
+                                pau->render_valid_frames)) {
+            ClockStop_(pau);    /* e.g., disk full */
+            break;
+        }
+        pau->render_frames += pau->block_frames;
+    }
+
+    pau->render_active = FALSE;
+    return 0;
+} /* RenderThread_ */
+
+/** Open #filename to render #pau's output to, instead of a device.
+ * If #filename is "", the output is thrown away.
+ * @param sf_format A libsndfile SF_FORMAT_* value, or 0 for WAV in
+ *          pau->format (unsigned for the 8-bit formats, since that's
+ *          all WAV has).
+ * @return TRUE on success; FALSE on failure. */
+static BOOL RenderOpen_(PAU pau, const char *filename, int sf_format)
+{
+    SF_INFO sf_info;
+
+    if(!sf_format) {
+        switch(pau->format) {
+            case AUSF_F32: sf_format = SF_FORMAT_WAV | SF_FORMAT_FLOAT; break;
+            case AUSF_I32: sf_format = SF_FORMAT_WAV | SF_FORMAT_PCM_32; break;
+            case AUSF_I24: sf_format = SF_FORMAT_WAV | SF_FORMAT_PCM_24; break;
+            case AUSF_I16: sf_format = SF_FORMAT_WAV | SF_FORMAT_PCM_16; break;
+            default: sf_format = SF_FORMAT_WAV | SF_FORMAT_PCM_U8; break;
+        }
+    }
+
+    if(!(pau->render_buf = (unsigned char *)malloc(
+            (size_t)pau->block_frames * pau->frame_bytes))) return FALSE;
+    if( (pau->format != AUSF_F32) && (pau->format != AUSF_I32) &&
+        !(pau->render_ints = (int *)malloc((size_t)pau->block_frames *
+                                pau->channels * sizeof(int))) ) {
+        return FALSE;
+    }
+
+    pau->render = TRUE;
+    if(!*filename) return TRUE;     /* null sink */
+
+    memset(&sf_info, 0, sizeof(sf_info));
+    sf_info.samplerate = pau->sample_rate;
+    sf_info.channels = pau->channels;
+    sf_info.format = sf_format;
+    pau->render_fd = sf_open(filename, SFM_WRITE, &sf_info);
+    return (pau->render_fd != NULL);
+} /* RenderOpen_ */
+
+/** Start calling pau->pa_callback.
+ * @return TRUE on success; FALSE on failure. */
+static BOOL OutputStart_(PAU pau)
+{
+    if(pau->pa_stream) {
+        return (Pa_StartStream(pau->pa_stream) == paNoError);
+    }
+    if(!pau->render || pau->render_thread) return FALSE;
+
+    pau->render_should_exit = FALSE;
+    pau->render_active = TRUE;
+    pau->render_thread = &pau->render_thread_storage;
+    if(pthread_create(pau->render_thread, NULL, RenderThread_, pau) != 0) {
+        pau->render_thread = NULL;
+        pau->render_active = FALSE;
+        return FALSE;
+    }
+    return TRUE;
+} /* OutputStart_ */
+
+/** Stop calling pau->pa_callback.  Safe to call if not started. */
+static void OutputStop_(PAU pau)
+{
+    if(pau->pa_stream) {
+        Pa_StopStream(pau->pa_stream);
+    } else if(pau->render_thread) {
+        pau->render_should_exit = TRUE;
+        pthread_join(*pau->render_thread, NULL);
+        pau->render_thread = NULL;
+        pau->render_active = FALSE;
+    }
+} /* OutputStop_ */
+
+/** Whether the callback is still being called, i.e., it hasn't
+ * returned paComplete and OutputStop_() hasn't been called. */
+static BOOL OutputIsActive_(PAU pau)
+{
+    if(pau->pa_stream) return (Pa_IsStreamActive(pau->pa_stream) == 1);
+    return pau->render_active;
+} /* OutputIsActive_ */
+
+/** Whether #pau has somewhere to send audio */
+static BOOL OutputIsOpen_(PAU pau)
+{
+    return (pau->pa_stream != NULL) || pau->render;
+} /* OutputIsOpen_ */
+
 /* libsndfile code ======================================================== */
 
-unsigned int AU_SFFR_Count = 0;    /* for debugging */
-/** The worker thread that reads data from a file. */
-static void *SFFileReader_(void *handle)
+/** Set up #sf_fd, just opened, for SFReadFrames_() to #format.  Once
+ * per file, since sf_command() isn't free. */
+static void SFPrepare_(SNDFILE *sf_fd, Au_SampleFormat format)
+{
+    /* sf_readf_int() clips float files at full scale rather than
+     * wrapping */
+    if(format == AUSF_I32) sf_command(sf_fd, SFC_SET_CLIPPING, NULL, SF_TRUE);
+} /* SFPrepare_ */
+
+/** Decode up to #frames frames from #sf_fd into #dest as #format, with
+ * a single libsndfile call.  libsndfile decodes to float, into
+ * #fstage, and then the whole lot is converted to #format at once.
+ * For AUSF_F32 and AUSF_I32, the data is decoded straight into #dest
+ * and #fstage isn't used: float only has 24 bits of mantissa, so going
+ * through it would drop the low 8 bits of 32-bit files.  #sf_fd must
+ * have been through SFPrepare_().
+ * @param fstage Room for #frames frames of floats.
+ * @param dither If non-NULL, dither when converting.
+ * @return The number of frames read, 0 at EOF, or -1 if the format is
+ *          not supported. */
+static sf_count_t SFReadFrames_(SNDFILE *sf_fd, Au_SampleFormat format,
+        int channels, void *dest, float *fstage, sf_count_t frames,
+        AuConv_Dither *dither)
+{
+    sf_count_t frames_read;
+
+    if(sampleSizeBytes_(format) < 0) return -1;
+    if(format == AUSF_F32) return sf_readf_float(sf_fd, (float *)dest, frames);
+    if(format == AUSF_I32) return sf_readf_int(sf_fd, (int *)dest, frames);
+
+    frames_read = sf_readf_float(sf_fd, fstage, frames);
+    if(frames_read > 0) {
+        AuConv_FromFloat(format, fstage, dest,
+                (size_t)frames_read * channels, dither);
+    }
+    return frames_read;
+} /* SFReadFrames_ */
+
+/** Get the #idx'th block of the write regions returned by
+ * AuRing_GetWriteRegions(). */
+static PFRBuf nthWriteBlock_(PAU_Stream pst, void *data1,
+        ring_buffer_size_t elems1, void *data2, ring_buffer_size_t idx)
+{
+    if(idx < elems1) {
+        return (PFRBuf)((unsigned char *)data1 + idx * pst->sf_elem_bytes);
+    }
+    return (PFRBuf)((unsigned char *)data2 +
+                        (idx - elems1) * pst->sf_elem_bytes);
+} /* nthWriteBlock_ */
+
+/** In adaptive mode, grow the read-ahead if the callback has come close
+ * to running dry since we last looked, or shrink it if playback has
+ * been stable for a while.  Called by the reader thread when it wakes
+ * up. */
+static void SFAdaptRingTarget_(PAU_Stream pst)
+{
+    unsigned long underruns = pst->near_underruns;
+
+    if(underruns != pst->adapt_seen_underruns) {
+        pst->adapt_seen_underruns = underruns;
+        pst->adapt_stable_blocks = 0;
+        if(pst->ring_target < pst->pau->ring_blocks) {
+            pst->ring_target *= 2;
+        }
+    } else if( (pst->adapt_stable_blocks >=
+                    pst->ring_target * AU_ADAPT_STABLE_RINGS) &&
+                (pst->ring_target > pst->pau->min_ring_blocks) ) {
+        pst->adapt_stable_blocks = 0;
+        pst->ring_target /= 2;
+    }
+} /* SFAdaptRingTarget_ */
+
+/** Get ready to read a new sf_fd at #rate: set up, reset or remove
+ * the resampler.
+ * @return TRUE on success; FALSE on failure. */
+static BOOL SFSetRate_(PAU_Stream pst, int rate)
+{
+    PAU pau = pst->pau;
+    long cap;
+
+    pst->sf_rate = rate;
+    pst->rs_in_pos = pst->rs_in_len = 0;
+    pst->rs_eof = FALSE;
+    pst->rs_in_total = pst->rs_out_total = 0;
+
+    if(rate == pau->sample_rate) {
+        AuRs_Delete(pst->resampler);
+        pst->resampler = NULL;
+        return TRUE;
+    }
+
+    /* Reuse the resampler if it is for the same rate.  It keeps its
+     * rate from the last file, even across plays (see StreamClose_()). */
+    if(pst->resampler && (pst->rs_rate == rate)) {
+        AuRs_Reset(pst->resampler);
+        return TRUE;
+    }
+
+    AuRs_Delete(pst->resampler);
+    pst->resampler = AuRs_New(rate, pau->sample_rate, pau->channels,
+                                pau->resample_quality);
+    if(!pst->resampler) return FALSE;
+    pst->rs_rate = rate;
+
+    cap = AU_RS_READ_FRAMES + AuRs_FlushFrames(pst->resampler);
+    if(cap > pst->rs_in_cap) {
+        free(pst->rs_in);
+        pst->rs_in_cap = 0;
+        if(!(pst->rs_in = (float *)malloc(
+                (size_t)cap * pau->channels * sizeof(float)))) return FALSE;
+        pst->rs_in_cap = cap;
+    }
+    return TRUE;
+} /* SFSetRate_ */
+
+/** Resample up to #frames frames from pst->sf_fd into #dest.
+ * @return The number of frames produced.  Less than #frames only at
+ *          EOF. */
+static sf_count_t SFResample_(PAU_Stream pst, float *dest, sf_count_t frames)
+{
+    PAU pau = pst->pau;
+    sf_count_t done = 0, limit, got;
+    size_t produced, used;
+
+    while(done < frames) {
+        /* Refill.  At EOF, add enough silence to get the rest out. */
+        if( (pst->rs_in_pos == pst->rs_in_len) && !pst->rs_eof ) {
+            got = sf_readf_float(pst->sf_fd, pst->rs_in, AU_RS_READ_FRAMES);
+            if(got < 0) got = 0;
+            pst->rs_in_pos = 0;
+            pst->rs_in_len = got;
+            pst->rs_in_total += got;
+            if(got < AU_RS_READ_FRAMES) {
+                memset(pst->rs_in + got * pau->channels, 0,
+                        AuRs_FlushFrames(pst->resampler) * pau->channels *
+                        sizeof(float));
+                pst->rs_in_len += AuRs_FlushFrames(pst->resampler);
+                pst->rs_eof = TRUE;
+            }
+        }
+
+        /* After EOF, stop at the exact length of the input */
+        limit = frames - done;
+        if(pst->rs_eof) {
+            got = (pst->rs_in_total * pau->sample_rate +
+                        pst->sf_rate - 1) / pst->sf_rate -
+                    pst->rs_out_total;
+            if(got < limit) limit = got;
+            if(limit <= 0) break;
+        }
+
+        produced = AuRs_Process(pst->resampler,
+                pst->rs_in + pst->rs_in_pos * pau->channels,
+                pst->rs_in_len - pst->rs_in_pos, &used,
+                dest + done * pau->channels, limit);
+        pst->rs_in_pos += used;
+        pst->rs_out_total += produced;
+        done += produced;
+        if( !produced && pst->rs_eof &&
+            (pst->rs_in_pos == pst->rs_in_len) ) {
+            break;
+        }
+    }
+
+    return done;
+} /* SFResample_ */
+
+/** Read up to #frames frames from pst->sf_fd, at the output's rate and
+ * in its format, into pst->sf_stage, and point pst->sf_out at them.
+ * @return The number of frames read, 0 at EOF, or -1 if the format is
+ *          not supported. */
+static sf_count_t SFReadStream_(PAU_Stream pst, sf_count_t frames)
+{
+    PAU pau = pst->pau;
+    AuConv_Dither *dither = pau->dither ? &pst->sf_dither : NULL;
+    float *fdest;
+    sf_count_t frames_read;
+
+    if(!pst->sf_fd && !pst->mem_data) return 0;     /* SFPipeOpen_() failed */
+
+    /* Raw PCM that's ready to go: no copy */
+    if(pst->mem_direct) {
+        frames_read = (pst->mem_len - pst->mem_pos) / pau->frame_bytes;
+        if(frames_read > frames) frames_read = frames;
+        pst->sf_out = pst->mem_data + pst->mem_pos;
+        pst->mem_pos += frames_read * pau->frame_bytes;
+        return frames_read;
+    }
+
+    pst->sf_out = pst->sf_stage;
+    if(!pst->resampler) {
+        return SFReadFrames_(pst->sf_fd, pau->format, pau->channels,
+                pst->sf_stage, pst->sf_float_stage, frames, dither);
+    }
+
+    if(sampleSizeBytes_(pau->format) < 0) return -1;
+    fdest = (pau->format == AUSF_F32) ? (float *)pst->sf_stage :
+                                        pst->sf_float_stage;
+    frames_read = SFResample_(pst, fdest, frames);
+    if( (frames_read > 0) && (pau->format != AUSF_F32) ) {
+        AuConv_FromFloat(pau->format, fdest, pst->sf_stage,
+                (size_t)frames_read * pau->channels, dither);
+    }
+    return frames_read;
+} /* SFReadStream_ */
+
+/** Change pst->eof_state from #from to #to, unless someone else has
+ * changed it first.
+ * @return TRUE if it was changed. */
+static BOOL EofSwap_(PAU_Stream pst, int from, int to)
+{
+    return __atomic_compare_exchange_n(&pst->eof_state, &from, to, FALSE,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+} /* EofSwap_ */
+
+/** Forget any PPPS_Stopped block in the ring, or held back, unless
+ * playback has already ended on it */
+static void EofReset_(PAU_Stream pst)
+{
+    if(!EofSwap_(pst, AUEOF_SENT, AUEOF_NONE) &&
+       !EofSwap_(pst, AUEOF_HELD, AUEOF_NONE)) {
+        EofSwap_(pst, AUEOF_REVOKED, AUEOF_NONE);
+    }
+} /* EofReset_ */
+
+/** Reposition pst->sf_fd so the next frame read is output frame
+ * #frame.  Called by the reader thread.  If #frame is past the end,
+ * the file ends at the next read. */
+static void SFSeek_(PAU_Stream pst, Au_FrameCount frame)
+{
+    PAU pau = pst->pau;
+    sf_count_t start = frame, out_start = frame, skip, n;
+    long g, step_in, step_out;
+    float *fstage;
+
+    if(pst->resampler) {
+        /* Start early enough to fill the filter, at an input frame
+         * that falls exactly on an output frame.  Then the filter
+         * phases match those of playing straight through, and so does
+         * the output. */
+        g = gcd_(pst->sf_rate, pau->sample_rate);
+        step_in = pst->sf_rate / g;
+        step_out = pau->sample_rate / g;
+        start = (sf_count_t)frame * pst->sf_rate / pau->sample_rate -
+                    AuRs_FlushFrames(pst->resampler);
+        if(start < 0) start = 0;
+        start = start / step_in * step_in;
+        out_start = start / step_in * step_out;
+    }
+
+    if(pst->mem_direct) {
+        skip = pst->mem_len / pau->frame_bytes;
+        if(frame > skip) frame = skip;
+        pst->mem_pos = (sf_count_t)frame * pau->frame_bytes;
+    } else if(sf_seek(pst->sf_fd, start, SEEK_SET) < 0) {
+        /* Probably past the end.  Go to the end, so the file finishes. */
+        start = sf_seek(pst->sf_fd, 0, SEEK_END);
+        if(start < 0) return;   /* not seekable - carry on */
+        out_start = frame = (start * pau->sample_rate + pst->sf_rate - 1) /
+                                pst->sf_rate;
+    }
+    pst->playback_frames = frame;
+
+    if(pst->resampler) {
+        AuRs_Reset(pst->resampler);
+        pst->rs_in_pos = pst->rs_in_len = 0;
+        pst->rs_eof = FALSE;
+        pst->rs_in_total = start;
+        pst->rs_out_total = out_start;
+
+        /* Decode and discard up to #frame */
+        fstage = (pau->format == AUSF_F32) ? (float *)pst->sf_stage :
+                                            pst->sf_float_stage;
+        for(skip = frame - out_start; skip > 0; skip -= n) {
+            n = pau->block_frames * pau->ring_blocks;
+            if(n > skip) n = skip;
+            if((n = SFResample_(pst, fstage, n)) <= 0) break;
+        }
+    }
+
+    /* There may be more to send now, even if we had sent it all.  The
+     * callback drops any PPPS_Stopped block in the ring as stale. */
+    pthread_mutex_lock(&pst->queue_mutex);
+    pst->sf_reader_at_eof = FALSE;
+    EofReset_(pst);
+    pthread_mutex_unlock(&pst->queue_mutex);
+} /* SFSeek_ */
+
+/** Close #fd and the AuFile it reads through, if any, and set both to
+ * NULL. */
+static void SFCloseFile_(SNDFILE **fd, AuFile **file)
+{
+    if(*fd) {
+        sf_close(*fd);
+        *fd = NULL;
+    }
+    AuFile_Close(*file);
+    *file = NULL;
+} /* SFCloseFile_ */
+
+/** Close #pst's current file or buffer.  A pipe's AuPipe stays open
+ * until StreamClose_(). */
+static void SFCloseSource_(PAU_Stream pst)
+{
+    SFCloseFile_(&pst->sf_fd, &pst->sf_file);
+    pst->sf_pipe_frame_bytes = pst->sf_pipe_slack = 0;
+    if(pst->mem_owned) free((void *)pst->mem_data);
+    pst->mem_data = NULL;
+    pst->mem_len = pst->mem_pos = 0;
+    pst->mem_owned = pst->mem_direct = FALSE;
+} /* SFCloseSource_ */
+
+/** Read pst->sf_pipe's header, now that it has arrived, and get ready
+ * to decode it.  If it's no good, the pipe counts as an empty source,
+ * so playback carries on with the queue, if any, or ends.  Called by
+ * the reader thread. */
+static void SFPipeOpen_(PAU_Stream pst)
+{
+    SF_INFO sf_info;
+    long sample_bytes;
+
+    pst->sf_pipe_opened = TRUE;
+    memset(&sf_info, 0, sizeof(sf_info));
+    pst->sf_fd = AuPipe_SfOpen(pst->sf_pipe, &sf_info);
+    if( pst->sf_fd &&
+        ( (sf_info.channels != pst->pau->channels) ||
+          !SFSetRate_(pst, sf_info.samplerate) ) ) {
+        sf_close(pst->sf_fd);
+        pst->sf_fd = NULL;
+    }
+    pst->sf_pipe_failed = (pst->sf_fd == NULL);
+    if(pst->sf_pipe_failed) return;
+    SFPrepare_(pst->sf_fd, pst->pau->format);
+
+    /* PCM is read exactly as asked.  Anything else, guess high. */
+    pst->sf_pipe_slack = 0;
+    switch(sf_info.format & SF_FORMAT_SUBMASK) {
+        case SF_FORMAT_PCM_S8:
+        case SF_FORMAT_PCM_U8:
+        case SF_FORMAT_ULAW:
+        case SF_FORMAT_ALAW: sample_bytes = 1; break;
+        case SF_FORMAT_PCM_16: sample_bytes = 2; break;
+        case SF_FORMAT_PCM_24: sample_bytes = 3; break;
+        case SF_FORMAT_PCM_32:
+        case SF_FORMAT_FLOAT: sample_bytes = 4; break;
+        case SF_FORMAT_DOUBLE: sample_bytes = 8; break;
+        default:
+            sample_bytes = 4;
+            pst->sf_pipe_slack = AU_PIPE_SLACK_BYTES;
+            break;
+    }
+    pst->sf_pipe_frame_bytes = sample_bytes * sf_info.channels;
+} /* SFPipeOpen_ */
+
+/** How many frames the reader can decode from pst->sf_pipe without
+ * waiting for the source, in whole blocks.  If that's less than a
+ * block, the pipe wakes the reader once a block's worth has arrived.
+ * Called by the reader thread.
+ * @return The frame count, or -1 if there's no limit: the source has
+ *          ended, or sf_fd isn't reading the pipe. */
+static sf_count_t SFPipeBudget_(PAU_Stream pst)
+{
+    PAU pau = pst->pau;
+    sf_count_t frames, lag = 0;
+    long avail, need;
+
+    if(!pst->sf_pipe_frame_bytes) return -1;
+
+    /* The resampler reads AU_RS_READ_FRAMES at a time, whatever it
+     * needs (SFResample_()) */
+    if(pst->resampler) lag = AU_RS_READ_FRAMES;
+
+    need = (long)(((sf_count_t)pau->block_frames * pst->sf_rate /
+                        pau->sample_rate + 1 + lag) *
+                    pst->sf_pipe_frame_bytes) + pst->sf_pipe_slack;
+    if(need > AU_PIPE_AHEAD_BYTES) need = AU_PIPE_AHEAD_BYTES;
+        /* so it will come.  Reads may then wait, but only briefly. */
+
+    avail = AuPipe_Available(pst->sf_pipe, need);
+    if(avail < 0) return -1;
+    if(avail < need) return 0;
+
+    frames = (avail - pst->sf_pipe_slack) / pst->sf_pipe_frame_bytes - lag;
+    if(pst->resampler) frames = frames * pau->sample_rate / pst->sf_rate;
+    if(frames < pau->block_frames) frames = pau->block_frames;
+    return frames / pau->block_frames * pau->block_frames;
+} /* SFPipeBudget_ */
+
+/** Open the next file in the queue, if any, as pst->sf_next_fd, so
+ * it is ready the moment the current file ends.  Files that can't be
+ * opened, or that don't have the output's channel count, are skipped.
+ * Called by the reader thread. */
+static void SFPreopenNext_(PAU_Stream pst)
+{
+    PAU_QueueEntry entry;
+    SF_INFO sf_info;
+
+    while(!pst->sf_next_fd) {
+        pthread_mutex_lock(&pst->queue_mutex);
+        entry = pst->queue_head;
+        if(entry) {
+            pst->queue_head = entry->next;
+            if(!pst->queue_head) pst->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&pst->queue_mutex);
+        if(!entry) return;
+
+        memset(&sf_info, 0, sizeof(sf_info));
+        pst->sf_next_fd = AuFile_SfOpen(entry->filename, &sf_info,
+                                &pst->pau->file_params, &pst->sf_next_file);
+        free(entry);
+
+        if( pst->sf_next_fd && (sf_info.channels != pst->pau->channels) ) {
+            SFCloseFile_(&pst->sf_next_fd, &pst->sf_next_file);
+        }
+        if(pst->sf_next_fd) SFPrepare_(pst->sf_next_fd, pst->pau->format);
+        pst->sf_next_rate = sf_info.samplerate;
+    }
+} /* SFPreopenNext_ */
+
+/** At the end of the current file, switch to the next one.
+ * @param can_stop If TRUE and there is no next file, set
+ *          pst->sf_reader_at_eof and AUEOF_SENT, and the caller sends
+ *          the PPPS_Stopped block.  Not if the callback has already
+ *          ended playback on a held block.  That is done under
+ *          queue_mutex so Au_Enqueue() knows whether to queue up
+ *          normally or to revoke the block.
+ * @return TRUE if there is a new current file. */
+static BOOL SFAdvanceFile_(PAU_Stream pst, BOOL can_stop)
+{
+    while(1) {
+        SFPreopenNext_(pst);
+        if(pst->sf_next_fd) {
+            SFCloseSource_(pst);
+            pst->sf_fd = pst->sf_next_fd;
+            pst->sf_file = pst->sf_next_file;
+            pst->sf_next_fd = NULL;
+            pst->sf_next_file = NULL;
+            pst->playback_frames = 0;   /* positions are per file */
+            if(!SFSetRate_(pst, pst->sf_next_rate)) continue;
+                /* out of memory - skip it */
+            return TRUE;
+        }
+
+        pthread_mutex_lock(&pst->queue_mutex);
+        if(pst->queue_head) {   /* enqueued since SFPreopenNext_ looked */
+            pthread_mutex_unlock(&pst->queue_mutex);
+            continue;
+        }
+        if( can_stop && ( EofSwap_(pst, AUEOF_NONE, AUEOF_SENT) ||
+                          EofSwap_(pst, AUEOF_HELD, AUEOF_SENT) ) ) {
+            pst->sf_reader_at_eof = TRUE;
+        }
+        pthread_mutex_unlock(&pst->queue_mutex);
+        return FALSE;
+    }
+} /* SFAdvanceFile_ */
+
+/** Split #frames frames from pst->sf_out into ring-buffer blocks,
+ * starting with the #idx'th claimed block.
+ * @return The index of the next unfilled block. */
+static ring_buffer_size_t SFFillBlocks_(PAU_Stream pst, void *data1,
+        ring_buffer_size_t elems1, void *data2, ring_buffer_size_t idx,
+        sf_count_t frames)
+{
+    sf_count_t nframes, done = 0;
+    PFRBuf pfr;
+    PAU pau = pst->pau;
+
+    while(done < frames) {
+        pfr = nthWriteBlock_(pst, data1, elems1, data2, idx++);
+        nframes = frames - done;
+        if(nframes > pau->block_frames) nframes = pau->block_frames;
+
+        pfr->state = PPPS_Playing;
+        pfr->gen = (uint32_t)pst->sf_gen;
+        pfr->pos_frames = pst->playback_frames;
+        pfr->frames = (uint16_t)nframes;
+        pst->playback_frames += nframes;
+        memcpy(pfr->data, pst->sf_out + done * pau->frame_bytes,
+                nframes * pau->frame_bytes);
+        done += nframes;
+    }
+
+    return idx;
+} /* SFFillBlocks_ */
+
+/** How urgently #task's stream needs reading: the fraction of its
+ * read-ahead that is in the ring, times 1024.  Emptiest first. */
+static long SFReaderUrgency_(AuPoolTask *task)
+{
+    PAU_Stream pst = (PAU_Stream)task->arg;
+    long target = pst->ring_target;
+    if(target <= 0) return 0;
+    return (long)AuRing_ReadAvailable(pst->sf_buffer) *
+            1024 / target;
+} /* SFReaderUrgency_ */
+
+/** Whether the reader should send the PPPS_Stopped block now that the
+ * last file has ended, with #nblocks more blocks about to be
+ * published.  It holds the block back while the ring is above the low
+ * watermark, so an Au_Enqueue() in the meantime still joins this ring
+ * without a gap.  The callback wakes the reader at the watermark,
+ * which sends it then; if the reader is late, the callback ends
+ * playback on AUEOF_HELD instead of reporting an underrun.  The reader
+ * doesn't hold back while the callback is waiting for more prefill
+ * than there will ever be, and it waits for a revoked block to be
+ * skipped, so there's only ever one. */
+static BOOL SFReaderMayStop_(PAU_Stream pst, ring_buffer_size_t nblocks)
+{
+    PAU pau = pst->pau;
+    ring_buffer_size_t queued, prefill;
+
+    int state = __atomic_load_n(&pst->eof_state, __ATOMIC_ACQUIRE);
+
+    if(state != AUEOF_NONE && state != AUEOF_HELD) return FALSE;
+
+    queued = AuRing_ReadAvailable(pst->sf_buffer) + nblocks;
+    prefill = pau->prefill_blocks;
+    if(prefill > pst->ring_target) prefill = pst->ring_target;
+    return (queued * AU_WAKE_LOW_FRACTION <= pst->ring_target) ||
+            (queued < prefill);
+} /* SFReaderMayStop_ */
+
+/** Have #pst's reader run soon, unless it is already due to.  Any
+ * thread, including the PortAudio callback.  Never blocks. */
+static void StreamWakeReader_(PAU_Stream pst)
+{
+    AuPool_Signal(ReaderPool_, &pst->sf_task);
+} /* StreamWakeReader_ */
+
+/** The reader, which reads data from a file into an Au_Stream, until
+ * there are #target blocks in the ring.  Runs on a ReaderPool_ worker
+ * each time the stream is signaled (SFReaderRun_()), and once on the
+ * opening thread to pre-roll.  Each run claims every free slot in the
+ * ring buffer up to #target, decodes enough frames for all of them
+ * with one libsndfile call into pst->sf_stage, splits the result into
+ * FRBufs, and publishes them all with one write-index advance.
+ *
+ * When a file ends, the reader carries on with the next file in the
+ * queue in the same pass, so there is no gap between them.  A block
+ * never spans two files: the last block of a file may be short. */
+static void SFReaderFill_(PAU_Stream pst, ring_buffer_size_t target)
+{
+    PAU pau = pst->pau;
+    if(pau->format == AUSF_CUSTOM) {
+        return;    /* TODO */
+    }
+    if(pst->sf_reader_failed) return;
+
+    void *data1, *data2;
+    ring_buffer_size_t buffers_avail, elems1, elems2, nblocks, nbefore;
+    long avail;
+    sf_count_t frames_read, frames_wanted;
+    unsigned long gen;
+    unsigned long long start;
+    PFRBuf pfr;
+    BOOL held = FALSE;
+    sf_count_t pipe_frames;
+
+    /* Au_Seek().  The callback throws away blocks sent before this, so
+     * just carry on from the new position. */
+    gen = pst->seek_gen;
+    if(gen != pst->sf_gen) {
+        PaUtil_ReadMemoryBarrier();
+        pst->sf_gen = gen;
+        SFSeek_(pst, pst->seek_frame);
+    }
+
+    if(pst->sf_reader_at_eof) return;   /* nothing more to send */
+
+    /* Don't make a worker wait on a pipe: read the header once it has
+     * arrived, and then only decode what has arrived.  The pipe wakes
+     * us when there is more. */
+    if(pst->sf_pipe && !pst->sf_pipe_opened) {
+        avail = AuPipe_Available(pst->sf_pipe, AU_PIPE_HEADER_BYTES);
+        if(avail >= 0 && avail < AU_PIPE_HEADER_BYTES) return;
+        SFPipeOpen_(pst);
+    }
+    if(!(pipe_frames = SFPipeBudget_(pst))) return;
+
+    SFPreopenNext_(pst);
+    if(pau->adaptive) SFAdaptRingTarget_(pst);
+
+    /* Claim every free slot at once, up to #target.  data2/elems2 are
+     * nonempty if the free space wraps around the end of the ring. */
+    buffers_avail = target -
+            AuRing_ReadAvailable(pst->sf_buffer);
+    if( (pipe_frames > 0) &&
+        (buffers_avail > pipe_frames / pau->block_frames) ) {
+        buffers_avail = pipe_frames / pau->block_frames;
+    }
+    if(buffers_avail <= 0) return;
+    buffers_avail = AuRing_GetWriteRegions(pst->sf_buffer,
+            buffers_avail, &data1, &elems1, &data2, &elems2);
+    if(buffers_avail <= 0) return;
+
+    nblocks = 0;
+    while(nblocks < buffers_avail) {
+        /* One read for all the remaining blocks (several, if
+         * resampling) */
+        frames_wanted = (sf_count_t)(buffers_avail - nblocks) *
+                            pau->block_frames;
+        start = nowNs_();
+        frames_read = SFReadStream_(pst, frames_wanted);
+        if(frames_read < 0) {
+            pst->sf_reader_failed = TRUE;
+            return;
+        }
+
+        nbefore = nblocks;
+        nblocks = SFFillBlocks_(pst, data1, elems1, data2, nblocks,
+                                frames_read);
+        STAT_ADD_(pau->stats.decode_ns, nowNs_() - start);
+        STAT_ADD_(pau->stats.decode_blocks, nblocks - nbefore);
+        if(frames_read == frames_wanted) break;
+
+        /* A short read means EOF.  Keep going with the next file, if
+         * any.  Otherwise, follow the last block with a PPPS_Stopped
+         * block, if there is room and it's time (SFReaderMayStop_()).
+         * If not, we will read 0 frames next time, and try again
+         * then. */
+        if(SFAdvanceFile_(pst, (nblocks < buffers_avail) &&
+                                SFReaderMayStop_(pst, nblocks))) {
+            continue;
+        }
+
+        if(pst->sf_reader_at_eof) {     /* Report EOF */
+            pfr = nthWriteBlock_(pst, data1, elems1, data2, nblocks++);
+            pfr->state = PPPS_Stopped;
+            pfr->gen = (uint32_t)pst->sf_gen;
+            pfr->pos_frames = pst->playback_frames;
+            pfr->frames = 0;
+        } else {
+            held = TRUE;
+        }
+        break;
+    } /* while blocks to fill */
+
+    /* Send the blocks to the PortAudio callback */
+    pfr = NULL;
+    AuRing_AdvanceWriteIndex(pst->sf_buffer, nblocks);
+    pst->adapt_stable_blocks += nblocks;
+
+    /* Now that the callback has everything, let it end playback if it
+     * runs dry before the PPPS_Stopped block comes.  Not if a file was
+     * queued since we looked. */
+    if(held) {
+        pthread_mutex_lock(&pst->queue_mutex);
+        if(!pst->queue_head) EofSwap_(pst, AUEOF_NONE, AUEOF_HELD);
+        pthread_mutex_unlock(&pst->queue_mutex);
+    }
+
+    /* If the pipe held us back, have it wake us when there's more.  If
+     * there already is, go again.  (If the source has ended since, the
+     * pipe has woken us already.) */
+    if( (pipe_frames > 0) && !held &&
+        (AuRing_ReadAvailable(pst->sf_buffer) < target) &&
+        (SFPipeBudget_(pst) > 0) ) {
+        StreamWakeReader_(pst);
+    }
+} /* SFReaderFill_ */
+
+/** The reader's AuPoolTask: fill #pst's ring up to the current
+ * read-ahead. */
+static void SFReaderRun_(AuPoolTask *task)
+{
+    PAU_Stream pst = (PAU_Stream)task->arg;
+
+    STAT_ADD_(pst->pau->stats.reader_wakeups, 1);
+    SFReaderFill_(pst, pst->ring_target);
+} /* SFReaderRun_ */
+
+/* Memory sources ========================================================= */
+
+/* libsndfile virtual I/O over Au_Stream.mem_data, for Au_PlayMemory() */
+
+static sf_count_t MemGetLen_(void *user_data)
+{
+    return ((PAU_Stream)user_data)->mem_len;
+} /* MemGetLen_ */
+
+static sf_count_t MemSeek_(sf_count_t offset, int whence, void *user_data)
+{
+    PAU_Stream pst = (PAU_Stream)user_data;
+    sf_count_t pos;
+
+    switch(whence) {
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = pst->mem_pos + offset; break;
+        case SEEK_END: pos = pst->mem_len + offset; break;
+        default: return -1;
+    }
+    if(pos < 0 || pos > pst->mem_len) return -1;
+    pst->mem_pos = pos;
+    return pos;
+} /* MemSeek_ */
+
+static sf_count_t MemRead_(void *ptr, sf_count_t count, void *user_data)
+{
+    PAU_Stream pst = (PAU_Stream)user_data;
+    if(count > pst->mem_len - pst->mem_pos) {
+        count = pst->mem_len - pst->mem_pos;
+    }
+    memcpy(ptr, pst->mem_data + pst->mem_pos, count);
+    pst->mem_pos += count;
+    return count;
+} /* MemRead_ */
+
+static sf_count_t MemWrite_(const void *ptr, sf_count_t count,
+        void *user_data)
+{
+    UNUSED(ptr);
+    UNUSED(count);
+    UNUSED(user_data);
+    return 0;   /* read-only */
+} /* MemWrite_ */
+
+static sf_count_t MemTell_(void *user_data)
+{
+    return ((PAU_Stream)user_data)->mem_pos;
+} /* MemTell_ */
+
+static SF_VIRTUAL_IO MemVirtualIO_ = {
+    MemGetLen_, MemSeek_, MemRead_, MemWrite_, MemTell_
+};
+
+/** The libsndfile format of headerless samples in #format, as
+ * Au_PlayMemoryRaw() takes them, or 0 if there isn't one. */
+static int sfRawFormat_(Au_SampleFormat format)
+{
+    switch(format) {
+        case AUSF_F32: return SF_FORMAT_RAW | SF_FORMAT_FLOAT | SF_ENDIAN_CPU;
+        case AUSF_I32: return SF_FORMAT_RAW | SF_FORMAT_PCM_32 | SF_ENDIAN_CPU;
+        case AUSF_I24:  /* always packed little-endian - see au_convert.h */
+            return SF_FORMAT_RAW | SF_FORMAT_PCM_24 | SF_ENDIAN_LITTLE;
+        case AUSF_I16: return SF_FORMAT_RAW | SF_FORMAT_PCM_16 | SF_ENDIAN_CPU;
+        case AUSF_I8: return SF_FORMAT_RAW | SF_FORMAT_PCM_S8;
+        case AUSF_UI8: return SF_FORMAT_RAW | SF_FORMAT_PCM_U8;
+        default: return 0;
+    }
+} /* sfRawFormat_ */
+
+/* Streams ================================================================ */
+
+/** What a stream plays: a file, a buffer in memory, or a pipe.  Filled
+ * in by Au_Play() and friends for StreamOpenSource_(). */
+typedef struct Au_Source {
+    /** The file to play, or NULL to play #data, #fd, or #read */
+    const char *filename;
+
+    /** A file descriptor to read through an AuPipe, or -1 */
+    int fd;
+    BOOL close_fd;
+
+    /** A function to read through an AuPipe, or NULL */
+    Au_ReadCallback read;
+    void *read_data;
+
+    /** #len bytes holding a whole file, or raw PCM if #raw */
+    const void *data;
+    size_t len;
+
+    /** Whether the stream should free(#data) once it's done */
+    BOOL owned;
+
+    /** If TRUE, #data is headerless PCM in #raw_format at #raw_rate,
+     * with the output's channel count. */
+    BOOL raw;
+    Au_SampleFormat raw_format;
+    int raw_rate;
+} Au_Source;
+
+/** AuPipe_NotifyFn for a stream's pipe: there is data to decode */
+static void StreamPipeNotify_(void *arg)
+{
+    PAU_Stream pst = (PAU_Stream)arg;
+    if(__atomic_load_n(&pst->sf_reader_active, __ATOMIC_ACQUIRE)) {
+        StreamWakeReader_(pst);
+    }
+} /* StreamPipeNotify_ */
+
+/** Set up #pst, which belongs to #pau, before its first StreamOpen_().
+ * @return TRUE on success; FALSE on failure. */
+static BOOL StreamInit_(PAU pau, PAU_Stream pst)
+{
+    memset(pst, 0, sizeof(Au_Stream));
+    pst->pau = pau;
+    return (0 == pthread_mutex_init(&pst->queue_mutex, NULL));
+} /* StreamInit_ */
+
+/** Undo StreamInit_(), and free the buffers StreamOpen_() keeps for
+ * next time.  Call StreamClose_() first. */
+static void StreamDestroy_(PAU_Stream pst)
+{
+    AuRing_FreeMemory(&pst->sf_buffer_mem);
+    free(pst->sf_stage);
+    free(pst->sf_float_stage);
+    AuRs_Delete(pst->resampler);
+    free(pst->rs_in);
+    pthread_mutex_destroy(&pst->queue_mutex);
+} /* StreamDestroy_ */
+
+/** Open #src and start the reader filling #pst's ring buffer from it.
+ * On failure, call StreamClose_() to clean up.  That won't free
+ * src->data even if src->owned.
+ * @return TRUE on success; FALSE on failure. */
+static BOOL StreamOpenSource_(PAU_Stream pst, const Au_Source *src)
+{
+    PAU pau = pst->pau;
+    ring_buffer_size_t preroll;
+
+    pst->play_start_ns = nowNs_();
+
+    /* sf_fd */
+    SF_INFO sf_info;
+    memset(&sf_info, 0, sizeof(sf_info));
+    if(src->filename) {
+        pst->sf_fd = AuFile_SfOpen(src->filename, &sf_info,
+                                    &pau->file_params, &pst->sf_file);
+        if(!pst->sf_fd) return FALSE;
+        SFPrepare_(pst->sf_fd, pau->format);
+
+    } else if(src->fd >= 0 || src->read) {
+        /* The reader reads the header once it arrives (SFPipeOpen_()),
+         * so a slow source doesn't hold up the caller, and Au_Stop()
+         * can give up on it. */
+        pst->sf_pipe = (src->fd >= 0) ?
+                AuPipe_OpenFd(src->fd, src->close_fd,
+                                StreamPipeNotify_, pst) :
+                AuPipe_OpenCallback(src->read, src->read_data,
+                                StreamPipeNotify_, pst);
+        if(!pst->sf_pipe) return FALSE;
+        pst->sf_pipe_opened = pst->sf_pipe_failed = FALSE;
+        sf_info.channels = pau->channels;
+        sf_info.samplerate = pau->sample_rate;
+
+    } else {
+        pst->mem_data = (const unsigned char *)src->data;
+        pst->mem_len = (sf_count_t)src->len;
+        pst->mem_pos = 0;
+        if(src->raw) {
+            sf_info.samplerate = src->raw_rate;
+            sf_info.channels = pau->channels;
+            sf_info.format = sfRawFormat_(src->raw_format);
+            if(!sf_info.format) return FALSE;
+            pst->mem_direct = (src->raw_format == pau->format) &&
+                                (src->raw_rate == pau->sample_rate);
+        }
+        if(!pst->mem_direct) {
+            pst->sf_fd = sf_open_virtual(&MemVirtualIO_, SFM_READ, &sf_info,
+                                            pst);
+            if(!pst->sf_fd) return FALSE;
+            SFPrepare_(pst->sf_fd, pau->format);
+        }
+    }
+
+    /* Sanity check.  For a pipe, SFPipeOpen_() checks again once it
+     * knows. */
+    if(sf_info.channels != pau->channels) return FALSE;
+    if(!SFSetRate_(pst, sf_info.samplerate)) return FALSE;
+
+    pst->playback_frames = 0;
+    pst->play_block_offset = 0;
+    pst->play_waiting = TRUE;
+    pst->sf_gen = pst->play_gen = pst->seek_gen;
+
+    /* Ring buffer */
+    int bufbytes = bufferSizeBytes_(pau);
+    if(bufbytes == -1) return FALSE;
+
+    pst->sf_reader_at_eof = FALSE;
+    pst->eof_state = AUEOF_NONE;
+    if( !pst->sf_stage && ((pst->sf_stage =
+                malloc((size_t)bufbytes * pau->ring_blocks)) == NULL) ) {
+        return FALSE;
+    }
+    if( (pau->format != AUSF_F32) && !pst->sf_float_stage &&
+        ((pst->sf_float_stage = (float *)malloc((size_t)pau->block_frames *
+                pau->ring_blocks * pau->channels * sizeof(float))) == NULL) ) {
+        return FALSE;
+    }
+    AuConv_DitherInit(&pst->sf_dither, (unsigned int)(size_t)pst);
+
+    /* Each element holds exactly one block of this file's channels
+     * and our sample format, packed back to back.  The reader and the
+     * callback are normally several blocks apart, so sharing a cache
+     * line at the boundary costs less than padding every block out to
+     * whole lines would. */
+    pst->sf_elem_bytes = offsetof(FRBuf, data) + bufbytes;
+    pst->sf_elem_bytes = (pst->sf_elem_bytes + AU_FRBUF_ALIGN - 1)
+        & ~(long)(AU_FRBUF_ALIGN - 1);
+
+    if( !pst->sf_buffer_mem.data &&
+        !AuRing_AllocMemory(&pst->sf_buffer_mem,
+                (size_t)pst->sf_elem_bytes * pau->ring_blocks,
+                pau->ring_mem_flags) ) {
+        return FALSE;
+    }
+    pst->sf_buffer = &pst->sf_buffer_storage;
+    if(-1 == AuRing_Init(pst->sf_buffer, pst->sf_elem_bytes,
+                pau->ring_blocks, pst->sf_buffer_mem.data)) {
+        return FALSE;
+    }
+
+    pst->ring_target = pau->adaptive ? pau->min_ring_blocks :
+                                        pau->ring_blocks;
+    pst->near_underruns = pst->adapt_seen_underruns = 0;
+    pst->adapt_stable_blocks = 0;
+
+    /* Reader.  Pre-roll: decode the prefill here and now, so the first
+     * callback has audio to play rather than waiting for a worker.
+     * Then let a worker fill the rest.  From here on, the reader may be
+     * done with src->data at any time. */
+    if(!ReaderPool_) return FALSE;
+    pst->mem_owned = src->owned && pst->mem_data;
+    AuPoolTask_Init(&pst->sf_task, SFReaderRun_, SFReaderUrgency_, pst);
+    pst->sf_reader_failed = FALSE;
+    preroll = pau->prefill_blocks;
+    if(preroll > pst->ring_target) preroll = pst->ring_target;
+    SFReaderFill_(pst, preroll);
+    __atomic_store_n(&pst->sf_reader_active, TRUE, __ATOMIC_RELEASE);
+    StreamWakeReader_(pst);
+
+    return TRUE;
+} /* StreamOpenSource_ */
+
+/** Open #filename and start the reader filling #pst's ring buffer
+ * from it.  On failure, call StreamClose_() to clean up.
+ * @return TRUE on success; FALSE on failure. */
+static BOOL StreamOpen_(PAU_Stream pst, const char *filename)
+{
+    Au_Source src;
+    memset(&src, 0, sizeof(src));
+    src.fd = -1;
+    src.filename = filename;
+    return StreamOpenSource_(pst, &src);
+} /* StreamOpen_ */
+
+/** Stop #pst's reader and free everything StreamOpen_()
+ * allocated.  The callback must no longer be reading from #pst.  Safe
+ * to call on a stream that isn't open. */
+static void StreamClose_(PAU_Stream pst)
+{
+    /* Stop the pipe first: that ends any read the reader is waiting on,
+     * and its thread stops signaling the reader. */
+    if(pst->sf_pipe) AuPipe_Stop(pst->sf_pipe);
+
+    if(pst->sf_reader_active) {
+        /* Wait for the reader to finish, if it's running, and make sure
+         * it doesn't run again */
+        AuPool_Cancel(ReaderPool_, &pst->sf_task);
+        __atomic_store_n(&pst->sf_reader_active, FALSE, __ATOMIC_RELEASE);
+    }
+
+    /* The ring's storage, the stages and the resampler are kept for
+     * the next StreamOpen_(). */
+    if(pst->sf_buffer) {
+        AuRing_Flush(pst->sf_buffer);
+        pst->sf_buffer = NULL;
+    }
+    pst->play_start_ns = 0;
+
+    SFCloseSource_(pst);
+    SFCloseFile_(&pst->sf_next_fd, &pst->sf_next_file);
+    AuPipe_Close(pst->sf_pipe);
+    pst->sf_pipe = NULL;
+
+    /* Empty the queue.  The reader is gone, so no lock needed. */
+    while(pst->queue_head) {
+        PAU_QueueEntry entry = pst->queue_head;
+        pst->queue_head = entry->next;
+        free(entry);
+    }
+    pst->queue_tail = NULL;
+    pst->play_block_offset = 0;
+} /* StreamClose_ */
+
+/** Copy up to #frames frames from #pst's ring buffer to #out, starting
+ * partway through the current block if the last call didn't use all
+ * of it.  While pst->play_waiting, copies nothing until there is
+ * enough read-ahead.  Call only from the PortAudio callback.  Never
+ * blocks, except when rendering offline.
+ * @param clock_pos Set to the file position of the first frame copied,
+ *          or -1 if none were.
+ * @param ended Set to TRUE if the reader has sent its last block.
+ * @return The number of frames copied.  Less than #frames if the
+ *          stream ended or the ring ran dry. */
+static unsigned long StreamRead_(PAU_Stream pst, unsigned char *out,
+        unsigned long frames, Au_FrameCount *clock_pos, BOOL *ended)
+{
+    void *data1, *data2;
+    ring_buffer_size_t elems1, elems2, ok;
+    unsigned long frames_left = frames, gen;
+    unsigned long long start_ns;
+    Au_FrameCount nframes;
+    BOOL skipped = FALSE, waiting = FALSE;
+    PFRBuf pfr;
+    PAU pau = pst->pau;
+
+    *clock_pos = -1;
+    *ended = FALSE;
+
+    /* After an Au_Seek(), the block we were partway through is stale,
+     * along with everything else already in the ring. */
+    gen = pst->seek_gen;
+    if(gen != pst->play_gen) {
+        pst->play_gen = gen;
+        pst->play_block_offset = 0;
+        pst->play_waiting = TRUE;
+    }
+
+    /* Wait for the prefill watermark before starting or resuming.  No
+     * need offline, since we wait for the reader anyway.  Blocks from
+     * before a seek don't count, so drop them first. */
+    if(pst->play_waiting && !pau->render) {
+        while( (AuRing_GetReadRegions(pst->sf_buffer, 1,
+                    &data1, &elems1, &data2, &elems2) > 0) &&
+                (((PFRBuf)data1)->gen != (uint32_t)pst->play_gen) ) {
+            AuRing_AdvanceReadIndex(pst->sf_buffer, 1);
+            skipped = TRUE;
+        }
+        ok = pau->prefill_blocks;
+        if(ok > pst->ring_target) ok = pst->ring_target;
+        if( (AuRing_ReadAvailable(pst->sf_buffer) < ok) &&
+            !pst->sf_reader_at_eof ) {
+            StreamWakeReader_(pst);
+            return 0;
+        }
+    }
+
+    /* How much read-ahead there is, once playback is under way */
+    if(!pst->play_waiting) {
+        ok = AuRing_ReadAvailable(pst->sf_buffer);
+        STAT_ADD_(pau->stats.fill_samples, 1);
+        STAT_ADD_(pau->stats.fill_sum, ok);
+        if( (pau->stats.fill_min < 0) || (ok < pau->stats.fill_min) ) {
+            __atomic_store_n(&pau->stats.fill_min, ok, __ATOMIC_RELAXED);
+        }
+    }
+
+    while(frames_left > 0) {
+        ok = AuRing_GetReadRegions(pst->sf_buffer, 1,
+                        &data1, &elems1, &data2, &elems2);
+        if(ok <= 0 || elems1 <= 0) {        /* no data ready */
+            /* That's all there is, if the reader is holding back the
+             * PPPS_Stopped block */
+            if(EofSwap_(pst, AUEOF_HELD, AUEOF_TAKEN)) {
+                *ended = TRUE;
+                break;
+            }
+            if(!pau->render || pau->render_should_exit) break;
+            /* Offline, there's no deadline, so wait for the reader
+             * rather than output silence. */
+            if(!waiting) StreamWakeReader_(pst);
+            waiting = TRUE;
+            sched_yield();
+            continue;
+        }
+        waiting = FALSE;
+
+        pfr = (PFRBuf)data1;
+        if(pfr->gen != (uint32_t)pst->play_gen) {     /* from before a seek */
+            pfr = NULL;
+            AuRing_AdvanceReadIndex(pst->sf_buffer, 1);
+            skipped = TRUE;
+            continue;
+        }
+        pst->play_waiting = FALSE;
+        if(pst->play_start_ns) {        /* time to first sample */
+            start_ns = nowNs_() - pst->play_start_ns;
+            STAT_ADD_(pau->stats.first_samples, 1);
+            STAT_ADD_(pau->stats.first_sample_ns, start_ns);
+            __atomic_store_n(&pau->stats.first_sample_last_ns, start_ns,
+                                __ATOMIC_RELAXED);
+            pst->play_start_ns = 0;
+        }
+
+        if(pfr->state == PPPS_Stopped) {
+            pfr = NULL;
+            AuRing_AdvanceReadIndex(pst->sf_buffer, 1);
+            pst->play_block_offset = 0;
+            if(EofSwap_(pst, AUEOF_SENT, AUEOF_TAKEN)) {
+                *ended = TRUE;
+                break;
+            }
+            /* Au_Enqueue() got in first: there's more to come */
+            EofSwap_(pst, AUEOF_REVOKED, AUEOF_NONE);
+            skipped = TRUE;
+            continue;
+        }
+
+        if(*clock_pos < 0) {
+            *clock_pos = pfr->pos_frames + pst->play_block_offset;
+        }
+
+        nframes = pfr->frames - pst->play_block_offset;
+        if(nframes > (Au_FrameCount)frames_left) nframes = frames_left;
+
+        /* Output the data */
+        memcpy(out, pfr->data + pst->play_block_offset * pau->frame_bytes,
+                nframes * pau->frame_bytes);
+        out += nframes * pau->frame_bytes;
+        frames_left -= nframes;
+        pst->play_block_offset += nframes;
+
+        /* Release the info block if we've used all of it */
+        if(pst->play_block_offset >= pfr->frames) {
+            pfr = NULL; /* because it's invalid once we advance the read index */
+            AuRing_AdvanceReadIndex(pst->sf_buffer, 1);
+            pst->play_block_offset = 0;
+        }
+    } /* while frames_left */
+
+    /* Ran dry partway through.  Unless that stops playback, build up
+     * the read-ahead again before resuming, so a stall makes one gap
+     * rather than a stutter. */
+    if( (frames_left > 0) && !*ended && !pst->play_waiting ) {
+        STAT_ADD_(pau->stats.underruns, 1);
+        if(pau->adaptive) ++pst->near_underruns;
+        if(pau->underrun_policy == AUUP_CONTINUE) pst->play_waiting = TRUE;
+    }
+
+    /* Tell the reader if we came close to running dry */
+    ok = AuRing_ReadAvailable(pst->sf_buffer);
+    if(pau->adaptive && frames_left == 0 &&
+            (ok * AU_ADAPT_LOW_FRACTION < pst->ring_target)) {
+        ++pst->near_underruns;
+    }
+
+    /* Let the reader get working on more data, but only once the ring
+     * is down to the low watermark, or if we're waiting on it.  It
+     * refills all the way, so this is one wakeup per several blocks
+     * rather than one per callback. */
+    if( skipped || pst->play_waiting ||
+        (ok * AU_WAKE_LOW_FRACTION <= pst->ring_target) ) {
+        StreamWakeReader_(pst);
+    }
+
+    return frames - frames_left;
+} /* StreamRead_ */
+
+/* Decoded-sample cache =================================================== */
+
+/** The default for Au_SampleSetCacheBudget() */
+#define AU_SAMPLE_CACHE_DEFAULT_BYTES (64UL*1024*1024)
+
+/** How many frames SampleDecode_() decodes at a time */
+#define AU_SAMPLE_DECODE_FRAMES (4096)
+
+/** How many hash buckets the cache has.  A power of two. */
+#define AU_SAMPLE_CACHE_BUCKETS (256)
+
+/** Protects everything below, and Au_Sample.refs. */
+static pthread_mutex_t SampleCacheMutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+/** The LRU list: most recently used first */
+static PAU_Sample SampleCacheHead_ = NULL, SampleCacheTail_ = NULL;
+
+/** The same samples, hashed by SampleHash_() */
+static PAU_Sample SampleCacheBuckets_[AU_SAMPLE_CACHE_BUCKETS];
+
+/** How much decoded data is in the cache */
+static size_t SampleCacheBytes_ = 0;
+
+/** How much decoded data the cache may hold before it evicts */
+static size_t SampleCacheBudget_ = AU_SAMPLE_CACHE_DEFAULT_BYTES;
+
+/** Remove #ps from the LRU list.  Call with SampleCacheMutex_ held. */
+static void SampleUnlink_(PAU_Sample ps)
+{
+    if(ps->prev) ps->prev->next = ps->next; else SampleCacheHead_ = ps->next;
+    if(ps->next) ps->next->prev = ps->prev; else SampleCacheTail_ = ps->prev;
+    ps->prev = ps->next = NULL;
+} /* SampleUnlink_ */
+
+/** Put #ps at the front of the LRU list.  Call with SampleCacheMutex_
+ * held. */
+static void SampleLinkFront_(PAU_Sample ps)
+{
+    ps->prev = NULL;
+    ps->next = SampleCacheHead_;
+    if(SampleCacheHead_) SampleCacheHead_->prev = ps;
+    SampleCacheHead_ = ps;
+    if(!SampleCacheTail_) SampleCacheTail_ = ps;
+} /* SampleLinkFront_ */
+
+/** FNV-1a of #filename, continued over the rest of the key, as in
+ * au_infocache.c */
+static unsigned long SampleHash_(const char *filename,
+        Au_SampleFormat format, int sample_rate, int channels)
+{
+    unsigned long h = 2166136261UL;
+    while(*filename) {
+        h ^= (unsigned char)*filename++;
+        h *= 16777619UL;
+    }
+    h ^= (unsigned long)format;
+    h *= 16777619UL;
+    h ^= (unsigned long)sample_rate;
+    h *= 16777619UL;
+    h ^= (unsigned long)channels;
+    h *= 16777619UL;
+    return h;
+} /* SampleHash_ */
+
+/** Find the cached sample of #filename, decoded for #pau.  Call with
+ * SampleCacheMutex_ held.
+ * @return The sample, or NULL if there isn't one. */
+static PAU_Sample SampleFind_(PAU pau, const char *filename,
+        unsigned long hash)
+{
+    PAU_Sample ps;
+
+    for(ps = SampleCacheBuckets_[hash & (AU_SAMPLE_CACHE_BUCKETS - 1)];
+            ps; ps = ps->hash_next) {
+        if( (ps->hash == hash) &&
+            (ps->format == pau->format) &&
+            (ps->sample_rate == pau->sample_rate) &&
+            (ps->channels == pau->channels) &&
+            (0 == strcmp(ps->filename, filename)) ) {
+            return ps;
+        }
+    }
+    return NULL;
+} /* SampleFind_ */
+
+/** Add #ps, whose hash is set, to its hash bucket.  Call with
+ * SampleCacheMutex_ held. */
+static void SampleHashInsert_(PAU_Sample ps)
+{
+    PAU_Sample *bucket =
+            &SampleCacheBuckets_[ps->hash & (AU_SAMPLE_CACHE_BUCKETS - 1)];
+
+    ps->hash_next = *bucket;
+    *bucket = ps;
+} /* SampleHashInsert_ */
+
+/** Remove #ps from its hash bucket.  Call with SampleCacheMutex_
+ * held. */
+static void SampleHashRemove_(PAU_Sample ps)
+{
+    PAU_Sample *link =
+            &SampleCacheBuckets_[ps->hash & (AU_SAMPLE_CACHE_BUCKETS - 1)];
+
+    while(*link != ps) link = &(*link)->hash_next;
+    *link = ps->hash_next;
+    ps->hash_next = NULL;
+} /* SampleHashRemove_ */
+
+/** Evict unreferenced samples, least recently used first, until the
+ * cache fits in its budget.  Call with SampleCacheMutex_ held. */
+static void SampleCacheTrim_(void)
+{
+    PAU_Sample ps = SampleCacheTail_, prev;
+
+    while(ps && (SampleCacheBytes_ > SampleCacheBudget_)) {
+        prev = ps->prev;
+        if(ps->refs == 0) {
+            SampleUnlink_(ps);
+            SampleHashRemove_(ps);
+            SampleCacheBytes_ -= (size_t)ps->frames * ps->frame_bytes;
+            free(ps->data);
+            free(ps);
+        }
+        ps = prev;
+    }
+} /* SampleCacheTrim_ */
+
+/** Decode all of #filename as #format.
+ * @return A new, unlinked Au_Sample with refs 0, or NULL on failure. */
+static PAU_Sample SampleDecode_(const char *filename, Au_SampleFormat format,
+        int sample_rate, int channels)
+{
+    SF_INFO sf_info;
+    SNDFILE *sf_fd;
+    PAU_Sample ps;
+    sf_count_t capacity, frames_read, frames_wanted;
+    unsigned char *newdata;
+    float *fstage = NULL;
+    size_t len = strlen(filename);
+
+    if(sampleSizeBytes_(format) < 0) return NULL;
+
+    memset(&sf_info, 0, sizeof(sf_info));
+    if(!(sf_fd = sf_open(filename, SFM_READ, &sf_info))) return NULL;
+    SFPrepare_(sf_fd, format);
+
+    do {    /* init with rollback */
+        if( (sf_info.samplerate != sample_rate) ||
+            (sf_info.channels != channels) ) break;
+
+        if(!(ps = (PAU_Sample)malloc(sizeof(Au_Sample) + len + 1))) break;
+        memset(ps, 0, sizeof(Au_Sample));
+        memcpy(ps->filename, filename, len + 1);
+        ps->format = format;
+        ps->sample_rate = sample_rate;
+        ps->channels = channels;
+        ps->frame_bytes = sampleSizeBytes_(format) * channels;
+
+        if( (format != AUSF_F32) && (format != AUSF_I32) &&
+            !(fstage = (float *)malloc(
+                    AU_SAMPLE_DECODE_FRAMES * channels * sizeof(float))) ) {
+            free(ps);
+            break;
+        }
+
+        /* Read it all, a piece at a time, growing the buffer if the
+         * header's frame count was low (or missing). */
+        capacity = (sf_info.frames > 0 && sf_info.frames < SF_COUNT_MAX) ?
+                        sf_info.frames : 65536;
+        if(!(ps->data = (unsigned char *)malloc(
+                        (size_t)capacity * ps->frame_bytes))) capacity = 0;
+        while(capacity > 0) {
+            if(ps->frames == capacity) {
+                capacity *= 2;
+                if(!(newdata = (unsigned char *)realloc(ps->data,
+                                (size_t)capacity * ps->frame_bytes))) break;
+                ps->data = newdata;
+            }
+            frames_wanted = capacity - ps->frames;
+            if(frames_wanted > AU_SAMPLE_DECODE_FRAMES) {
+                frames_wanted = AU_SAMPLE_DECODE_FRAMES;
+            }
+            frames_read = SFReadFrames_(sf_fd, format, channels,
+                    ps->data + ps->frames * ps->frame_bytes, fstage,
+                    frames_wanted, NULL);
+            if(frames_read < 0) break;
+            ps->frames += frames_read;
+            if(frames_read < frames_wanted) {   /* EOF */
+                free(fstage);
+                sf_close(sf_fd);
+                return ps;      /* Success exit */
+            }
+        }
+
+        free(fstage);
+        free(ps->data);
+        free(ps);
+    } while(0);
+
+    sf_close(sf_fd);
+    return NULL;
+} /* SampleDecode_ */
+
+/** Drop a reference to #ps, and evict if that puts the cache over
+ * budget. */
+static void SampleRelease_(PAU_Sample ps)
+{
+    pthread_mutex_lock(&SampleCacheMutex_);
+    --ps->refs;
+    SampleCacheTrim_();
+    pthread_mutex_unlock(&SampleCacheMutex_);
+} /* SampleRelease_ */
+
+void Au_SampleSetCacheBudget(size_t bytes)
+{
+    pthread_mutex_lock(&SampleCacheMutex_);
+    SampleCacheBudget_ = bytes;
+    SampleCacheTrim_();
+    pthread_mutex_unlock(&SampleCacheMutex_);
+} /* Au_SampleSetCacheBudget */
+
+HAUSAMPLE Au_SampleLoad(HAU handle, const char *filename)
+{
+    PAU_Sample ps, newps;
+    unsigned long hash;
+    POW_FAST
+    if(!AuInitialized_ || !pau || !filename) return NULL;
+
+    hash = SampleHash_(filename, pau->format, pau->sample_rate,
+                        pau->channels);
+
+    /* Cache hit? */
+    pthread_mutex_lock(&SampleCacheMutex_);
+    if((ps = SampleFind_(pau, filename, hash))) {
+        ++ps->refs;
+        SampleUnlink_(ps);
+        SampleLinkFront_(ps);
+        pthread_mutex_unlock(&SampleCacheMutex_);
+        return (HAUSAMPLE)ps;
+    }
+    pthread_mutex_unlock(&SampleCacheMutex_);
+
+    /* No - decode it.  Don't hold the lock while we do. */
+    newps = SampleDecode_(filename, pau->format, pau->sample_rate,
+                            pau->channels);
+    if(!newps) return NULL;
+    newps->hash = hash;
+
+    /* Another thread may have decoded it meanwhile.  If so, use theirs,
+     * so the cache only ever has one copy. */
+    pthread_mutex_lock(&SampleCacheMutex_);
+    if((ps = SampleFind_(pau, filename, hash))) {
+        ++ps->refs;
+        SampleUnlink_(ps);
+        SampleLinkFront_(ps);
+        pthread_mutex_unlock(&SampleCacheMutex_);
+        free(newps->data);
+        free(newps);
+        return (HAUSAMPLE)ps;
+    }
+    newps->refs = 1;
+    SampleLinkFront_(newps);
+    SampleHashInsert_(newps);
+    SampleCacheBytes_ += (size_t)newps->frames * newps->frame_bytes;
+    SampleCacheTrim_();
+    pthread_mutex_unlock(&SampleCacheMutex_);
+
+    return (HAUSAMPLE)newps;
+} /* Au_SampleLoad */
+
+BOOL Au_SampleFree(HAUSAMPLE sample)
+{
+    if(!sample) return FALSE;
+    SampleRelease_((PAU_Sample)sample);
+    return TRUE;
+} /* Au_SampleFree */
+
+/* Mixer ================================================================== */
+
+/** The mixer works in chunks of at most this many frames, so its
+ * scratch buffers have a fixed size whatever PortAudio asks for. */
+#define AU_MIX_CHUNK_FRAMES (256)
+
+/** The soft limiter leaves samples below this level alone, and bends
+ * anything above it smoothly towards full scale. */
+#define AU_MIX_LIMIT_THRESHOLD (0.8f)
+
+/** acc[i] += src[i] * gain for #n samples. */
+static void MixAccumulate_(float *acc, const float *src, size_t n,
+        float gain)
+{
+    size_t i = 0;
+#ifdef __SSE__
+    __m128 g = _mm_set1_ps(gain);
+    for(; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+    }
+#endif
+    for(; i < n; ++i) acc[i] += src[i] * gain;
+} /* MixAccumulate_ */
+
+/** Like MixAccumulate_(), but the gain starts at #gain and changes by
+ * #step each frame.  Used when a voice's gain changes. */
+static void MixAccumulateRamp_(float *acc, const float *src,
+        size_t frames, int channels, float gain, float step)
+{
+    size_t i;
+    int c;
+    for(i = 0; i < frames; ++i, gain += step) {
+        for(c = 0; c < channels; ++c) *acc++ += *src++ * gain;
+    }
+} /* MixAccumulateRamp_ */
+
+/** Get the largest absolute value of #n samples. */
+static float MixPeak_(const float *buf, size_t n)
+{
+    size_t i = 0;
+    float peak = 0.0f;
+#ifdef __SSE__
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 vpeak = _mm_setzero_ps();
+    float lanes[4];
+    for(; i + 4 <= n; i += 4) {
+        vpeak = _mm_max_ps(vpeak, _mm_andnot_ps(sign, _mm_loadu_ps(buf + i)));
+    }
+    _mm_storeu_ps(lanes, vpeak);
+    peak = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+#endif
+    for(; i < n; ++i) peak = fmaxf(peak, fabsf(buf[i]));
+    return peak;
+} /* MixPeak_ */
+
+/** Squash #n samples into (-1, 1).  Below AU_MIX_LIMIT_THRESHOLD,
+ * samples pass unchanged; above it, a tanh curve takes them smoothly
+ * towards full scale, so overloads sound rounded instead of clipped. */
+static void MixSoftLimit_(float *buf, size_t n)
+{
+    const float knee = 1.0f - AU_MIX_LIMIT_THRESHOLD;
+    size_t i;
+    float mag;
+    for(i = 0; i < n; ++i) {
+        mag = fabsf(buf[i]);
+        if(mag > AU_MIX_LIMIT_THRESHOLD) {
+            buf[i] = copysignf(AU_MIX_LIMIT_THRESHOLD +
+                        knee * tanhf((mag - AU_MIX_LIMIT_THRESHOLD) / knee),
+                        buf[i]);
+        }
+    }
+} /* MixSoftLimit_ */
+
+/** Release whatever #pv is playing.  The callback must be done with
+ * it: its state must not be AUVS_ACTIVE while the stream runs. */
+static void MixerVoiceRelease_(PAU_Voice pv)
+{
+    if(pv->sample) {
+        SampleRelease_(pv->sample);
+        pv->sample = NULL;
+    }
+    StreamClose_(&pv->stream);
+} /* MixerVoiceRelease_ */
+
+/** Get #pv, which the caller has reserved, ready for a new voice:
+ * wait for the callback to finish with it, if it is fading out, then
+ * release its old source.  Call without mixer_mutex held. */
+static void MixerSlotPrepare_(PAU_Voice pv)
+{
+    /* A stopping voice fades out over one chunk, so this is at most
+     * one callback. */
+    while(pv->state == AUVS_ACTIVE) Pa_Sleep(1);
+
+    if(pv->state == AUVS_DONE) {
+        PaUtil_ReadMemoryBarrier();
+        MixerVoiceRelease_(pv);
+        pv->state = AUVS_FREE;
+    }
+} /* MixerSlotPrepare_ */
+
+/** Give back #pv, reserved by MixerClaimVoice_() or MixerReap_(), and
+ * now FREE. */
+static void MixerSlotUnreserve_(PAU pau, PAU_Voice pv)
+{
+    pthread_mutex_lock(&pau->mixer_mutex);
+    pv->reserved = FALSE;
+    pthread_mutex_unlock(&pau->mixer_mutex);
+} /* MixerSlotUnreserve_ */
+
+/** Free the slots of voices the callback has finished with.  Releasing
+ * a file voice waits for its reader, so this does it one slot at a
+ * time without mixer_mutex held.  Call without mixer_mutex held. */
+static void MixerReap_(PAU pau)
+{
+    int i;
+    PAU_Voice pv;
+
+    while(1) {
+        pv = NULL;
+        pthread_mutex_lock(&pau->mixer_mutex);
+        for(i = 0; i < pau->voice_slots; ++i) {
+            if( (pau->voices[i].state == AUVS_DONE) &&
+                !pau->voices[i].reserved ) {
+                pv = &pau->voices[i];
+                pv->reserved = TRUE;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&pau->mixer_mutex);
+        if(!pv) return;
+
+        MixerSlotPrepare_(pv);
+        MixerSlotUnreserve_(pau, pv);
+    }
+} /* MixerReap_ */
+
+/** Decide whether a new voice of #priority can play.  If max_voices
+ * are already playing, also pick the voice to steal: the
+ * lowest-priority one, oldest first, as long as it isn't more
+ * important than the new one.  Call with mixer_mutex held.
+ * @return TRUE if the new voice can play, stealing *#victim if that
+ *          isn't NULL. */
+static BOOL MixerPickVictim_(PAU pau, int priority, PAU_Voice *victim)
+{
+    int i, active = 0;
+    PAU_Voice pv;
+
+    *victim = NULL;
+    for(i = 0; i < pau->voice_slots; ++i) {
+        pv = &pau->voices[i];
+        if(pv->state == AUVS_ACTIVE && !pv->stop_requested) {
+            ++active;
+            if( !*victim || (pv->priority < (*victim)->priority) ||
+                ( (pv->priority == (*victim)->priority) &&
+                  (pv->serial < (*victim)->serial) ) ) {
+                *victim = pv;
+            }
+        }
+    }
+
+    if(active < pau->max_voices) {
+        *victim = NULL;
+        return TRUE;
+    }
+    return (*victim && (*victim)->priority <= priority);
+} /* MixerPickVictim_ */
+
+/** Reserve a slot for a new voice of #priority, if it can play at all
+ * (MixerPickVictim_()).  A FREE slot if there is one; otherwise one
+ * the callback has finished with, or is fading out.  Follow with
+ * MixerSlotPrepare_(), then set up the source and call
+ * MixerStartVoice_(), all without mixer_mutex held.
+ * @return The slot, or NULL if there is no room. */
+static PAU_Voice MixerClaimVoice_(PAU pau, int priority)
+{
+    int i;
+    PAU_Voice pv, victim, free_pv = NULL, done_pv = NULL, stopping_pv = NULL;
+
+    pthread_mutex_lock(&pau->mixer_mutex);
+    if(MixerPickVictim_(pau, priority, &victim)) {
+        for(i = 0; i < pau->voice_slots; ++i) {
+            pv = &pau->voices[i];
+            if(pv->reserved) continue;
+            if(pv->state == AUVS_FREE) {
+                free_pv = pv;
+                break;
+            } else if(pv->state == AUVS_DONE) {
+                if(!done_pv) done_pv = pv;
+            } else if(pv->stop_requested) {
+                if(!stopping_pv) stopping_pv = pv;
+            }
+        }
+        pv = free_pv ? free_pv : done_pv ? done_pv : stopping_pv;
+        if(pv) pv->reserved = TRUE;
+    } else {
+        pv = NULL;
+    }
+    pthread_mutex_unlock(&pau->mixer_mutex);
+
+    return pv;
+} /* MixerClaimVoice_ */
+
+/** Hand #pv, reserved and with its source set up, to the callback,
+ * stealing a voice if need be.  If the voice can no longer play
+ * because others started meanwhile, release the source and the slot.
+ * Call without mixer_mutex held.
+ * @return The voice ID, or -1 if it didn't start. */
+static long MixerStartVoice_(PAU pau, PAU_Voice pv, float gain,
+        int priority)
+{
+    PAU_Voice victim;
+
+    pthread_mutex_lock(&pau->mixer_mutex);
+    if(!MixerPickVictim_(pau, priority, &victim)) {
+        pthread_mutex_unlock(&pau->mixer_mutex);
+        MixerVoiceRelease_(pv);
+        MixerSlotUnreserve_(pau, pv);
+        return -1;
+    }
+
+    pv->stop_requested = FALSE;
+    pv->gain = pv->applied_gain = gain;
+    pv->priority = priority;
+    pv->serial = ++pau->voice_serial;
+    pv->reserved = FALSE;
+    PaUtil_WriteMemoryBarrier();
+    pv->state = AUVS_ACTIVE;
+
+    if(victim) victim->stop_requested = TRUE;
+    pthread_mutex_unlock(&pau->mixer_mutex);
+    return pv->serial;
+} /* MixerStartVoice_ */
+
+/** Find the playing voice with ID #voice.  Call with mixer_mutex held.
+ * @return The voice, or NULL if it has finished or is fading out. */
+static PAU_Voice MixerFindVoice_(PAU pau, long voice)
+{
+    int i;
+    for(i = 0; i < pau->voice_slots; ++i) {
+        if( (pau->voices[i].state == AUVS_ACTIVE) &&
+            !pau->voices[i].stop_requested &&
+            (pau->voices[i].serial == voice) ) {
+            return &pau->voices[i];
+        }
+    }
+    return NULL;
+} /* MixerFindVoice_ */
+
+/** Free all the mixer's voices and buffers.  Only call while the
+ * stream is stopped. */
+static void MixerClose_(PAU pau)
+{
+    int i;
+
+    if(pau->voices) {
+        for(i = 0; i < pau->voice_slots; ++i) {
+            MixerVoiceRelease_(&pau->voices[i]);
+            StreamDestroy_(&pau->voices[i].stream);
+        }
+        free(pau->voices);
+        pau->voices = NULL;
+    }
+    pau->voice_slots = pau->max_voices = 0;
+
+    free(pau->mix_accum);
+    free(pau->mix_voice);
+    free(pau->mix_raw);
+    pau->mix_accum = pau->mix_voice = NULL;
+    pau->mix_raw = NULL;
+} /* MixerClose_ */
+
+/** PortAudio callback to mix all the active voices.  Runs until
+ * Au_Stop(), outputting silence when no voices are playing. */
+static int PAMixerCallback_(const void *input, void *output,
+    unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo,
+    PaStreamCallbackFlags statusFlags, void *handle )
+{
+    unsigned long offset, chunk, got;
+    size_t nsamples;
+    int i;
+    PAU_Voice pv;
+    const unsigned char *src;
+    Au_FrameCount clock_pos;
+    BOOL ended, stopping, any_playing = FALSE;
+    float target;
+    POW_UD_FAST
+
+    UNUSED(input);
+    UNUSED(statusFlags);
+
+    for(offset = 0; offset < frameCount; offset += chunk) {
+        chunk = frameCount - offset;
+        if(chunk > AU_MIX_CHUNK_FRAMES) chunk = AU_MIX_CHUNK_FRAMES;
+        nsamples = chunk * pau->channels;
+        memset(pau->mix_accum, 0, nsamples * sizeof(float));
+
+        for(i = 0; i < pau->voice_slots; ++i) {
+            pv = &pau->voices[i];
+            if(pv->state != AUVS_ACTIVE) continue;
+            PaUtil_ReadMemoryBarrier();
+            any_playing = TRUE;
+            stopping = pv->stop_requested;
+
+            /* Get this voice's next chunk */
+            if(pv->sample) {
+                got = pv->sample->frames - pv->sample_pos;
+                if(got > chunk) got = chunk;
+                src = pv->sample->data +
+                        pv->sample_pos * pv->sample->frame_bytes;
+                pv->sample_pos += got;
+                ended = (pv->sample_pos >= pv->sample->frames);
+            } else {
+                got = StreamRead_(&pv->stream, pau->mix_raw, chunk,
+                                    &clock_pos, &ended);
+                    /* If the reader falls behind, the voice skips a
+                     * beat rather than holding up the others. */
+                src = pau->mix_raw;
+            }
+
+            /* Add it in.  A stopping voice fades out over the chunk. */
+            AuConv_ToFloat(pau->format, src, pau->mix_voice,
+                            got * pau->channels);
+            target = stopping ? 0.0f : pv->gain;
+            if(target == pv->applied_gain) {
+                MixAccumulate_(pau->mix_accum, pau->mix_voice,
+                                got * pau->channels, target);
+            } else {
+                MixAccumulateRamp_(pau->mix_accum, pau->mix_voice, got,
+                        pau->channels, pv->applied_gain,
+                        (target - pv->applied_gain) / chunk);
+                pv->applied_gain = target;
+            }
+
+            if(ended || stopping) {
+                PaUtil_WriteMemoryBarrier();
+                pv->state = AUVS_DONE;
+            }
+        } /* for each voice */
+
+        if(MixPeak_(pau->mix_accum, nsamples) > AU_MIX_LIMIT_THRESHOLD) {
+            MixSoftLimit_(pau->mix_accum, nsamples);
+        }
+        AuConv_FromFloat(pau->format, pau->mix_accum,
+                (unsigned char *)output + offset * pau->frame_bytes,
+                nsamples, pau->dither ? &pau->mix_dither : NULL);
+    } /* for each chunk */
+
+    /* The mixer's clock runs from Au_MixerStart() */
+    ClockPublish_(pau, pau->mix_frames, frameCount,
+            timeInfo ? timeInfo->outputBufferDacTime : 0, any_playing);
+    pau->mix_frames += frameCount;
+
+    return paContinue;
+} /* PAMixerCallback_ */
+
+BOOL Au_MixerStart(HAU handle, int max_voices)
+{
+    size_t nsamples;
+    POW
+    if(!pau->pa_stream || max_voices < 1) return FALSE;
+        /* Not offline: the mixer never finishes, so it would render
+         * silence forever. */
+
+    Au_Stop(handle);    /* whatever was playing */
+
+    do {    /* init with rollback */
+        if(!(pau->voices = (PAU_Voice)calloc(2 * max_voices,
+                                                sizeof(Au_Voice)))) break;
+        while(pau->voice_slots < 2 * max_voices) {
+            if(!StreamInit_(pau, &pau->voices[pau->voice_slots].stream)) {
+                break;
+            }
+            ++pau->voice_slots;
+        }
+        if(pau->voice_slots < 2 * max_voices) break;
+        pau->max_voices = max_voices;
+
+        nsamples = (size_t)AU_MIX_CHUNK_FRAMES * pau->channels;
+        if(!(pau->mix_accum = (float *)malloc(nsamples * sizeof(float)))) break;
+        if(!(pau->mix_voice = (float *)malloc(nsamples * sizeof(float)))) break;
+        if(!(pau->mix_raw = (unsigned char *)malloc(
+                    (size_t)AU_MIX_CHUNK_FRAMES * pau->frame_bytes))) break;
+
+        pau->mix_frames = 0;
+        AuConv_DitherInit(&pau->mix_dither, (unsigned int)(size_t)pau);
+        ClockReset_(pau);
+        pau->clock_active = TRUE;
+
+        pau->pa_callback_userdata = NULL;   /* everything's in pau */
+        pau->pa_callback = PAMixerCallback_;
+
+        if(!OutputStart_(pau)) break;
+
+        return TRUE;
+    } while(0);
+
+    /* Failure: roll back changes */
+    Au_Stop(handle);
+    return FALSE;
+} /* Au_MixerStart */
+
+long Au_MixerPlaySample(HAU handle, HAUSAMPLE sample, float gain,
+        int priority)
 {
-    POW
-    if(pau->format == AUSF_CUSTOM) {
-        AU_SFFR_Count = 123000;
-        return 0;    /* TODO */
+    PAU_Sample ps = (PAU_Sample)sample;
+    PAU_Voice pv;
+    POW_FAST
+    if(!AuInitialized_ || !pau || !pau->voices || !ps) return -1;
+
+    if( (ps->format != pau->format) ||
+        (ps->sample_rate != pau->sample_rate) ||
+        (ps->channels != pau->channels) ) {
+        return -1;
     }
 
-    //AU_SFFR_Count+=2;
+    MixerReap_(pau);
+    if(!(pv = MixerClaimVoice_(pau, priority))) return -1;
+    MixerSlotPrepare_(pv);
 
-    void *data1, *data2;
-    ring_buffer_size_t buffers_avail, elems1, elems2, ok;
-    sf_count_t frames_read;
-    sf_count_t frames_wanted = PA_BUFFER_FRAMECOUNT;
-    PFRBuf pfr;
+    pthread_mutex_lock(&SampleCacheMutex_);
+    ++ps->refs;
+    SampleUnlink_(ps);
+    SampleLinkFront_(ps);
+    pthread_mutex_unlock(&SampleCacheMutex_);
 
-    while(1) {
-        sem_wait(pau->sf_reader_semaphore);
-        //AU_SFFR_Count+=2;
-        if(pau->sf_reader_should_exit) {
-            AU_SFFR_Count = 123456789;
-            break;  /* EXIT POINT */
-        }
-
-        /* Find out where to put the data.
-         * For now, every time the file_reader thread wakes up, fill the
-         * ring buffer. */
-        buffers_avail =
-            PaUtil_GetRingBufferWriteAvailable(pau->sf_buffer);
-
-        /* Read the data.  For now, do one element at a time so I don't
-         * have to deal with data1/data2. */
-        for( ; buffers_avail>0 ; --buffers_avail) {
-            ++AU_SFFR_Count;
-            ok = PaUtil_GetRingBufferWriteRegions( pau->sf_buffer, 1,
-                    &data1, &elems1, &data2, &elems2);
-            if(ok <= 0 || elems1 <= 0) {
-                AU_SFFR_Count = 123001;
-                break;
-            }
+    pv->sample = ps;
+    pv->sample_pos = 0;
+    return MixerStartVoice_(pau, pv, gain, priority);
+} /* Au_MixerPlaySample */
 
-            pfr = (PFRBuf)data1;
-            //pfr->pos_frames = sf_seek(pau->sf_fd, SEEK_CUR, 0);
-                /* Get the offset of the beginning of what we are
-                 * reading */
-                // TODO cache this?
-
-            /* NOTE: we currently use the STATIC_ASSERT checks above
-             * to guarantee that, e.g., sf_read_float is giving us
-             * 32 bits at a time.  If those checks ever go away, this
-             * switch will need to change correspondingly. */
-
-            switch(pau->format) {   /* TODO optimize this */
-                case AUSF_F32:
-                    frames_read = sf_readf_float(pau->sf_fd, (float *)pfr->data,
-                            PA_BUFFER_FRAMECOUNT);
-                    if(frames_read > 0 && frames_read != frames_wanted) {
-                        AU_SFFR_Count = 123002;
-                        return 0;   /* EXIT POINT */
-                    }
-                    break;
+long Au_MixerPlayFile(HAU handle, const char *filename, float gain,
+        int priority)
+{
+    PAU_Voice pv;
+    POW_FAST
+    if(!AuInitialized_ || !pau || !pau->voices || !filename) return -1;
+
+    /* Open and pre-roll without mixer_mutex, so the other voices'
+     * control calls don't wait on the disk.  The slot is reserved
+     * meanwhile. */
+    MixerReap_(pau);
+    if(!(pv = MixerClaimVoice_(pau, priority))) return -1;
+    MixerSlotPrepare_(pv);
+
+    if(!StreamOpen_(&pv->stream, filename)) {
+        StreamClose_(&pv->stream);
+        MixerSlotUnreserve_(pau, pv);
+        return -1;
+    }
+    return MixerStartVoice_(pau, pv, gain, priority);
+} /* Au_MixerPlayFile */
 
-                case AUSF_I32:
-                    frames_read = sf_readf_int(pau->sf_fd, (int *)pfr->data,
-                            PA_BUFFER_FRAMECOUNT);
-                    if(frames_read > 0 && frames_read != frames_wanted) {
-                        AU_SFFR_Count = 123003;
-                        return 0;   /* EXIT POINT */
-                        // TODO fill out the rest of the buffer with
-                        // zeros instead
-                    }
-                    break;
+BOOL Au_MixerSetGain(HAU handle, long voice, float gain)
+{
+    PAU_Voice pv;
+    POW
+    if(!pau->voices) return FALSE;
 
-                case AUSF_I24:
-                    AU_SFFR_Count = 123004;
-                    return 0;   /* EXIT POINT */ /* TODO handle this */
-                    break;
+    pthread_mutex_lock(&pau->mixer_mutex);
+    if((pv = MixerFindVoice_(pau, voice))) pv->gain = gain;
+    pthread_mutex_unlock(&pau->mixer_mutex);
 
-                case AUSF_I16:
-                    frames_read = sf_readf_short(pau->sf_fd, (short *)pfr->data,
-                            PA_BUFFER_FRAMECOUNT);
-                    if(frames_read > 0 && frames_read != frames_wanted) {
-                        AU_SFFR_Count = 123005;
-                        return 0;   /* EXIT POINT */
-                    }
-                    break;
+    return (pv != NULL);
+} /* Au_MixerSetGain */
 
-                case AUSF_I8:
-                    AU_SFFR_Count = 123006;
-                    return 0;   /* EXIT POINT */ /* TODO handle this */
-                    break;
-                case AUSF_UI8:
-                    AU_SFFR_Count = 123007;
-                    return 0;   /* EXIT POINT */ /* TODO handle this */
-                    break;
-                default:
-                    AU_SFFR_Count = 123008;
-                    return 0;
-                    break;
-            } /* switch(format) */
-
-            /* Sync info */
-            pfr->pos_frames = pau->playback_frames;
-            pau->playback_frames += frames_read;
-
-            if(frames_read == 0) {       /* Report EOF */
-                pfr->state = PPPS_Stopped;
-                AU_SFFR_Count |= 0x01;
-            } else {                    /* Play it */
-                pfr->state = PPPS_Playing;
-                AU_SFFR_Count &= (unsigned long int)(-2);
-            }
+BOOL Au_MixerStopVoice(HAU handle, long voice)
+{
+    PAU_Voice pv;
+    POW
+    if(!pau->voices) return FALSE;
 
-            /* Send pfr to the PortAudio callback */
-            pfr = NULL;
-            PaUtil_AdvanceRingBufferWriteIndex(pau->sf_buffer, 1);
-        } /* while buffers_avail */
+    pthread_mutex_lock(&pau->mixer_mutex);
+    if((pv = MixerFindVoice_(pau, voice))) pv->stop_requested = TRUE;
+    pthread_mutex_unlock(&pau->mixer_mutex);
 
-        //AU_SFFR_Count+=2;
-    } /* thread main loop */
+    return (pv != NULL);
+} /* Au_MixerStopVoice */
 
-    AU_SFFR_Count = 987654321;
-    return 0;
-} /* SFFileReader_ */
+int Au_MixerActiveVoices(HAU handle)
+{
+    int i, retval = 0;
+    POW_FAST
+    if(!AuInitialized_ || !pau || !pau->voices) return 0;
+
+    MixerReap_(pau);
+    pthread_mutex_lock(&pau->mixer_mutex);
+    for(i = 0; i < pau->voice_slots; ++i) {
+        if( (pau->voices[i].state == AUVS_ACTIVE) &&
+            !pau->voices[i].stop_requested ) {
+            ++retval;
+        }
+    }
+    pthread_mutex_unlock(&pau->mixer_mutex);
+
+    return retval;
+} /* Au_MixerActiveVoices */
 
 /* Init/termination ======================================================= */
 
@@ -405,6 +3027,20 @@ BOOL Au_Startup()
     if( err != paNoError ) return FALSE;
         /* TODO figure out error reporting - Pa_GetErrorText(err) */
 
+    /* Start the readers, one per CPU by default */
+    int threads = ReaderPoolThreads_;
+    if(threads <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (ncpu < 1) ? 1 :
+                    (ncpu > AU_READER_THREADS_MAX) ? AU_READER_THREADS_MAX :
+                    (int)ncpu;
+    }
+    ReaderPool_ = AuPool_New(threads, ReaderPoolCpus_, ReaderPoolNCpus_);
+    if(!ReaderPool_) {
+        Pa_Terminate();
+        return FALSE;
+    }
+
     AuInitialized_ = TRUE;
     return TRUE;
 } /* Au_Startup */
@@ -421,24 +3057,108 @@ BOOL Au_Shutdown()
     if( err != paNoError ) return FALSE;
         /* TODO figure out error reporting - Pa_GetErrorText(err) */
 
+    /* Empty the sample cache of anything not in use */
+    pthread_mutex_lock(&SampleCacheMutex_);
+    size_t budget = SampleCacheBudget_;
+    SampleCacheBudget_ = 0;
+    SampleCacheTrim_();
+    SampleCacheBudget_ = budget;
+    pthread_mutex_unlock(&SampleCacheMutex_);
+
+    AuPool_Delete(ReaderPool_);
+    ReaderPool_ = NULL;
+
     AuInitialized_ = FALSE;
     return TRUE;
 } /* Au_Shutdown */
 
+BOOL Au_SetReaderThreads(int threads, const int *cpus, int ncpus)
+{
+    int *copy = NULL;
+
+    if(AuInitialized_) return FALSE;
+    if(threads < 0 || ncpus < 0 || (ncpus > 0 && !cpus)) return FALSE;
+
+    if(ncpus > 0) {
+        if(!(copy = (int *)malloc(ncpus * sizeof(int)))) return FALSE;
+        memcpy(copy, cpus, ncpus * sizeof(int));
+    }
+    free(ReaderPoolCpus_);
+    ReaderPoolCpus_ = copy;
+    ReaderPoolNCpus_ = ncpus;
+    ReaderPoolThreads_ = threads;
+    return TRUE;
+} /* Au_SetReaderThreads */
+
 /** Create a new output.
  * @param handle {HAU} The output to shut down
  * @return non-NULL on success; NULL on failure
  */
 HAU Au_New(Au_SampleFormat format, int sample_rate, int channels,
         void *user_data)
+{
+    return Au_NewEx(format, sample_rate, channels, NULL, user_data);
+} /* Au_New */
+
+/** Create a new output with specific buffering.
+ * @return non-NULL on success; NULL on failure
+ */
+HAU Au_NewEx(Au_SampleFormat format, int sample_rate, int channels,
+        const Au_Options *options, void *user_data)
 {
     PAU pau;
     PaError pa_err;
     PaSampleFormat pa_format;
+    PaStreamParameters pa_params;
+    const PaDeviceInfo *pa_devinfo;
+    Au_Options opts;
 
     (void)user_data;    /* not yet used */
 
     if(!AuInitialized_) return FALSE;
+
+    /* Fill in the options from the profile */
+    if(options) {
+        opts = *options;
+    } else {
+        memset(&opts, 0, sizeof(opts));
+    }
+    if( ((int)opts.profile < 0) ||
+        ((size_t)opts.profile >= sizeof(AuProfiles_)/sizeof(AuProfiles_[0])) ) {
+        return NULL;
+    }
+    if(opts.block_frames <= 0) {
+        opts.block_frames = AuProfiles_[opts.profile].block_frames;
+    }
+    if(opts.block_frames > AU_BLOCK_FRAMES_MAX) return NULL;
+    if(opts.ring_blocks <= 0) {
+        opts.ring_blocks = AuProfiles_[opts.profile].ring_blocks;
+    }
+    opts.ring_blocks = roundUpPow2_(opts.ring_blocks);
+    if(opts.ring_blocks < 2) opts.ring_blocks = 2;
+    if(opts.min_ring_blocks <= 0) opts.min_ring_blocks = opts.ring_blocks / 8;
+    opts.min_ring_blocks = roundUpPow2_(opts.min_ring_blocks);
+    if(opts.min_ring_blocks < 2) opts.min_ring_blocks = 2;
+    if(opts.min_ring_blocks > opts.ring_blocks) {
+        opts.min_ring_blocks = opts.ring_blocks;
+    }
+    if(opts.prefill_blocks <= 0) opts.prefill_blocks = opts.ring_blocks / 4;
+    if(opts.prefill_blocks < 1) opts.prefill_blocks = 1;
+    if(opts.prefill_blocks > opts.ring_blocks) {
+        opts.prefill_blocks = opts.ring_blocks;
+    }
+    if( ((int)opts.underrun_policy < 0) ||
+        ((int)opts.underrun_policy > (int)AUUP_STOP) ) {
+        return NULL;
+    }
+    if(opts.resample_quality == AURQ_PROFILE) {
+        opts.resample_quality = AuProfiles_[opts.profile].resample_quality;
+    }
+    if( ((int)opts.resample_quality < 0) ||
+        ((int)opts.resample_quality > (int)AURQ_BEST) ) {
+        return NULL;
+    }
+
     /* Map the format, since we don't directly expose the implementation
      * types to the caller.*/
     switch(format) {
@@ -455,33 +3175,77 @@ HAU Au_New(Au_SampleFormat format, int sample_rate, int channels,
     }
 
     if(sample_rate < 1.0) return NULL;
+    if(channels < 1 || channels > PA_MAX_CHANNELS) return NULL;
 
     do {    /* init with rollback */
         pau = (PAU)malloc(sizeof(Au_Output));
         if(!pau) break;
         memset(pau, 0, sizeof(Au_Output));
+        pau->stats.fill_min = -1;
 
         pau->format = format;
         pau->sample_rate = sample_rate;
         pau->channels = channels;
+        pau->frame_bytes = sampleSizeBytes_(format) * channels;
+
+        pau->block_frames = opts.block_frames;
+        pau->ring_blocks = opts.ring_blocks;
+        pau->adaptive = opts.adaptive;
+        pau->min_ring_blocks = opts.min_ring_blocks;
+        pau->dither = opts.dither;
+        pau->underrun_policy = opts.underrun_policy;
+        pau->prefill_blocks = opts.prefill_blocks;
+        pau->resample_quality = opts.resample_quality;
+        pau->ring_mem_flags = (opts.lock_memory ? AU_RING_MEM_LOCK : 0) |
+                                (opts.huge_pages ? AU_RING_MEM_HUGE : 0);
+        pau->file_params.chunks = opts.file_chunks;
+        pau->file_params.chunk_bytes = opts.file_chunk_bytes;
 
         /* PortAudio init */
 
         pau->pa_callback = PAEmptyCallback_;
         pau->pa_callback_userdata = NULL;
 
-        pa_err = Pa_OpenDefaultStream(
+        if(!StreamInit_(pau, &pau->stream)) {
+            free(pau);
+            pau = NULL;
+            break;
+        }
+
+        if(0 != pthread_mutex_init(&pau->mixer_mutex, NULL)) {
+            StreamDestroy_(&pau->stream);
+            free(pau);
+            pau = NULL;
+            break;
+        }
+
+        if(opts.render_file) {      /* offline - no PortAudio */
+            if(!RenderOpen_(pau, opts.render_file, opts.render_format)) break;
+            return (HAU)pau;    /* Success exit */
+        }
+
+        pa_params.device = Pa_GetDefaultOutputDevice();
+        if(pa_params.device == paNoDevice) break;
+        if(!(pa_devinfo = Pa_GetDeviceInfo(pa_params.device))) break;
+        pa_params.channelCount = channels;
+        pa_params.sampleFormat = pa_format;
+        pa_params.suggestedLatency =
+            AuProfiles_[opts.profile].low_latency ?
+                pa_devinfo->defaultLowOutputLatency :
+                pa_devinfo->defaultHighOutputLatency;
+                    /* High is what Pa_OpenDefaultStream() uses */
+        pa_params.hostApiSpecificStreamInfo = NULL;
+
+        pa_err = Pa_OpenStream(
             &pau->pa_stream,
-            0,              /* no input channels */
-            channels,
-            pa_format,
+            NULL,           /* no input */
+            &pa_params,
             sample_rate,
-            PA_BUFFER_FRAMECOUNT,
-                /* frames per buffer, i.e. the number of sample frames
-                 * that PortAudio will request from the callback. Many
-                 * apps may want to use paFramesPerBufferUnspecified,
-                 * which tells PortAudio to pick the best, possibly
-                 * changing, buffer size.*/
+            paFramesPerBufferUnspecified,
+                /* frames per buffer.  Let PortAudio pick the best,
+                 * possibly changing, buffer size.  PAPlayCallback_()
+                 * handles any size. */
+            paNoFlag,
             PACallback_,    /* dispatches to pau->pa_callback */
             pau );      /*This is a pointer that will be passed to
                             your callback*/
@@ -494,7 +3258,7 @@ HAU Au_New(Au_SampleFormat format, int sample_rate, int channels,
     Au_Delete((HAU)pau);
 
     return NULL;
-} /* Au_New */
+} /* Au_NewEx */
 
 /** Close an output.  If this succeeds, any memory associated witht that
  * output has been freed.
@@ -505,140 +3269,290 @@ BOOL Au_Delete(HAU handle)
 {
     POW
 
-    if(pau->pa_stream) Pa_StopStream(pau->pa_stream);      /* just in case */
-
-    /* TODO shutdown the reader thread */
-
-    if(pau->sf_fd) {                    /* close the reader file */
-        sf_close(pau->sf_fd);
-        pau->sf_fd = NULL;
-    }
+    Au_Stop(handle);        /* stops the reader */
 
     if(pau->pa_stream) {                /* close the output stream */
         Pa_CloseStream(pau->pa_stream);
         pau->pa_stream = NULL;
     }
 
+    if(pau->render_fd) sf_close(pau->render_fd);
+    free(pau->render_buf);
+    free(pau->render_ints);
+
+    StreamDestroy_(&pau->stream);
+    pthread_mutex_destroy(&pau->mixer_mutex);
     free(pau);
     return TRUE;
 }
 
 /* Playback from a file =================================================== */
 
-/** Get the sample rate and format from a file.
+/** Fill in #info for #filename.
+ * @param lasting If non-NULL, set to whether the result will hold for
+ *          as long as the file doesn't change, and so may be cached:
+ *          TRUE on success, or if libsndfile can't read this kind of
+ *          file at all; FALSE if it failed for some other reason,
+ *          e.g., an I/O error, that may not happen next time.
  * @return TRUE on success; FALSE on failure. */
-BOOL Au_InspectFile(const char *filename, int *samplerate, int *channels,
-        Au_SampleFormat *format, long int *len)
+static BOOL InspectOne_(const char *filename, Au_FileInfo *info,
+        BOOL *lasting)
 {
     SF_INFO sf_info;
     SNDFILE *sf_fd;
     sf_count_t framecount;
+    int err;
 
+    memset(info, 0, sizeof(Au_FileInfo));
     memset(&sf_info, 0, sizeof(sf_info));
     sf_fd = sf_open(filename, SFM_READ, &sf_info);
-    if(!sf_fd) return FALSE;
+    if(!sf_fd) {
+        if(lasting) {
+            err = sf_error(NULL);
+            *lasting = (err == SF_ERR_UNRECOGNISED_FORMAT) ||
+                        (err == SF_ERR_UNSUPPORTED_ENCODING);
+        }
+        return FALSE;
+    }
+    if(lasting) *lasting = TRUE;
 
-    *samplerate = sf_info.samplerate;
-    *channels = sf_info.channels;
+    info->samplerate = sf_info.samplerate;
+    info->channels = sf_info.channels;
     switch(sf_info.format & SF_FORMAT_SUBMASK) {
-        case SF_FORMAT_PCM_S8: *format = AUSF_I8; break;
-        case SF_FORMAT_PCM_U8: *format = AUSF_UI8; break;
-        case SF_FORMAT_PCM_16: *format = AUSF_I16; break;
-        case SF_FORMAT_PCM_24: *format = AUSF_I24; break;
+        case SF_FORMAT_PCM_S8: info->format = AUSF_I8; break;
+        case SF_FORMAT_PCM_U8: info->format = AUSF_UI8; break;
+        case SF_FORMAT_PCM_16: info->format = AUSF_I16; break;
+        case SF_FORMAT_PCM_24: info->format = AUSF_I24; break;
 
-        case SF_FORMAT_PCM_32: *format = AUSF_I32; break;
+        case SF_FORMAT_PCM_32: info->format = AUSF_I32; break;
         case SF_FORMAT_FLOAT:
         case SF_FORMAT_VORBIS:  /* sf src/ogg_vorbis.c uses float inside */
-            *format = AUSF_F32; break;
-        default: *format = AUSF_CUSTOM; break;
+            info->format = AUSF_F32; break;
+        default: info->format = AUSF_CUSTOM; break;
     }
 
-    if( (len != NULL) && sf_info.seekable ) {
-        framecount = sf_seek(sf_fd, 0, SEEK_END);
-        *len = (long int)framecount;
+    /* The header says, unless the file is a stream that doesn't */
+    framecount = sf_info.frames;
+    if( (framecount < 0) || (framecount == SF_COUNT_MAX) ) {
+        framecount = sf_info.seekable ? sf_seek(sf_fd, 0, SEEK_END) : -1;
     }
+    info->len = (long int)framecount;
 
     sf_close(sf_fd);
+    info->ok = TRUE;
     return TRUE;
-} /* Au_InspectFile */
-
-unsigned int AU_PAPC_Count = 0;     /* For debugging */
+} /* InspectOne_ */
 
-/** PortAudio callback to play data received from a file. */
-static int PAPlayCallback_(const void *input, void *output,
-    unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo,
-    PaStreamCallbackFlags statusFlags, void *handle )
+/** Get the sample rate and format from a file.
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_InspectFile(const char *filename, int *samplerate, int *channels,
+        Au_SampleFormat *format, long int *len)
 {
-#define MARK_NOT_PLAYING \
-    do { if(0 == pthread_mutex_lock(pau->playback_time_mutex)) { \
-        pau->is_playing = FALSE; \
-        pthread_mutex_unlock(pau->playback_time_mutex); \
-    } } while(0)
-
-    void *data1, *data2;
-    ring_buffer_size_t read_avail, elems1, elems2, ok;
-    POW_UD_FAST
+    Au_FileInfo info;
 
-    ++AU_PAPC_Count;
+    if(!InspectOne_(filename, &info, NULL)) return FALSE;
+    *samplerate = info.samplerate;
+    *channels = info.channels;
+    *format = info.format;
+    if(len != NULL) *len = info.len;
+    return TRUE;
+} /* Au_InspectFile */
 
-    /* Let the reader get working on more data */
-    sem_post(pau->sf_reader_semaphore);
+/** One Au_InspectFiles() call, shared by its threads */
+typedef struct InspectJob {
+    const char *const *filenames;
+    Au_FileInfo *infos;
+    size_t count;
+
+    /** The cache to check first, or NULL.  Not changed until the
+     * threads are done. */
+    const AuInfoCache *cache;
+
+    /** Per file: its cache key, and whether it has one (i.e., it could
+     * be stat()ed and wasn't in the cache) and its result is worth
+     * adding (see InspectOne_()) */
+    AuInfoKey *keys;
+    char *to_store;
+
+    /** The next file no thread has claimed yet.  Atomic. */
+    size_t next;
+
+    /** How many threads are still going, protected by #mutex.  #done
+     * is signaled when it reaches 0. */
+    int running;
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+} InspectJob;
+
+/** An Au_InspectFiles() thread's task */
+typedef struct InspectTask {
+    AuPoolTask task;
+    InspectJob *job;
+} InspectTask;
+
+/** Inspect files from #task's job until there are none left */
+static void InspectRun_(AuPoolTask *task)
+{
+    InspectJob *job = ((InspectTask *)task->arg)->job;
+    size_t first, i, last;
+    AuInfoData data;
+    BOOL have_key, lasting;
 
-    if(frameCount != PA_BUFFER_FRAMECOUNT) {    /* shouldn't happen, right? */
-        MARK_NOT_PLAYING;
-        return paComplete; /* for now */
+    while(1) {
+        first = __atomic_fetch_add(&job->next, AU_INSPECT_CLAIM,
+                                    __ATOMIC_RELAXED);
+        if(first >= job->count) break;
+        last = first + AU_INSPECT_CLAIM;
+        if(last > job->count) last = job->count;
+
+        for(i = first; i < last; ++i) {
+            have_key = AuInfoCache_Key(job->filenames[i], &job->keys[i]);
+            if(have_key && job->cache &&
+                    AuInfoCache_Lookup(job->cache, job->filenames[i],
+                                        &job->keys[i], &data)) {
+                job->infos[i].ok = data.ok;
+                job->infos[i].samplerate = data.samplerate;
+                job->infos[i].channels = data.channels;
+                job->infos[i].format = (Au_SampleFormat)data.format;
+                job->infos[i].len = data.len;
+                continue;
+            }
+            InspectOne_(job->filenames[i], &job->infos[i], &lasting);
+            job->to_store[i] = have_key && lasting;
+        }
     }
 
-    /* Get the next block of info, if any */
-    read_avail = PaUtil_GetRingBufferReadAvailable(pau->sf_buffer);
-    if(read_avail <= 0) {
-        MARK_NOT_PLAYING;
-        return paComplete;  /* for now */
+    pthread_mutex_lock(&job->mutex);
+    if(--job->running == 0) pthread_cond_signal(&job->done);
+    pthread_mutex_unlock(&job->mutex);
+} /* InspectRun_ */
+
+BOOL Au_InspectFiles(const char *const *filenames, size_t count,
+        Au_FileInfo *infos, const char *cache_filename)
+{
+    InspectJob job;
+    InspectTask *tasks = NULL;
+    AuInfoCache *cache = NULL;
+    AuPool *pool = NULL;
+    AuInfoData data;
+    long ncpu;
+    int threads, t;
+    size_t i;
+    BOOL ok = FALSE;
+
+    if(!filenames || !infos) return FALSE;
+    for(i = 0; i < count; ++i) {
+        if(!filenames[i]) return FALSE;
     }
-    ok = PaUtil_GetRingBufferReadRegions(pau->sf_buffer, 1,
-                    &data1, &elems1, &data2, &elems2);
-    if(ok <= 0 || elems1 <= 0) {
-        MARK_NOT_PLAYING;
-        return paComplete;
+    if(count == 0) return TRUE;
+
+    memset(&job, 0, sizeof(job));
+    job.filenames = filenames;
+    job.infos = infos;
+    job.count = count;
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.done, NULL);
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (ncpu < 1) ? 2 : (ncpu > AU_INSPECT_THREADS_MAX / 2) ?
+                AU_INSPECT_THREADS_MAX : (int)ncpu * 2;
+    if((size_t)threads > (count + AU_INSPECT_CLAIM - 1) / AU_INSPECT_CLAIM) {
+        threads = (int)((count + AU_INSPECT_CLAIM - 1) / AU_INSPECT_CLAIM);
     }
 
-    PFRBuf pfr = (PFRBuf)data1;
-    PPPS state = pfr->state;
+    do { /* once */
+        if(cache_filename && !(cache = AuInfoCache_Load(cache_filename))) {
+            break;
+        }
+        job.cache = cache;
+
+        job.keys = (AuInfoKey *)malloc(count * sizeof(AuInfoKey));
+        job.to_store = (char *)calloc(count, 1);
+        tasks = (InspectTask *)calloc(threads, sizeof(InspectTask));
+        if(!job.keys || !job.to_store || !tasks) break;
+
+        if(!(pool = AuPool_New(threads, NULL, 0))) break;
 
-    /* Initialize the sync information if necessary. */
-    if(pau->playback_start_time == -1.0) {
-        /* block if necessary for this one, so we have a reliable
-         * sync-start indication. */
-        if(0 != pthread_mutex_lock(pau->playback_time_mutex)) {
-            // Couldn't lock the mutex, so can't change pau->is_playing
-            return paComplete;  /* for now */
+        job.running = threads;
+        for(t = 0; t < threads; ++t) {
+            tasks[t].job = &job;
+            AuPoolTask_Init(&tasks[t].task, InspectRun_, NULL, &tasks[t]);
+            AuPool_Signal(pool, &tasks[t].task);
         }
-        pau->playback_start_time = pau->playback_time = 0;
-        pau->is_playing = TRUE;
-        pthread_mutex_unlock(pau->playback_time_mutex);
-    }
 
-    /* Update the sync information, if we can.  If we can't get the
-     * mutex, the caller is already reading it, so is going to miss
-     * this update anyway.  Therefore, don't bother updating it now.
-     *
-     * TODO is there a faster way than a mutex?
-     */
-    else if(0 == pthread_mutex_trylock(pau->playback_time_mutex)) {
-        pau->playback_time = (PaTime)pfr->pos_frames/pau->sample_rate;
-        pau->is_playing = TRUE;
-        pthread_mutex_unlock(pau->playback_time_mutex);
-    }
+        pthread_mutex_lock(&job.mutex);
+        while(job.running > 0) pthread_cond_wait(&job.done, &job.mutex);
+        pthread_mutex_unlock(&job.mutex);
+
+        for(t = 0; t < threads; ++t) AuPool_Cancel(pool, &tasks[t].task);
+
+        /* Remember what we found.  A cache we can't update is just a
+         * slower next time, so that doesn't fail the call. */
+        if(cache) {
+            for(i = 0; i < count; ++i) {
+                if(!job.to_store[i]) continue;
+                data.ok = infos[i].ok;
+                data.samplerate = infos[i].samplerate;
+                data.channels = infos[i].channels;
+                data.format = (int)infos[i].format;
+                data.len = infos[i].len;
+                if(!AuInfoCache_Store(cache, filenames[i], &job.keys[i],
+                                        &data)) {
+                    break;
+                }
+            }
+            AuInfoCache_Save(cache, cache_filename);
+        }
+
+        ok = TRUE;
+    } while(0);
+
+    AuPool_Delete(pool);
+    AuInfoCache_Delete(cache);
+    free(tasks);
+    free(job.to_store);
+    free(job.keys);
+    pthread_cond_destroy(&job.done);
+    pthread_mutex_destroy(&job.mutex);
+    return ok;
+} /* Au_InspectFiles */
+
+/** PortAudio callback to play data received from a file. */
+static int PAPlayCallback_(const void *input, void *output,
+    unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo,
+    PaStreamCallbackFlags statusFlags, void *handle )
+{
+#define MARK_NOT_PLAYING ClockStop_(pau)
+
+    unsigned long nframes;
+    Au_FrameCount clock_pos;
+    BOOL ended, done;
+    POW_UD_FAST
 
-    /* Output the data */
-    memcpy(output, (void *)pfr->data, bufferSizeBytes_(pau));
+    /* Fill the output from as many blocks as it takes */
+    nframes = StreamRead_(&pau->stream, (unsigned char *)output,
+                            frameCount, &clock_pos, &ended);
+    /* Ended, or no data ready (for now).  While waiting for the
+     * prefill, the reader just hasn't got going yet.  Otherwise, an
+     * empty ring is an underrun, which only ends playback with
+     * AUUP_STOP. */
+    done = ended || ( (nframes < frameCount) && !pau->stream.play_waiting );
+
+    if(nframes < frameCount) {   /* pad with silence */
+        memset((unsigned char *)output + nframes * pau->frame_bytes,
+                silenceByte_(pau->format),
+                (frameCount - nframes) * pau->frame_bytes);
+    }
 
-    /* Release the info block */
-    pfr = NULL;     /* because it's invalid once we advance the read index */
-    PaUtil_AdvanceRingBufferReadIndex(pau->sf_buffer, 1);
+    /* Update the sync information.  Never blocks. */
+    if(clock_pos >= 0) {
+        ClockPublish_(pau, clock_pos, frameCount,
+                timeInfo ? timeInfo->outputBufferDacTime : 0, !done);
+    }
 
-    if(state == PPPS_Stopped) {
+    if(done) {
         MARK_NOT_PLAYING;
+        pau->render_valid_frames = nframes;
         return paComplete;
     } else {
         return paContinue;
@@ -646,123 +3560,294 @@ static int PAPlayCallback_(const void *input, void *output,
 #undef MARK_NOT_PLAYING
 } /* PAPlayCallback_ */
 
-/** Play audio file #filename on output #handle. */
-BOOL Au_Play(HAU handle, const char *filename)
+/** Let go of the sample or tones an earlier Au_SamplePlay() or
+ * Au_PlayTones() left on #pau.  They stay there after they finish,
+ * until the next playback or Au_Stop().  The callback must be
+ * stopped. */
+static void OutputDropSources_(PAU pau)
 {
-    POW
-    if(!pau->pa_stream) return FALSE;
+    if(pau->sample) {
+        SampleRelease_(pau->sample);
+        pau->sample = NULL;
+    }
 
-    if(pau->sf_reader_thread) return FALSE;
-        /* For now --- TODO enqueue files */
+    AuOsc_Delete(pau->tones);
+    pau->tones = NULL;
+    free(pau->tone_float);
+    pau->tone_float = NULL;
+} /* OutputDropSources_ */
 
-    Pa_StopStream(pau->pa_stream);      /* just in case */
+/** Start playing #src on #pau: the guts of Au_Play() and friends.
+ * On failure, src->data is still the caller's. */
+static BOOL PlaySource_(PAU pau, const Au_Source *src)
+{
+    if(!OutputIsOpen_(pau)) return FALSE;
 
-    do { /* once */
+    if(pau->stream.sf_reader_active) return FALSE;
+        /* Use Au_Enqueue() to play files back-to-back */
+    if(pau->voices) return FALSE;   /* the mixer owns the stream */
 
-        /* sf_fd */
-        SF_INFO sf_info;
-        memset(&sf_info, 0, sizeof(sf_info));
-        pau->sf_fd = sf_open(filename, SFM_READ, &sf_info);
-        if(!pau->sf_fd) break;
+    OutputStop_(pau);       /* just in case */
+    OutputDropSources_(pau);    /* else Au_Seek() would look at them */
 
-        if( (sf_info.samplerate != (int)pau->sample_rate) ||    /* sanity check */
-            (sf_info.channels != 2) ) {
-            break;
-        }
+    do { /* once */
 
         /* Sync */
-        pau->is_playing = FALSE;
-        pau->playback_frames = 0;
-        pau->playback_time = -1.0;
-        pau->playback_start_time = -1.0;
+        ClockReset_(pau);
             /* negative => the player callback will initialize it. */
+        pau->clock_active = TRUE;
 
-        pau->playback_time_mutex = &pau->playback_time_mutex_storage;
-        if(0 != pthread_mutex_init(pau->playback_time_mutex, NULL)) break;
-
-        /* Ring buffer */
-        //int bufbytes = bufferSizeBytes_(pau);
-        //if(bufbytes == -1) break;
-
-        if((pau->sf_buffer_data =
-                    malloc(sizeof(FRBuf) * PA_RING_BUFFERCOUNT)) == NULL) break;
-        pau->sf_buffer = &pau->sf_buffer_storage;
-        if(-1 == PaUtil_InitializeRingBuffer(pau->sf_buffer,
-                    sizeof(FRBuf), PA_RING_BUFFERCOUNT, pau->sf_buffer_data)) {
-            break;
-        }
-
-        /* Threading */
-        pau->sf_reader_semaphore = &pau->sf_reader_semaphore_storage;
-        if(sem_init(pau->sf_reader_semaphore, 0, 1) == -1) {
-            /* initial value 1, so the reader will start to load data */
-            break;
-        }
-        pau->sf_reader_should_exit = FALSE;
-
-        pau->sf_reader_thread = &pau->sf_reader_thread_storage;
-        if(pthread_create(pau->sf_reader_thread, NULL,
-                    SFFileReader_, pau) != 0) {
-            break;
-        }
+        if(!StreamOpenSource_(&pau->stream, src)) break;
 
         pau->pa_callback_userdata = NULL;   /* everything's in pau */
         pau->pa_callback = PAPlayCallback_;
 
-        /* Fire away! */
-        if(Pa_StartStream(pau->pa_stream) != paNoError) break;
-        sched_yield();
-        Pa_Sleep(0);
-            /* hopefully this will let the initial sync in PAPlayCallback_
-             * happen before the caller does anything.
-             * No guarantees, though! */
+        /* Fire away!  The prefill is already decoded (see
+         * StreamOpenSource_()), so the first callback plays audio. */
+        if(!OutputStart_(pau)) break;
 
         return TRUE;
     } while(0);
 
-    /* Failure: roll back changes */
+    /* Failure: roll back changes, but leave src->data alone.  (The
+     * pipe never closes src->fd if opening it failed.) */
+    pau->stream.mem_owned = FALSE;
     Au_Stop((HAU)pau);
     return FALSE;
+} /* PlaySource_ */
+
+/** Play audio file #filename on output #handle. */
+BOOL Au_Play(HAU handle, const char *filename)
+{
+    Au_Source src;
+    POW
+    if(!filename) return FALSE;
+    memset(&src, 0, sizeof(src));
+    src.fd = -1;
+    src.filename = filename;
+    return PlaySource_(pau, &src);
 } /* Au_Play */
 
-BOOL Au_IsPlaying(HAU handle)
+BOOL Au_PlayMemory(HAU handle, const void *data, size_t len,
+        Au_Ownership ownership)
+{
+    Au_Source src;
+    POW
+    if(!data || !len) return FALSE;
+    if(ownership != AUOWN_BORROW && ownership != AUOWN_TAKE) return FALSE;
+    memset(&src, 0, sizeof(src));
+    src.fd = -1;
+    src.data = data;
+    src.len = len;
+    src.owned = (ownership == AUOWN_TAKE);
+    return PlaySource_(pau, &src);
+} /* Au_PlayMemory */
+
+BOOL Au_PlayMemoryRaw(HAU handle, const void *data, size_t len,
+        Au_SampleFormat format, int sample_rate, Au_Ownership ownership)
+{
+    Au_Source src;
+    POW
+    if(!data || !len || sample_rate <= 0) return FALSE;
+    if(ownership != AUOWN_BORROW && ownership != AUOWN_TAKE) return FALSE;
+    memset(&src, 0, sizeof(src));
+    src.fd = -1;
+    src.data = data;
+    src.len = len;
+    src.owned = (ownership == AUOWN_TAKE);
+    src.raw = TRUE;
+    src.raw_format = format;
+    src.raw_rate = sample_rate;
+    return PlaySource_(pau, &src);
+} /* Au_PlayMemoryRaw */
+
+BOOL Au_PlayFd(HAU handle, int fd, BOOL close_fd)
 {
+    Au_Source src;
     POW
-    BOOL retval = FALSE;
-    if(0 == pthread_mutex_lock(pau->playback_time_mutex)) {
-        retval = pau->is_playing;
-        pthread_mutex_unlock(pau->playback_time_mutex);
+    if(fd < 0) return FALSE;
+    memset(&src, 0, sizeof(src));
+    src.fd = fd;
+    src.close_fd = close_fd;
+    return PlaySource_(pau, &src);
+} /* Au_PlayFd */
+
+BOOL Au_PlayCallback(HAU handle, Au_ReadCallback read, void *user_data)
+{
+    Au_Source src;
+    POW
+    if(!read) return FALSE;
+    memset(&src, 0, sizeof(src));
+    src.fd = -1;
+    src.read = read;
+    src.read_data = user_data;
+    return PlaySource_(pau, &src);
+} /* Au_PlayCallback */
+
+/** Play audio file #filename on output #handle after whatever is
+ * already queued. */
+BOOL Au_Enqueue(HAU handle, const char *filename)
+{
+    PAU_QueueEntry entry;
+    size_t len;
+    int state;
+    POW
+    PAU_Stream pst = &pau->stream;
+    if(!filename) return FALSE;
+
+    len = strlen(filename);
+    if(!(entry = (PAU_QueueEntry)malloc(sizeof(Au_QueueEntry) + len + 1))) {
+        return FALSE;
+    }
+    entry->next = NULL;
+    memcpy(entry->filename, filename, len + 1);
+
+    /* If the reader is still going, it will pick up the new file.  If
+     * it has sent the PPPS_Stopped block, but the callback hasn't
+     * reached it yet, take it back, and the reader will carry on. */
+    pthread_mutex_lock(&pst->queue_mutex);
+    state = __atomic_load_n(&pst->eof_state, __ATOMIC_ACQUIRE);
+    if( pst->sf_reader_active &&
+        ( state == AUEOF_NONE || state == AUEOF_REVOKED ||
+          EofSwap_(pst, AUEOF_HELD, AUEOF_NONE) ||
+          EofSwap_(pst, AUEOF_SENT, AUEOF_REVOKED) ) ) {
+        pst->sf_reader_at_eof = FALSE;
+        if(pst->queue_tail) {
+            pst->queue_tail->next = entry;
+        } else {
+            pst->queue_head = entry;
+        }
+        pst->queue_tail = entry;
+        pthread_mutex_unlock(&pst->queue_mutex);
+        StreamWakeReader_(pst);     /* so it can pre-open */
+        return TRUE;
     }
+    pthread_mutex_unlock(&pst->queue_mutex);
+    free(entry);
+
+    /* Otherwise, playback has already ended, or is down to the last
+     * buffers the device has.  Start over. */
+    if(pst->sf_reader_active) Au_Stop(handle);
+    return Au_Play(handle, filename);
+} /* Au_Enqueue */
+
+BOOL Au_IsPlaying(HAU handle)
+{
+    POW
+    BOOL retval = pau->is_playing;
+    PaUtil_ReadMemoryBarrier();
     return retval;
 } /* Au_IsPlaying */
 
 double Au_GetTimeInPlayback(HAU handle)
 {
-    PaTime start, curr;
+    ClockSnapshot snap;
+    PaTime now;
+    double retval, end;
     POW_FAST
     if(!pau) {
         return -1.0;
     }
-    if(!pau->playback_time_mutex) {
+    if(!pau->clock_active) {
         return -2.0;
     }
 
-    if(0 == pthread_mutex_lock(pau->playback_time_mutex)) {
-        start = pau->playback_start_time;
-        curr = pau->playback_time;
-        pthread_mutex_unlock(pau->playback_time_mutex);
-    } else {
-        return -3.0;
+    ClockRead_(pau, &snap);
+    if(snap.pos_frames < 0) return 0.0;     /* not started yet */
+
+    retval = (double)snap.pos_frames / pau->sample_rate;
+
+    /* Interpolate from when the most recent buffer reaches the DAC.
+     * Before that, the listener is still hearing earlier buffers, so
+     * the time may be less than the buffer's start.  Don't run past
+     * the end of the buffer, though, in case the callback is late or
+     * playback has stopped. */
+    if(snap.is_playing && snap.dac_time > 0 && pau->pa_stream &&
+            (now = Pa_GetStreamTime(pau->pa_stream)) > 0) {
+        retval += now - snap.dac_time;
+        end = (double)(snap.pos_frames + snap.frames) / pau->sample_rate;
+        if(retval > end) retval = end;
+        if(retval < 0.0) retval = 0.0;
     }
 
-    return (double)(curr-start);
+    return retval;
 } /* Au_GetTimeInPlayback */
 
+BOOL Au_Seek(HAU handle, long int frame)
+{
+    PAU_Stream pst;
+    POW
+    if(frame < 0) return FALSE;
+    if(pau->voices) return FALSE;   /* the mixer has no one position */
+    if(pau->tones) return FALSE;    /* nor do tones */
+    if(!OutputIsActive_(pau)) return FALSE;
+
+    if(pau->sample) {
+        pau->sample_seek_frame = frame;
+        PaUtil_WriteMemoryBarrier();
+        ++pau->sample_seek_gen;
+        return TRUE;
+    }
+
+    pst = &pau->stream;
+    if(!pst->sf_reader_active) return FALSE;
+    if(pst->sf_pipe) return FALSE;     /* pipes can't seek */
+    pst->seek_frame = frame;
+    PaUtil_WriteMemoryBarrier();
+    ++pst->seek_gen;
+    StreamWakeReader_(pst);
+    return TRUE;
+} /* Au_Seek */
+
+BOOL Au_Wait(HAU handle)
+{
+    POW
+    if(pau->voices) return FALSE;   /* the mixer never finishes */
+    while(OutputIsActive_(pau)) Pa_Sleep(1);
+    return TRUE;
+} /* Au_Wait */
+
+BOOL Au_GetStats(HAU handle, Au_Stats *stats)
+{
+    Au_StatCounters *sc;
+    unsigned long n;
+    int i;
+    POW
+    if(!stats) return FALSE;
+    sc = &pau->stats;
+
+    memset(stats, 0, sizeof(Au_Stats));
+    stats->underruns = STAT_GET_(sc->underruns);
+    stats->ring_blocks = pau->ring_blocks;
+    stats->ring_fill_min = STAT_GET_(sc->fill_min);
+    if((n = STAT_GET_(sc->fill_samples)) > 0) {
+        stats->ring_fill_avg = (double)STAT_GET_(sc->fill_sum) / n;
+    }
+    stats->blocks_decoded = STAT_GET_(sc->decode_blocks);
+    if(stats->blocks_decoded > 0) {
+        stats->decode_ns_per_block = (double)STAT_GET_(sc->decode_ns) /
+                                        stats->blocks_decoded;
+    }
+    stats->reader_wakeups = STAT_GET_(sc->reader_wakeups);
+    stats->frames_rendered = STAT_GET_(sc->frames);
+    stats->callbacks = STAT_GET_(sc->callbacks);
+    for(i = 0; i < AU_STATS_HIST_BUCKETS; ++i) {
+        stats->callback_us_hist[i] = STAT_GET_(sc->callback_hist[i]);
+    }
+    if((n = STAT_GET_(sc->first_samples)) > 0) {
+        stats->first_sample_us =
+                STAT_GET_(sc->first_sample_last_ns) / 1000.0;
+        stats->first_sample_us_avg =
+                STAT_GET_(sc->first_sample_ns) / 1000.0 / n;
+    }
+    return TRUE;
+} /* Au_GetStats */
+
 BOOL Au_Stop(HAU handle)
 {
     POW
 
-    if(pau->pa_stream) Pa_StopStream(pau->pa_stream);      /* just in case */
+    OutputStop_(pau);       /* just in case */
 
     /* TODO? protect the callback with a mutex?  If the stream is
      * stopped, we shouldn't need to.
@@ -770,125 +3855,211 @@ BOOL Au_Stop(HAU handle)
     pau->pa_callback = PAEmptyCallback_;
     pau->pa_callback_userdata = NULL;
 
-    if(pau->sf_reader_thread) {
-        /* Tell the thread to exit */
-        pau->sf_reader_should_exit = TRUE;
-        sem_post(pau->sf_reader_semaphore);
+    StreamClose_(&pau->stream);
+    MixerClose_(pau);
 
-        /* Wait for the thread to exit */
-        if(pthread_join(*pau->sf_reader_thread, NULL) != 0) {
-            pthread_cancel(*pau->sf_reader_thread);
-            /* TODO is there a better way? */
-        }
-        pau->sf_reader_thread = NULL;
-    }
+    pau->clock_active = FALSE;
+    ClockReset_(pau);
 
-    if(pau->sf_reader_semaphore) {
-        sem_destroy(pau->sf_reader_semaphore);
-        pau->sf_reader_semaphore = NULL;
-    }
+    OutputDropSources_(pau);
+
+    return TRUE;
+} /* Au_Stop */
+
+/* Playback from memory =================================================== */
+
+/** PortAudio callback to play a cached sample. */
+static int PASamplePlayCallback_(const void *input, void *output,
+    unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo,
+    PaStreamCallbackFlags statusFlags, void *handle )
+{
+    Au_FrameCount nframes;
+    BOOL done;
+    POW_UD_FAST
+    PAU_Sample ps = pau->sample;
+
+    UNUSED(input);
+    UNUSED(statusFlags);
 
-    if(pau->sf_buffer) {
-        PaUtil_FlushRingBuffer(pau->sf_buffer);
-        pau->sf_buffer = NULL;
+    if(pau->sample_seek_gen != pau->sample_gen) {   /* Au_Seek() */
+        pau->sample_gen = pau->sample_seek_gen;
+        PaUtil_ReadMemoryBarrier();
+        pau->sample_pos = pau->sample_seek_frame;
+        if(pau->sample_pos > ps->frames) pau->sample_pos = ps->frames;
     }
 
-    if(pau->sf_buffer_data) {
-        free(pau->sf_buffer_data);
-        pau->sf_buffer_data = NULL;
+    nframes = ps->frames - pau->sample_pos;
+    if(nframes > (Au_FrameCount)frameCount) nframes = frameCount;
+    done = (pau->sample_pos + nframes >= ps->frames);
+
+    memcpy(output, ps->data + pau->sample_pos * ps->frame_bytes,
+            nframes * ps->frame_bytes);
+    if(nframes < (Au_FrameCount)frameCount) {   /* pad with silence */
+        memset((unsigned char *)output + nframes * ps->frame_bytes,
+                silenceByte_(ps->format),
+                (frameCount - nframes) * ps->frame_bytes);
     }
 
-    if(pau->playback_time_mutex) {
-        pthread_mutex_destroy(pau->playback_time_mutex);
-        pau->playback_time_mutex = NULL;
+    ClockPublish_(pau, pau->sample_pos, frameCount,
+            timeInfo ? timeInfo->outputBufferDacTime : 0, !done);
+    pau->sample_pos += nframes;
+
+    if(done) pau->render_valid_frames = nframes;
+    return done ? paComplete : paContinue;
+} /* PASamplePlayCallback_ */
+
+BOOL Au_SamplePlay(HAU handle, HAUSAMPLE sample)
+{
+    PAU_Sample ps = (PAU_Sample)sample;
+    POW
+    if(!OutputIsOpen_(pau) || !ps) return FALSE;
+
+    if( (ps->format != pau->format) ||
+        (ps->sample_rate != pau->sample_rate) ||
+        (ps->channels != pau->channels) ) {
+        return FALSE;
     }
-    pau->playback_time = -1.0;
-    pau->playback_start_time = -1.0;
-    pau->is_playing = FALSE;
 
-    if(pau->sf_fd) {
-        sf_close(pau->sf_fd);
-        pau->sf_fd = NULL;
+    Au_Stop(handle);    /* whatever was playing */
+
+    pthread_mutex_lock(&SampleCacheMutex_);
+    ++ps->refs;
+    SampleUnlink_(ps);
+    SampleLinkFront_(ps);
+    pthread_mutex_unlock(&SampleCacheMutex_);
+
+    pau->sample = ps;
+    pau->sample_pos = 0;
+    pau->sample_gen = pau->sample_seek_gen;
+    ClockReset_(pau);
+    pau->clock_active = TRUE;
+
+    pau->pa_callback_userdata = NULL;   /* everything's in pau */
+    pau->pa_callback = PASamplePlayCallback_;
+
+    if(!OutputStart_(pau)) {
+        Au_Stop(handle);
+        return FALSE;
     }
 
     return TRUE;
-} /* Au_Stop */
-
-/* Utility functions ====================================================== */
-void Au_msleep(long ms)
-{
-    Pa_Sleep(ms);
-}
+} /* Au_SamplePlay */
 
-/* High-level functions =================================================== */
+/* Tones ================================================================== */
 
-/** Callback to make a sine wave.  Currently only supports paFloat32
- * format.
- */
-unsigned long Sine_Most_Recent_frameCount = 0;
+/** Tones are rendered in float this many frames at a time, when the
+ * output format isn't AUSF_F32 */
+#define AU_TONE_CHUNK_FRAMES (256)
 
-static int PA_HL_Sine_Callback_(const void *input, void *output,
+/** PortAudio callback to play pau->tones. */
+static int PAToneCallback_(const void *input, void *output,
     unsigned long frameCount, const PaStreamCallbackTimeInfo* timeInfo,
     PaStreamCallbackFlags statusFlags, void *handle )
 {
+    unsigned long nframes = frameCount, done, chunk;
+    BOOL finished = FALSE;
     POW_UD_FAST
 
-    /* A debugging tool */
-    Sine_Most_Recent_frameCount = frameCount;
-
-    double freq_rad = *((double *)pud->data);
-    float *out = (float*)output;
-    unsigned int i;
-    double d;
-    PaTime t = timeInfo->outputBufferDacTime;   /* time for sample 0 */
-    double time_step = 1.0/pau->sample_rate;
-
     UNUSED(input);
     UNUSED(statusFlags);
 
-    for( i=0; i<frameCount; i++ )
-    {
-        d = sin(freq_rad * t);
-        *out++ = d; /* left */
-        *out++ = d; /* right */
-        t += time_step;
+    if( (pau->tone_frames_left >= 0) &&
+        ((Au_FrameCount)nframes >= pau->tone_frames_left) ) {
+        nframes = pau->tone_frames_left;
+        finished = TRUE;
     }
-    return paContinue;
-} /* PA_HL_Sine_Callback_ */
 
-BOOL Au_HL_Sine(HAU handle, double freq_Hz, int secs)
-{
-    double freq_rad = 2.0 * M_PI * freq_Hz;
-    PaError pa_err;
-    void *old_userdata;
-    PaStreamCallback *old_pacallback;
+    if(pau->format == AUSF_F32) {
+        AuOsc_Render(pau->tones, (float *)output, nframes);
+    } else {
+        for(done = 0; done < nframes; done += chunk) {
+            chunk = nframes - done;
+            if(chunk > AU_TONE_CHUNK_FRAMES) chunk = AU_TONE_CHUNK_FRAMES;
+            AuOsc_Render(pau->tones, pau->tone_float, chunk);
+            AuConv_FromFloat(pau->format, pau->tone_float,
+                    (unsigned char *)output + done * pau->frame_bytes,
+                    chunk * pau->channels,
+                    pau->dither ? &pau->tone_dither : NULL);
+        }
+    }
+    if(nframes < frameCount) {      /* pad with silence */
+        memset((unsigned char *)output + nframes * pau->frame_bytes,
+                silenceByte_(pau->format),
+                (frameCount - nframes) * pau->frame_bytes);
+    }
+
+    ClockPublish_(pau, pau->tone_pos, frameCount,
+            timeInfo ? timeInfo->outputBufferDacTime : 0, !finished);
+    pau->tone_pos += nframes;
+    if(pau->tone_frames_left >= 0) pau->tone_frames_left -= nframes;
+
+    if(finished) pau->render_valid_frames = nframes;
+    return finished ? paComplete : paContinue;
+} /* PAToneCallback_ */
 
+BOOL Au_PlayTones(HAU handle, const Au_Tone *tones, int count, double secs)
+{
+    AuOscBank *bank;
     POW
-    if(pau->format != AUSF_F32) return FALSE;
-    if(pau->channels != 2) return FALSE;
+    if(!OutputIsOpen_(pau) || !tones || count < 1) return FALSE;
+    if(pau->voices) return FALSE;   /* the mixer owns the stream */
+    if(!(secs > 0.0) && !pau->pa_stream) return FALSE;  /* forever */
+
+    if(!(bank = AuOsc_New(tones, count, pau->channels, pau->sample_rate))) {
+        return FALSE;
+    }
+
+    Au_Stop(handle);    /* whatever was playing */
 
-    Pa_StopStream(pau->pa_stream);      /* just in case */
+    pau->tones = bank;
+    if( (pau->format != AUSF_F32) &&
+        !(pau->tone_float = (float *)malloc((size_t)AU_TONE_CHUNK_FRAMES *
+                                pau->channels * sizeof(float))) ) {
+        Au_Stop(handle);
+        return FALSE;
+    }
+    AuConv_DitherInit(&pau->tone_dither, (unsigned int)(size_t)pau);
+    pau->tone_frames_left = (secs > 0.0) ?
+                (Au_FrameCount)(secs * pau->sample_rate + 0.5) : -1;
+    pau->tone_pos = 0;
+    ClockReset_(pau);
+    pau->clock_active = TRUE;
+
+    pau->pa_callback_userdata = NULL;   /* everything's in pau */
+    pau->pa_callback = PAToneCallback_;
+
+    if(!OutputStart_(pau)) {
+        Au_Stop(handle);
+        return FALSE;
+    }
 
-    const PaStreamInfo *strinfo;
-    if(!(strinfo=Pa_GetStreamInfo(pau->pa_stream))) return FALSE;
-    /* TODO? pass the stream params to the callback */
+    return TRUE;
+} /* Au_PlayTones */
 
-    old_userdata = pau->pa_callback_userdata;
-    pau->pa_callback_userdata = (void *)&freq_rad;
-    old_pacallback = pau->pa_callback;
-    pau->pa_callback = PA_HL_Sine_Callback_;
+/* Utility functions ====================================================== */
+void Au_msleep(long ms)
+{
+    Pa_Sleep(ms);
+}
 
-    pa_err = Pa_StartStream(pau->pa_stream);
-    if(pa_err != paNoError) return FALSE;
+/* High-level functions =================================================== */
 
-    Pa_Sleep(secs*1000);
+BOOL Au_HL_Sine(HAU handle, double freq_Hz, int secs)
+{
+    Au_Tone tone;
 
-    Pa_StopStream(pau->pa_stream);
+    if(secs <= 0) return TRUE;      /* nothing to play */
 
-    pau->pa_callback_userdata = old_userdata;
-    pau->pa_callback = old_pacallback;
+    memset(&tone, 0, sizeof(tone));
+    tone.wave = AUWF_SINE;
+    tone.freq_hz = freq_Hz;
+    tone.gain = 1.0f;
+    tone.channel = -1;
 
+    if(!Au_PlayTones(handle, &tone, 1, secs)) return FALSE;
+    Au_Wait(handle);
+    Au_Stop(handle);
     return TRUE;
-}
+} /* Au_HL_Sine */
 
 /* vi: set ts=4 sts=4 sw=4 et ai tw=72: */
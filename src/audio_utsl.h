@@ -44,14 +44,196 @@
  * output.  AU is re-entrant, so you can have multiple instances running
  * at a time.  The limit is the number of physical audio devices
  * available on the system --- you can run as many AU instances as you
- * want if they are all outputting to files.  There is a 1-1
+ * want if they are all outputting to files (see
+ * Au_Options.render_file).  There is a 1-1
  * relationship between AU instances and outputs.
  */
 typedef void *HAU;
 
+/** Sample formats.  AUSF_I24 is packed, 3 bytes per sample.
+ * AUSF_UI8 is offset binary, with silence at 0x80.  Files in any
+ * format libsndfile can read are converted to the output's format. */
 typedef enum Au_SampleFormat { AUSF_F32, AUSF_I32, AUSF_I24, AUSF_I16, AUSF_I8,
     AUSF_UI8, AUSF_CUSTOM } Au_SampleFormat;
 
+/** How an output trades latency for robustness.  See Au_NewEx(). */
+typedef enum Au_LatencyProfile {
+    /** What Au_New() uses.  256-frame blocks, 32 blocks of read-ahead
+     * (about 186 ms at 44.1 kHz), and the device's default high
+     * latency. */
+    AULP_DEFAULT,
+
+    /** 64-frame blocks, 16 blocks of read-ahead (about 23 ms at
+     * 44.1 kHz), and the device's default low latency.  For sounds
+     * that must start quickly, read from fast storage. */
+    AULP_INTERACTIVE,
+
+    /** 1024-frame blocks, 128 blocks of read-ahead (about 3 s at
+     * 44.1 kHz), and the device's default high latency.  For riding
+     * out stalls on slow or network storage. */
+    AULP_ROBUST
+} Au_LatencyProfile;
+
+/** How carefully to resample files whose sample rate differs from
+ * the output's.  Higher quality costs more CPU on the reader pool,
+ * never in the audio callback. */
+typedef enum Au_ResampleQuality {
+    /** Use the quality for the Au_LatencyProfile: AURQ_FAST for
+     * AULP_INTERACTIVE, AURQ_BEST for AULP_ROBUST, otherwise
+     * AURQ_MEDIUM. */
+    AURQ_PROFILE,
+
+    /** 8-tap filter.  Audible aliasing on bright material. */
+    AURQ_FAST,
+
+    /** 32-tap filter.  Fine for most listening. */
+    AURQ_MEDIUM,
+
+    /** 64-tap filter with a steep cutoff. */
+    AURQ_BEST
+} Au_ResampleQuality;
+
+/** What to do when the reader can't keep up and the read-ahead runs
+ * out.  See Au_Options.underrun_policy. */
+typedef enum Au_UnderrunPolicy {
+    /** Output silence and keep going once the read-ahead is back up to
+     * Au_Options.prefill_blocks.  A brief disk or CPU stall makes a
+     * click rather than stopping playback. */
+    AUUP_CONTINUE,
+
+    /** Stop, as if the file had ended */
+    AUUP_STOP
+} Au_UnderrunPolicy;
+
+/** Options for Au_NewEx().  Zero-initialize this, then set the fields
+ * you care about.  Fields left at 0 take their values from #profile. */
+typedef struct Au_Options {
+    /** The starting point for the other fields */
+    Au_LatencyProfile profile;
+
+    /** The number of frames in each block the reader passes to the
+     * playback callback.  At most 65535. */
+    long block_frames;
+
+    /** The number of blocks of read-ahead.  Rounded up to a power
+     * of 2.  With #adaptive, this is the most that will be used. */
+    long ring_blocks;
+
+    /** If TRUE, start with #min_ring_blocks of read-ahead.  Double it
+     * (up to #ring_blocks) whenever playback comes close to running
+     * dry, and halve it again once playback has been stable for a
+     * while. */
+    BOOL adaptive;
+
+    /** With #adaptive, the least read-ahead to use, in blocks.
+     * Rounded up to a power of 2.  If 0, #ring_blocks/8 (at least 2). */
+    long min_ring_blocks;
+
+    /** If TRUE, add TPDF dither when converting audio to an output
+     * format of 24 bits or less.  Worth it when playing higher-
+     * resolution files, or mixing, on a 16- or 8-bit output.  Not
+     * affected by #profile. */
+    BOOL dither;
+
+    /** How to resample files that don't match the output's rate */
+    Au_ResampleQuality resample_quality;
+
+    /** What to do on an underrun.  Each underrun is counted in
+     * Au_Stats.underruns either way.  Not affected by #profile. */
+    Au_UnderrunPolicy underrun_policy;
+
+    /** Blocks of read-ahead to wait for before starting playback, and
+     * before resuming after a seek or an underrun.  Until then, the
+     * output is silent.  Files shorter than this start as soon as they
+     * have been read.  If 0, #ring_blocks/4 (at least 1). */
+    long prefill_blocks;
+
+    /** If TRUE, mlock() each ring buffer, so the callback can't page-
+     * fault on it even when memory is tight.  Needs enough
+     * RLIMIT_MEMLOCK; if locking fails, playback goes ahead unlocked.
+     * Not affected by #profile. */
+    BOOL lock_memory;
+
+    /** If TRUE, put each ring buffer on huge pages (Linux only), which
+     * cuts TLB misses in the callback.  Each ring then takes at least
+     * one huge page (2 MiB), so this is for a few large outputs, not
+     * many small ones.  Not affected by #profile. */
+    BOOL huge_pages;
+
+    /** How far ahead to read files, in reads of #file_chunk_bytes,
+     * plus two.  Built with io_uring, each open file caches this many
+     * reads; otherwise, the kernel is asked to read ahead as far, and
+     * each file caches just two.  At least 3.  If 0, 8.  Not affected
+     * by #profile. */
+    int file_chunks;
+
+    /** The size of each read from a file.  If 0, 64 KiB.  Not affected
+     * by #profile. */
+    long file_chunk_bytes;
+
+    /** If non-NULL, render to this file instead of playing on the
+     * default device.  Audio goes through the same reader, ring buffer
+     * and callback, but as fast as the CPU allows, with no underruns
+     * and no device needed.  Everything played on the output is
+     * written to the file back to back, without the silence that pads
+     * the end of each playback.  Use Au_Wait() to wait for a playback
+     * to finish.  The mixer isn't available, and Au_PlayTones() needs
+     * a length.  Not affected by #profile.  If "", the output is
+     * thrown away, which is handy for benchmarks. */
+    const char *render_file;
+
+    /** With #render_file, the libsndfile format (SF_FORMAT_*
+     * major format | subtype) of the file.  If 0, WAV in the output's
+     * sample format (unsigned for the 8-bit formats). */
+    int render_format;
+} Au_Options;
+
+/** The number of buckets in Au_Stats.callback_us_hist */
+#define AU_STATS_HIST_BUCKETS (16)
+
+/** Counters for an output, from Au_GetStats().  They count from
+ * Au_New() on, across all playbacks. */
+typedef struct Au_Stats {
+    /** How many times the callback ran out of data partway through a
+     * playback */
+    unsigned long underruns;
+
+    /** Blocks of read-ahead at the start of each callback: the fewest
+     * seen (-1 if none yet), and the average.  Out of #ring_blocks.
+     * Not counted before the first block of a playback arrives. */
+    long ring_fill_min;
+    double ring_fill_avg;
+    long ring_blocks;
+
+    /** Blocks the reader has decoded (and converted and resampled), and
+     * the average time each took */
+    unsigned long blocks_decoded;
+    double decode_ns_per_block;
+
+    /** How many times a reader has been run on the reader pool */
+    unsigned long reader_wakeups;
+
+    /** Frames the callback has handed to the device (or render file),
+     * including silence */
+    unsigned long long frames_rendered;
+
+    /** How many times the callback has run, and how long it took.
+     * callback_us_hist[0] counts calls under 1 us; callback_us_hist[i]
+     * counts calls of at least 2^(i-1) us and under 2^i us.  The last
+     * bucket also counts everything longer. */
+    unsigned long callbacks;
+    unsigned long callback_us_hist[AU_STATS_HIST_BUCKETS];
+
+    /** Time to first sample: from Au_Play() (or another call that
+     * starts a playback, or a mixer voice playing a file) until the
+     * callback first hands that playback's audio to the device, in
+     * microseconds.  For the latest playback, and the average over all
+     * of them.  0 if none yet.  The device's own output latency comes
+     * on top of this. */
+    double first_sample_us;
+    double first_sample_us_avg;
+} Au_Stats;
+
 /* Initialization and termination functions ------------------------------ */
 
 /** Initialize AU.  Must be called before any other functions.
@@ -64,6 +246,19 @@ extern BOOL Au_Startup();
  */
 extern BOOL Au_Shutdown();
 
+/** Set how many threads read and decode files for all outputs.  Every
+ * stream (Au_Play(), each file voice in the mixer) shares them, and
+ * they serve the streams with the least read-ahead left first.  Call
+ * before Au_Startup(), or between Au_Shutdown() and the next
+ * Au_Startup().
+ * @param threads How many.  If 0, one per CPU, up to 8.
+ * @param cpus If non-NULL, #ncpus CPU numbers.  Thread i runs only on
+ *          cpus[i % ncpus], where the platform supports it (Linux).
+ *          Copied, so it doesn't have to outlive the call.
+ * @return TRUE on success; FALSE on failure, e.g., if called while AU
+ *          is running. */
+extern BOOL Au_SetReaderThreads(int threads, const int *cpus, int ncpus);
+
 /** Create a new output.
  * @param format The output format
  * @param sample_rate The sample rate, in Hz
@@ -74,6 +269,19 @@ extern BOOL Au_Shutdown();
 extern HAU Au_New(Au_SampleFormat format, int sample_rate,
         int channels, void *user_data);
 
+/** Create a new output with specific buffering.  Au_New() is
+ * Au_NewEx() with #options NULL.
+ * @param format The output format
+ * @param sample_rate The sample rate, in Hz
+ * @param channels How many channels
+ * @param options If non-NULL, how to buffer.  Copied, so it doesn't
+ *          have to outlive the call.  If NULL, AULP_DEFAULT.
+ * @param user_data Currently unused
+ * @return non-NULL on success; NULL on failure
+ */
+extern HAU Au_NewEx(Au_SampleFormat format, int sample_rate,
+        int channels, const Au_Options *options, void *user_data);
+
 /** Close an output.  If this succeeds, any memory associated witht that
  * output has been freed.
  * @param handle {HAU} The output to shut down
@@ -90,30 +298,306 @@ extern BOOL Au_Delete(HAU handle);
  * @format Will be filled in with the sample format on success.
  *          If the format is unknown to audio-utsl, the return value
  *          will be AUSF_CUSTOM.
- * @len If non-NULL and #filename is seekable, will be filled in with
- *          the number of frames on success.
+ * @len If non-NULL, will be filled in with the number of frames on
+ *          success, or -1 if that isn't known (e.g., #filename is a
+ *          FIFO).
  * @return TRUE on success; FALSE on failure. */
 BOOL Au_InspectFile(const char *filename, int *samplerate, int *channels,
         Au_SampleFormat *format, long int *len);
 
-/** Play audio file #filename on output #handle. */
+/** What Au_InspectFiles() found out about one file */
+typedef struct Au_FileInfo {
+    /** TRUE if the file could be opened.  The other fields are only
+     * meaningful if so. */
+    BOOL ok;
+
+    int samplerate;
+    int channels;
+
+    /** As for Au_InspectFile() */
+    Au_SampleFormat format;
+
+    /** The number of frames, or -1 if that isn't known */
+    long int len;
+} Au_FileInfo;
+
+/** Inspect many files at once, as Au_InspectFile() would, on a pool of
+ * threads.  Doesn't need Au_Startup().
+ * @param filenames #count files
+ * @param infos Filled in with what was found out about each file
+ * @param cache_filename If non-NULL, a cache file.  Files whose size and
+ *          modification time match what the cache has for them aren't
+ *          opened.  The cache is then updated with the others, except
+ *          for failures that might not happen again, such as I/O
+ *          errors; only files libsndfile can't read at all are cached
+ *          as failures.  If it can't be read, it is started over.  If
+ *          it can't be written, the call still succeeds.
+ * @return TRUE on success, even if some files couldn't be opened (see
+ *          Au_FileInfo.ok); FALSE on bad arguments or out of memory. */
+BOOL Au_InspectFiles(const char *const *filenames, size_t count,
+        Au_FileInfo *infos, const char *cache_filename);
+
+/** Play audio file #filename on output #handle.  The file must have
+ * the same number of channels as the output.  Any number of channels
+ * is supported.  If the file's sample rate is different from the
+ * output's, it is resampled (see Au_Options.resample_quality). */
 BOOL Au_Play(HAU handle, const char *filename);
 
+/** Who frees a buffer passed to Au_PlayMemory() or Au_PlayMemoryRaw() */
+typedef enum Au_Ownership {
+    /** The caller does, once playback has stopped (Au_Stop(),
+     * Au_Delete(), or when it ends on its own and Au_IsPlaying() is
+     * FALSE).  Until then, the buffer must not change. */
+    AUOWN_BORROW,
+
+    /** Audio-utsl free()s it when it's done with it.  Only if the call
+     * succeeds: on failure, the caller still owns the buffer. */
+    AUOWN_TAKE
+} Au_Ownership;
+
+/** Play a whole audio file that is already in memory, e.g., from an
+ * archive, on output #handle.  Like Au_Play(), but #data is read in
+ * place as playback goes, not copied.
+ * @param data The file's contents: #len bytes in any format libsndfile
+ *          can read
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_PlayMemory(HAU handle, const void *data, size_t len,
+        Au_Ownership ownership);
+
+/** Play #len bytes of headerless, interleaved PCM at #data on output
+ * #handle.  It must have as many channels as the output.  If #format
+ * and #sample_rate are the output's, the reader copies frames straight
+ * from #data into the ring buffer, with no decoding at all.
+ * Otherwise, they are converted and resampled as for a file.  Samples
+ * are in the CPU's byte order (AUSF_I24: packed little-endian).
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_PlayMemoryRaw(HAU handle, const void *data, size_t len,
+        Au_SampleFormat format, int sample_rate, Au_Ownership ownership);
+
+/** Play from file descriptor #fd, e.g., a pipe from a transcoder
+ * process or a socket, on output #handle.  The data can be in any
+ * format libsndfile can read from a stream (e.g., WAV, AU, FLAC, Ogg),
+ * with as many channels as the output.  A thread of the stream's own
+ * reads #fd into a large buffer, and the data is decoded from there,
+ * so a slow source doesn't hold up anything else.  Au_Seek() fails
+ * while playing from a pipe.  Au_Enqueue() works as usual.
+ * Doesn't wait for the data: the output is silent until the header
+ * and the first blocks of audio have arrived.  If the data turns out
+ * not to be playable, playback ends as if it were empty.  Au_Stop()
+ * gives up on a source that hasn't sent anything yet.
+ * @param close_fd If TRUE, #fd is closed when playback stops.  Only if
+ *          the call succeeds: on failure, the caller still owns #fd.
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_PlayFd(HAU handle, int fd, BOOL close_fd);
+
+/** Reads data for Au_PlayCallback().  Called on a thread of its own,
+ * so it may block.
+ * @param buf Where to put up to #len bytes
+ * @return How many bytes it read, 0 at the end of the data, or <0 on
+ *          error, which also ends playback. */
+typedef long (*Au_ReadCallback)(void *user_data, void *buf, size_t len);
+
+/** As Au_PlayFd(), but reading by calling #read with #user_data until
+ * it returns 0 or less.  Once playback stops, #read is not called
+ * again.  Au_Stop() doesn't wait for a call that is already blocked:
+ * that call returns on its own thread, and what it read is thrown
+ * away.  So keep #user_data valid until then. */
+BOOL Au_PlayCallback(HAU handle, Au_ReadCallback read, void *user_data);
+
+/** Play audio file #filename on output #handle once everything already
+ * playing or queued has finished, with no gap in between.  The next
+ * file is opened ahead of time and decoded into the same buffer as
+ * the current one, so playback is sample-contiguous.  Files that
+ * can't be opened, or that don't have as many channels as the output,
+ * are skipped.  Files at other sample rates are resampled.
+ *
+ * If nothing is playing, this is the same as Au_Play().  The end of
+ * playback isn't committed to until the buffer has drained to its low
+ * watermark, and even after that a new file still joins without a gap
+ * until playback reaches the end.  Only if the call comes later than
+ * that, with the device playing out its last buffers, does this stop
+ * the output and start #filename afresh.  Never waits for playback to
+ * finish.
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_Enqueue(HAU handle, const char *filename);
+
 /** Returns true if #handle is probably playing a file, false if
  * probably not.  Not guaranteed, since audio_utsl does not yet have
  * the world's most thorough error handling.
- * Also, may not be true immediately after an Au_Play() call. */
+ * Also, may not be true immediately after an Au_Play() call.
+ * Lock-free. */
 BOOL Au_IsPlaying(HAU handle);
 
-/** Get the time since playback started, after an Au_Play() call.
+/** Get the time since the current file started playing, after an
+ * Au_Play() call.
+ * Interpolated from when the most recent buffer reaches the DAC.
+ * Lock-free, so you can poll it as often as you like without
+ * disturbing the audio thread.
  * @return the time, or <0 in case of error. */
 double Au_GetTimeInPlayback(HAU handle);
 
+/** Jump to frame #frame of what #handle is playing, counting at the
+ * output's sample rate (as Au_GetTimeInPlayback() does).  Read-ahead
+ * from before the seek is thrown away, and playback resumes at exactly
+ * #frame, after a short silence while the reader catches up.  Works
+ * after Au_Play(), Au_Enqueue() and Au_SamplePlay(), but not on a
+ * mixer.  If the reader has already moved on to the next queued file
+ * (which happens up to the read-ahead time before the current one
+ * ends), seeks in that file.  Seeking past the end ends the file.
+ * @return TRUE on success; FALSE if nothing is playing or #frame is
+ *          negative. */
+BOOL Au_Seek(HAU handle, long int frame);
+
+/** Wait until what #handle is playing has finished.  Mostly for
+ * outputs that render to a file (Au_Options.render_file).
+ * @return TRUE once playback has finished; FALSE if #handle is a
+ *          mixer, which never finishes. */
+BOOL Au_Wait(HAU handle);
+
+/** Get #handle's statistics.  Cheap and lock-free; the counters are
+ * always on.
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_GetStats(HAU handle, Au_Stats *stats);
+
 /** Stop a playback that was started with Au_Play.
  * @return FALSE on invalid #hau; otherwise TRUE.
  */
 BOOL Au_Stop(HAU hau);
 
+/* Cached-sample functions ----------------------------------------------- */
+
+/** A file decoded into memory, for sounds you play over and over.
+ * See Au_SampleLoad(). */
+typedef void *HAUSAMPLE;
+
+/** Set how much memory the decoded-sample cache may use.  Samples that
+ * aren't loaded or playing are evicted, least recently used first,
+ * when the cache is over budget.  Samples that are in use are never
+ * evicted, so the cache can go over budget if they add up to more
+ * than #bytes.  The default is 64 MiB. */
+void Au_SampleSetCacheBudget(size_t bytes);
+
+/** Decode all of #filename into memory, ready to play on #handle.  If
+ * the file is already in the cache in #handle's format, sample rate
+ * and channel count, no decoding is done.  The file must match
+ * #handle's sample rate and channel count.
+ * @return A sample to pass to Au_SamplePlay() and, eventually, to
+ *          Au_SampleFree(); or NULL on failure. */
+HAUSAMPLE Au_SampleLoad(HAU handle, const char *filename);
+
+/** Play #sample on #handle, straight from memory.  No file is opened
+ * and nothing runs on the reader pool.  Stops whatever #handle was
+ * playing.  Use Au_Stop(), Au_IsPlaying() and Au_GetTimeInPlayback()
+ * as with Au_Play().  #sample must have come from Au_SampleLoad() on
+ * an output with the same format, sample rate and channel count.
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_SamplePlay(HAU handle, HAUSAMPLE sample);
+
+/** Release a sample from Au_SampleLoad().  Its data stays in the cache
+ * for the next Au_SampleLoad() of the same file, until it is evicted.
+ * It is safe to call this while the sample is playing.
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_SampleFree(HAUSAMPLE sample);
+
+/* Mixer functions ------------------------------------------------------- */
+
+/** Turn #handle into a mixer, so it can play several sounds at once on
+ * one device stream.  Each sound is a "voice": a cached sample or a
+ * file.  Voices are converted to float, scaled by their gain, summed,
+ * and run through a soft limiter so loud mixes don't clip harshly.
+ * The output keeps running, silent when no voices are playing, until
+ * Au_Stop().  Stops whatever #handle was playing.
+ *
+ * While the mixer is running, Au_Play() fails, Au_IsPlaying() reports
+ * whether any voice is playing, and Au_GetTimeInPlayback() is the time
+ * since Au_MixerStart().
+ * @param max_voices The most voices that may play at once.  When that
+ *          many are playing, a new voice steals the lowest-priority one
+ *          (the oldest, if there is a tie), unless that voice has a
+ *          higher priority than the new one.
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_MixerStart(HAU handle, int max_voices);
+
+/** Start a voice playing #sample on mixer #handle.  #sample must have
+ * come from Au_SampleLoad() on an output with the same format, sample
+ * rate and channel count.
+ * @param gain The voice's volume.  1.0 plays it as-is.
+ * @param priority Higher-priority voices are stolen last.
+ * @return A voice ID, or -1 on failure or if there was no voice free
+ *          to steal. */
+long Au_MixerPlaySample(HAU handle, HAUSAMPLE sample, float gain,
+        int priority);
+
+/** Start a voice streaming #filename on mixer #handle, as for
+ * Au_MixerPlaySample().  Each file voice has its own read-ahead, and
+ * its reader runs on the shared reader pool, as for Au_Play().  The
+ * file is opened and pre-rolled on the calling thread.  The file must
+ * match #handle's channel count, and is resampled if its rate is
+ * different.
+ * @return A voice ID, or -1 on failure. */
+long Au_MixerPlayFile(HAU handle, const char *filename, float gain,
+        int priority);
+
+/** Change the gain of #voice.  The change is ramped over a few
+ * milliseconds so it doesn't click.
+ * @return TRUE on success; FALSE if #voice has finished. */
+BOOL Au_MixerSetGain(HAU handle, long voice, float gain);
+
+/** Fade out and stop #voice.
+ * @return TRUE on success; FALSE if #voice has already finished. */
+BOOL Au_MixerStopVoice(HAU handle, long voice);
+
+/** Get the number of voices playing on mixer #handle, not counting
+ * any being faded out.  Also frees finished voices' resources. */
+int Au_MixerActiveVoices(HAU handle);
+
+/* Tone functions -------------------------------------------------------- */
+
+/** Waveforms for Au_Tone */
+typedef enum Au_Waveform {
+    AUWF_SINE,
+    /** Square, saw and triangle are not band-limited, so they alias
+     * at high frequencies */
+    AUWF_SQUARE,
+    AUWF_SAW,
+    AUWF_TRIANGLE,
+    /** White noise, uniform in [-#gain, #gain).  #freq_hz is ignored. */
+    AUWF_NOISE
+} Au_Waveform;
+
+/** One oscillator for Au_PlayTones().  Zero-initialize this, then set
+ * the fields you care about. */
+typedef struct Au_Tone {
+    Au_Waveform wave;
+
+    /** The frequency, or the start of a sweep */
+    double freq_hz;
+
+    /** If nonzero, sweep from #freq_hz to this over #sweep_secs, then
+     * stay there */
+    double end_freq_hz;
+    double sweep_secs;
+
+    /** If TRUE, sweep exponentially (the same number of octaves per
+     * second throughout), rather than linearly */
+    BOOL sweep_log;
+
+    /** The amplitude.  1.0 is full scale. */
+    float gain;
+
+    /** The channel to play on, from 0, or -1 for all channels */
+    int channel;
+} Au_Tone;
+
+/** Start playing the sum of #count tones on #handle, in its own format
+ * and channel count, and return at once.  Stops whatever #handle was
+ * playing.  Au_IsPlaying(), Au_GetTimeInPlayback(), Au_Wait() and
+ * Au_Stop() work as for files; Au_Seek() doesn't.
+ * @param secs How long to play, or 0 to play until Au_Stop().  Must be
+ *          nonzero when rendering to a file.
+ * @return TRUE on success; FALSE on failure. */
+BOOL Au_PlayTones(HAU handle, const Au_Tone *tones, int count, double secs);
+
 /* Utility functions ----------------------------------------------------- */
 
 /** Sleep for approximately #ms milliseconds.
@@ -124,8 +608,8 @@ void Au_msleep(long ms);
 
 #ifdef AU_HIGH_LEVEL
 
-/** Play a sine wave for #secs seconds at #freq_Hz.
- * Only supports the AUSF_F32 format, 2 channels.
+/** Play a full-scale sine wave for #secs seconds at #freq_Hz on all
+ * channels, and wait for it to finish.  Au_PlayTones() doesn't wait.
  * @return FALSE if an error occurs; otherwise, TRUE.
  */
 extern BOOL Au_HL_Sine(HAU handle, double freq_Hz, int secs);